@@ -1,7 +1,9 @@
 #include <cmath>
+#include <vector>
 #include <benchmark/benchmark.h>
 #include <rect.h>
 #include <bitmap.h>
+#include <bitmap_effects.h>
 #include <pixel_format.h>
 #include <transform.h>
 
@@ -277,6 +279,60 @@ static void BM_ToneBlit(benchmark::State& state) {
 
 BENCHMARK(BM_ToneBlit);
 
+static void BM_ToneBlitSat(benchmark::State& state) {
+	Bitmap::SetFormat(format);
+	auto dest = Bitmap::Create(320, 240);
+	auto src = Bitmap::Create(320, 240);
+	auto rect = src->GetRect();
+	auto tone = Tone(200,60,90,40);
+	for (auto _: state) {
+		dest->ToneBlit(0, 0, *src, rect, tone, opacity);
+	}
+}
+
+BENCHMARK(BM_ToneBlitSat);
+
+// One 320x240 screen through the tone kernel, range(0) is the backend
+// and range(1) the AlphaMode
+static void BM_ToneRow(benchmark::State& state) {
+	auto backend = static_cast<BitmapEffects::Backend>(state.range(0));
+	auto default_backend = BitmapEffects::GetBackend();
+	if (!BitmapEffects::SetBackend(backend)) {
+		state.SkipWithError("Backend not supported");
+		return;
+	}
+	state.SetLabel(BitmapEffects::GetBackendName(backend));
+
+	BitmapEffects::ToneParams params;
+	params.rs = 24;
+	params.gs = 16;
+	params.bs = 8;
+	params.as = 0;
+	params.apply_sat = true;
+	params.sat = 40 * 8;
+	params.apply_tone = true;
+	params.red = 200;
+	params.green = 60;
+	params.blue = 90;
+	params.alpha = static_cast<BitmapEffects::AlphaMode>(state.range(1));
+
+	std::vector<uint32_t> pixels(320 * 240);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		pixels[i] = static_cast<uint32_t>(i * 2654435761u);
+	}
+	for (auto _: state) {
+		BitmapEffects::ToneRow(pixels.data(), pixels.size(), params);
+	}
+	state.SetItemsProcessed(state.iterations() * pixels.size());
+	BitmapEffects::SetBackend(default_backend);
+}
+
+BENCHMARK(BM_ToneRow)->ArgsProduct({
+	{ static_cast<int>(BitmapEffects::Backend::Scalar), static_cast<int>(BitmapEffects::Backend::SSE2),
+		static_cast<int>(BitmapEffects::Backend::AVX2), static_cast<int>(BitmapEffects::Backend::NEON) },
+	{ static_cast<int>(BitmapEffects::AlphaMode::Opaque), static_cast<int>(BitmapEffects::AlphaMode::Alpha_8Bit) }
+});
+
 static void BM_BlendBlit(benchmark::State& state) {
 	Bitmap::SetFormat(format);
 	auto dest = Bitmap::Create(320, 240);
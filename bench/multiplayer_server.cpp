@@ -0,0 +1,257 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multiplayer/server.h"
+#include "multiplayer/socket.h"
+#include "multiplayer/connection.h"
+#include "multiplayer/messages.h"
+#include "game_config.h"
+#include "output.h"
+
+/**
+ * Load test of the multiplayer server
+ *  ServerMain runs on loopback in this process, every synthetic client is
+ *  a ConnectorSocket with its own loop thread. The clients of a run join
+ *  the same room and send rounds of packets at the given rate:
+ *  a move every round, a chat message every 20 and a picture every 40 rounds.
+ *
+ * Reported counters:
+ *  sent, delivered: packets per second sent by the clients and received from the server
+ *  p50_us, p99_us: fan-out latency of the moves, from sending to receiving
+ *  rss_kb/client, cpu%/client: growth of the process, which also contains the clients
+ */
+
+using namespace Messages;
+
+constexpr uint16_t bench_port = 16500;
+constexpr size_t send_times_size = 1 << 16;
+
+static int64_t Now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the move sequence number is sent as x, indexes the sending time
+static std::vector<std::atomic<int64_t>> send_times(send_times_size);
+static std::atomic<int> move_seq{0};
+
+class BenchClient : public Multiplayer::Connection {
+	ConnectorSocket socket;
+
+	std::mutex m_latency_mutex;
+	std::vector<int64_t> latencies;
+
+public:
+	std::atomic<bool> connected{false};
+	std::atomic<bool> failed{false};
+	std::atomic<bool> in_room{false};
+	std::atomic<uint64_t> received{0};
+
+	BenchClient() {
+		RegisterHandler<RoomPacket>([this](RoomPacket& p) { in_room = true; });
+		RegisterHandler<ProtocolPacket>([this](ProtocolPacket& p) { SetProtocol(p.version); });
+		RegisterHandler<MovePacket>([this](MovePacket& p) {
+			int64_t latency = Now() - send_times[p.x % send_times_size];
+			std::lock_guard lock(m_latency_mutex);
+			latencies.push_back(latency);
+			++received;
+		});
+		RegisterHandler<ChatPacket>([this](ChatPacket& p) { ++received; });
+		RegisterHandler<ShowPicturePacket>([this](ShowPicturePacket& p) { ++received; });
+		RegisterHandler<ErasePicturePacket>([this](ErasePicturePacket& p) { ++received; });
+	}
+
+	void Open() override {
+		socket.OnInfo = [](std::string_view m) {};
+		socket.OnWarning = [](std::string_view m) { Output::Warning("Bench: {}", m); };
+		socket.SetRemoteAddress("127.0.0.1", bench_port);
+		socket.ConfigSocks5("", 0);
+		socket.OnData = [this](std::string_view data) { Dispatch(data); };
+		socket.OnConnect = [this]() { connected = true; };
+		socket.OnFail = [this]() { failed = true; };
+		socket.OnDisconnect = []() {};
+		socket.Connect();
+	}
+
+	void Close() override {
+		socket.Close();
+	}
+
+	void Send(std::string_view data) override {
+		socket.Send(data);
+	}
+
+	void SendRound(int round) {
+		int seq = move_seq++;
+		send_times[seq % send_times_size] = Now();
+		SendPacket(MovePacket(0, seq, round & 0xFF));
+		if (round % 20 == 0)
+			SendPacket(ChatPacket(CV_LOCAL, "benchmark message"));
+		if (round % 40 == 0) {
+			Game_Pictures::ShowParams params;
+			params.name = "bench";
+			SendPacket(ShowPicturePacket(1, params, 0, 0, 0, 0));
+			SendPacket(ErasePicturePacket(1));
+		}
+	}
+
+	void TakeLatencies(std::vector<int64_t>& out) {
+		std::lock_guard lock(m_latency_mutex);
+		out.insert(out.end(), latencies.begin(), latencies.end());
+		latencies.clear();
+	}
+};
+
+static void StartServer() {
+	static bool started = []() {
+		Game_ConfigMultiplayer cfg;
+		cfg.server_bind_address.Set("127.0.0.1:" + std::to_string(bench_port));
+		cfg.server_max_users.Set(100);
+		cfg.no_heartbeats.Set(true);
+		Server().SetConfig(cfg);
+		Server().Start();
+		return true;
+	}();
+	(void)started;
+}
+
+template<typename F>
+static bool WaitFor(F&& condition) {
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (!condition()) {
+		if (std::chrono::steady_clock::now() > deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+static size_t CountServerClients() {
+	size_t count = 0;
+	Server().ForEachClient([&count](auto&) { ++count; });
+	return count;
+}
+
+static double CpuSeconds() {
+	uv_rusage_t usage;
+	if (uv_getrusage(&usage))
+		return 0;
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static size_t RssBytes() {
+	size_t rss = 0;
+	uv_resident_set_memory(&rss);
+	return rss;
+}
+
+// the connector threads are detached, so the clients must outlive them
+static std::vector<std::unique_ptr<BenchClient>> retired_clients;
+
+static void BM_ServerFanOut(benchmark::State& state) {
+	const size_t num_clients = state.range(0);
+	const int rate = state.range(1);
+	const bool binary = state.range(2) != 0;
+	// each run has its own room, the clients of the previous runs may still be closing
+	static int room_id = 1000;
+	++room_id;
+
+	StartServer();
+	// the previous clients have left
+	WaitFor([]() { return CountServerClients() == 0; });
+
+	size_t rss_before = RssBytes();
+
+	std::vector<std::unique_ptr<BenchClient>> clients;
+	for (size_t i = 0; i < num_clients; ++i) {
+		clients.emplace_back(new BenchClient());
+		clients.back()->Open();
+	}
+	bool ok = WaitFor([&clients]() {
+		return std::all_of(clients.begin(), clients.end(), [](auto& c) {
+			return c->connected || c->failed; });
+	});
+	ok = ok && std::none_of(clients.begin(), clients.end(), [](auto& c) { return c->failed.load(); });
+	if (ok) {
+		for (auto& client : clients) {
+			if (binary)
+				client->SendPacket(ProtocolPacket(Multiplayer::Packet::PROTOCOL_BINARY));
+			client->SendPacket(RoomPacket(room_id));
+		}
+		ok = WaitFor([&clients]() {
+			return std::all_of(clients.begin(), clients.end(), [](auto& c) { return c->in_room.load(); });
+		});
+	}
+	if (!ok) {
+		state.SkipWithError("the clients could not join the server");
+	} else {
+		// the join snapshots are not part of the measurement
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		std::vector<int64_t> latencies;
+		for (auto& client : clients) {
+			client->TakeLatencies(latencies);
+			client->received = 0;
+		}
+
+		const auto interval = std::chrono::microseconds(1000000 / rate);
+		double cpu_before = CpuSeconds();
+		auto begin = std::chrono::steady_clock::now();
+		auto next_round = begin;
+		uint64_t sent = 0;
+		int round = 1;
+		for (auto _ : state) {
+			for (auto& client : clients)
+				client->SendRound(round);
+			sent += num_clients * (1 + (round % 20 == 0) + 2 * (round % 40 == 0));
+			++round;
+			next_round += interval;
+			std::this_thread::sleep_until(next_round);
+		}
+		// let the last round arrive
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		double cpu = CpuSeconds() - cpu_before;
+		size_t rss_after = RssBytes();
+
+		uint64_t delivered = 0;
+		for (auto& client : clients) {
+			client->TakeLatencies(latencies);
+			delivered += client->received;
+		}
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&latencies](double p) {
+			if (latencies.empty())
+				return 0.0;
+			return latencies[static_cast<size_t>(p * (latencies.size() - 1))] / 1000.0;
+		};
+
+		state.counters["sent"] = benchmark::Counter(sent / seconds);
+		state.counters["delivered"] = benchmark::Counter(delivered / seconds);
+		state.counters["p50_us"] = percentile(0.50);
+		state.counters["p99_us"] = percentile(0.99);
+		state.counters["rss_kb/client"] = rss_after > rss_before ?
+			(rss_after - rss_before) / 1024.0 / num_clients : 0.0;
+		state.counters["cpu%/client"] = cpu / seconds * 100.0 / num_clients;
+	}
+
+	for (auto& client : clients) {
+		client->Close();
+		retired_clients.push_back(std::move(client));
+	}
+}
+
+BENCHMARK(BM_ServerFanOut)
+	->ArgNames({ "clients", "rate", "binary" })
+	->ArgsProduct({ { 10, 50, 100 }, { 20 }, { 0, 1 } })
+	->Args({ 50, 60, 1 })
+	->UseRealTime()
+	->MinTime(3.0)
+	->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
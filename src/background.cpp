@@ -22,6 +22,7 @@
 #include "cache.h"
 #include "background.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "main_data.h"
 #include <lcf/reader_util.h>
 #include "output.h"
@@ -144,3 +145,15 @@ void Background::Draw(Bitmap& dst) {
 		dst.ToneBlit(0, 0, dst, dst.GetRect(), tone_effect, Opacity::Opaque());
 	}
 }
+
+bool Background::GetDamage(Rect& rect, DamageHash& hash) {
+	rect = Rect(0, 0, Player::screen_width, Player::screen_height);
+
+	hash.Add(bg_bitmap).Add(Scale(bg_x)).Add(Scale(bg_y))
+		.Add(fg_bitmap).Add(Scale(fg_x)).Add(Scale(fg_y))
+		.Add(Main_Data::game_screen->GetShakeOffsetX())
+		.Add(Main_Data::game_screen->GetShakeOffsetY())
+		.Add(tone_effect);
+
+	return true;
+}
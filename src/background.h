@@ -31,6 +31,8 @@ public:
 	Background(int terrain_id);
 
 	void Draw(Bitmap& dst) override;
+
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
 	void Update();
 	Tone GetTone() const;
 	void SetTone(Tone tone);
@@ -0,0 +1,179 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Headers
+#include <algorithm>
+#include "band_renderer.h"
+#include "bitmap.h"
+#include "drawable_list.h"
+
+BandRenderer::BandRenderer(int threads) {
+	threads = std::max(threads, 1);
+	for (int band = 1; band < threads; ++band) {
+		workers.emplace_back(&BandRenderer::WorkerMain, this, band);
+	}
+	views.resize(threads);
+	band_active.resize(threads);
+}
+
+BandRenderer::~BandRenderer() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	start_cv.notify_all();
+
+	for (auto& worker: workers) {
+		worker.join();
+	}
+}
+
+void BandRenderer::Draw(DrawableList& list, Bitmap& dst, Drawable::Z_t min_z, Drawable::Z_t max_z) {
+	if (list.IsDirty()) {
+		list.Sort();
+	}
+
+	PrepareViews(dst);
+	drawn = false;
+
+	for (auto* drawable: list) {
+		auto z = drawable->GetZ();
+		if (z < min_z) {
+			continue;
+		}
+		if (z > max_z) {
+			break;
+		}
+		if (!drawable->IsVisible()) {
+			continue;
+		}
+
+		if (drawable->PrepareBand()) {
+			run.push_back(drawable);
+		} else {
+			DrawRun();
+			drawable->Draw(dst);
+		}
+	}
+	DrawRun();
+
+	if (drawn) {
+		// The views do not change the revision of dst
+		dst.Touch();
+	}
+}
+
+void BandRenderer::PrepareViews(Bitmap& dst) {
+	if (view_source != &dst || view_pixels != dst.pixels()
+			|| view_width != dst.GetWidth() || view_height != dst.GetHeight()) {
+		for (auto& view: views) {
+			view = Bitmap::CreateView(dst);
+		}
+		view_source = &dst;
+		view_pixels = dst.pixels();
+		view_width = dst.GetWidth();
+		view_height = dst.GetHeight();
+	}
+
+	const int bands = static_cast<int>(views.size());
+	const int band_height = std::max((view_height + bands - 1) / bands, min_band_height);
+	const auto& clip_rects = dst.GetClipRects();
+
+	std::vector<Rect> rects;
+	for (int band = 0; band < bands; ++band) {
+		const Rect band_rect(0, band * band_height, view_width, band_height);
+
+		rects.clear();
+		if (clip_rects.empty()) {
+			rects.push_back(band_rect);
+		} else {
+			for (auto rect: clip_rects) {
+				rect.Adjust(band_rect);
+				if (!rect.IsEmpty()) {
+					rects.push_back(rect);
+				}
+			}
+		}
+
+		Rect bounds = band_rect;
+		bounds.Adjust(dst.GetRect());
+		band_active[band] = !bounds.IsEmpty() && !rects.empty();
+		if (band_active[band]) {
+			views[band]->SetClipRects(rects);
+		}
+	}
+}
+
+void BandRenderer::DrawRun() {
+	if (run.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending = static_cast<int>(workers.size());
+		++generation;
+	}
+	start_cv.notify_all();
+
+	DrawBand(0);
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [this]() { return pending == 0; });
+	}
+
+	run.clear();
+	drawn = true;
+}
+
+void BandRenderer::DrawBand(int band) const {
+	if (!band_active[band]) {
+		return;
+	}
+
+	auto& view = *views[band];
+	for (const auto* drawable: run) {
+		drawable->DrawBand(view);
+	}
+}
+
+void BandRenderer::WorkerMain(int band) {
+	uint64_t seen = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start_cv.wait(lock, [&]() { return stop || generation != seen; });
+			if (stop) {
+				return;
+			}
+			seen = generation;
+		}
+
+		DrawBand(band);
+
+		bool done;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = --pending == 0;
+		}
+		if (done) {
+			done_cv.notify_one();
+		}
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_BAND_RENDERER_H
+#define EP_BAND_RENDERER_H
+
+// Headers
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "drawable.h"
+#include "memory_management.h"
+#include "rect.h"
+
+class DrawableList;
+
+/**
+ * Draws a DrawableList on several threads.
+ *
+ * The screen is split into horizontal bands, every thread draws the
+ * drawables into one band through a view of the screen clipped to it.
+ * Consecutive drawables which support Drawable::DrawBand are drawn this
+ * way, all others are drawn with Drawable::Draw on the calling thread
+ * in between, so the drawing order stays the same.
+ */
+class BandRenderer {
+public:
+	/** Bands are not made smaller than this amount of rows */
+	static constexpr int min_band_height = 16;
+
+	/**
+	 * Starts the worker threads.
+	 *
+	 * @param threads number of bands, the calling thread draws one of them
+	 */
+	explicit BandRenderer(int threads);
+
+	/** Stops the worker threads */
+	~BandRenderer();
+
+	BandRenderer(const BandRenderer&) = delete;
+	BandRenderer& operator=(const BandRenderer&) = delete;
+
+	/** @return number of threads drawing, including the calling thread */
+	int GetThreads() const;
+
+	/**
+	 * Draws the visible drawables of the list with a z value between min_z
+	 * and max_z, like DrawableList::Draw. The clip rectangles of dst are
+	 * honored.
+	 *
+	 * @param list drawables, sorted when needed
+	 * @param dst screen
+	 * @param min_z lowest z value drawn
+	 * @param max_z highest z value drawn
+	 */
+	void Draw(DrawableList& list, Bitmap& dst, Drawable::Z_t min_z, Drawable::Z_t max_z);
+
+private:
+	/** Creates the views and sets their clip rectangles for the bands of dst */
+	void PrepareViews(Bitmap& dst);
+
+	/** Draws the collected drawables in all bands and waits for the workers */
+	void DrawRun();
+
+	void DrawBand(int band) const;
+
+	void WorkerMain(int band);
+
+	std::vector<std::thread> workers;
+
+	std::vector<BitmapRef> views;
+	std::vector<bool> band_active;
+	const Bitmap* view_source = nullptr;
+	const void* view_pixels = nullptr;
+	int view_width = 0;
+	int view_height = 0;
+
+	std::vector<Drawable*> run;
+	bool drawn = false;
+
+	std::mutex mutex;
+	std::condition_variable start_cv;
+	std::condition_variable done_cv;
+	uint64_t generation = 0;
+	int pending = 0;
+	bool stop = false;
+};
+
+inline int BandRenderer::GetThreads() const {
+	return static_cast<int>(workers.size()) + 1;
+}
+
+#endif
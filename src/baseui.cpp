@@ -68,6 +68,14 @@ void BaseUi::CleanDisplay() {
 	main_surface->Clear();
 }
 
+Rect BaseUi::TakeDisplayDamage() {
+	if (!display_damage_set) {
+		return main_surface->GetRect();
+	}
+	display_damage_set = false;
+	return display_damage;
+}
+
 void BaseUi::SetGameResolution(GameResolution resolution) {
 	vcfg.game_resolution.Set(resolution);
 }
@@ -81,6 +81,15 @@ public:
 	 */
 	virtual void UpdateDisplay() = 0;
 
+	/**
+	 * Sets the part of the display surface which changed since the last
+	 * UpdateDisplay. Only affects the next UpdateDisplay, afterwards the
+	 * whole surface is considered changed again.
+	 *
+	 * @param rect changed part, empty when nothing changed
+	 */
+	void SetDisplayDamage(const Rect& rect);
+
 	/**
 	 * Gets a copy of the display surface.
 	 *
@@ -268,6 +277,13 @@ protected:
 	virtual void vGetConfig(Game_ConfigVideo& cfg) const = 0;
 	virtual bool vChangeDisplaySurfaceResolution(int new_width, int new_height);
 
+	/**
+	 * Returns the damage set by SetDisplayDamage and resets it.
+	 *
+	 * @return changed part of the display surface, the whole surface when not set
+	 */
+	Rect TakeDisplayDamage();
+
 	Game_ConfigVideo vcfg;
 
 	/**
@@ -320,6 +336,10 @@ protected:
 
 	/** Ui manages frame rate externally */
 	bool external_frame_rate = false;
+
+	/** Changed part of the display surface, see SetDisplayDamage */
+	Rect display_damage;
+	bool display_damage_set = false;
 };
 
 /** Global DisplayUi variable. */
@@ -337,6 +357,11 @@ inline void BaseUi::SetFrameRateSynchronized(bool value) {
 	external_frame_rate = value;
 }
 
+inline void BaseUi::SetDisplayDamage(const Rect& rect) {
+	display_damage = rect;
+	display_damage_set = true;
+}
+
 inline bool BaseUi::IsFullscreen() const {
 	return vcfg.fullscreen.Get();
 }
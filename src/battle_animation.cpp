@@ -81,6 +81,14 @@ void BattleAnimation::Update() {
 	frame++;
 }
 
+bool BattleAnimation::GetDamage(Rect&, DamageHash&) {
+	return false;
+}
+
+bool BattleAnimation::PrepareBand() {
+	return false;
+}
+
 void BattleAnimation::OnBattleSpriteReady(FileRequestResult* result) {
 	BitmapRef bitmap = Cache::Battle(result->file);
 	SetBitmap(bitmap);
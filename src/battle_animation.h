@@ -59,6 +59,12 @@ public:
 	/** @return true if the animation has finished **/
 	bool IsDone() const;
 
+	/** Not tracked, the cells are drawn one by one in Draw **/
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	/** Drawn on the main thread, the cells are drawn one by one in Draw **/
+	bool PrepareBand() override;
+
 	/** @return true if the animation only plays audio and doesn't display **/
 	bool IsOnlySound() const;
 
@@ -37,7 +37,7 @@
 #include "font.h"
 #include "output.h"
 #include "util_macro.h"
-#include "bitmap_hslrgb.h"
+#include "bitmap_effects.h"
 #include <iostream>
 
 BitmapRef Bitmap::Create(int width, int height, const Color& color) {
@@ -78,6 +78,10 @@ BitmapRef Bitmap::Create(void *pixels, int width, int height, int pitch, const D
 	return std::make_shared<Bitmap>(pixels, width, height, pitch, format);
 }
 
+BitmapRef Bitmap::CreateView(Bitmap& source) {
+	return Create(source.pixels(), source.width(), source.height(), source.pitch(), source.format);
+}
+
 Bitmap::Bitmap(int width, int height, bool transparent) {
 	format = (transparent ? pixel_format : opaque_pixel_format);
 	pixman_format = find_format(format);
@@ -319,16 +323,7 @@ void Bitmap::HueChangeBlit(int x, int y, Bitmap const& src, Rect const& src_rect
 	Bitmap bmp(reinterpret_cast<void*>(&pixels.front()), src_rect.width, src_rect.height, src_rect.width * 4, format);
 	bmp.Blit(0, 0, src, src_rect, Opacity::Opaque());
 
-	for (std::vector<uint32_t>::iterator p = pixels.begin(); p != pixels.end(); ++p) {
-		uint32_t pixel = *p;
-		uint8_t r = (pixel>>24) & 0xFF;
-		uint8_t g = (pixel>>16) & 0xFF;
-		uint8_t b = (pixel>> 8) & 0xFF;
-		uint8_t a = pixel & 0xFF;
-		if (a > 0)
-			RGB_adjust_HSL(r, g, b, hue);
-		*p = ((uint32_t) r << 24) | ((uint32_t) g << 16) | ((uint32_t) b << 8) | (uint32_t) a;
-	}
+	BitmapEffects::HueRow(pixels.data(), pixels.size(), hue);
 
 	Blit(dst_rect.x, dst_rect.y, bmp, bmp.GetRect(), Opacity::Opaque());
 }
@@ -458,6 +453,8 @@ pixman_format_code_t Bitmap::find_format(const DynamicFormat& format) {
 	return iter->second;
 }
 
+std::atomic<uint64_t> Bitmap::next_revision{0};
+
 DynamicFormat Bitmap::pixel_format;
 DynamicFormat Bitmap::opaque_pixel_format;
 DynamicFormat Bitmap::image_format;
@@ -528,6 +525,8 @@ void Bitmap::Init(int width, int height, void* data, int pitch, bool destroy) {
 
 	if (data != NULL && destroy)
 		pixman_image_set_destroy_function(bitmap.get(), destroy_func, data);
+
+	BumpRevision();
 }
 
 void Bitmap::ConvertImage(int& width, int& height, void*& pixels, bool transparent) {
@@ -613,6 +612,7 @@ void Bitmap::Blit(int x, int y, Bitmap const& src, Rect const& src_rect, Opacity
 
 	auto mask = CreateMask(opacity, src_rect);
 
+	BumpRevision();
 	pixman_image_composite32(src.GetOperator(mask.get(), blend_mode),
 							 src.bitmap.get(),
 							 mask.get(), bitmap.get(),
@@ -627,6 +627,7 @@ void Bitmap::BlitFast(int x, int y, Bitmap const & src, Rect const & src_rect, O
 		return;
 	}
 
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_SRC,
 		src.bitmap.get(),
 		nullptr, bitmap.get(),
@@ -638,8 +639,12 @@ void Bitmap::BlitFast(int x, int y, Bitmap const & src, Rect const & src_rect, O
 
 PixmanImagePtr Bitmap::GetSubimage(Bitmap const& src, const Rect& src_rect) {
 	uint8_t* pixels = (uint8_t*) src.pixels() + src_rect.x * src.bpp() + src_rect.y * src.pitch();
-	return PixmanImagePtr{ pixman_image_create_bits(src.pixman_format, src_rect.width, src_rect.height,
+	auto image = PixmanImagePtr{ pixman_image_create_bits(src.pixman_format, src_rect.width, src_rect.height,
 									(uint32_t*) pixels, src.pitch()) };
+	if (src.format.bits == 8) {
+		pixman_image_set_indexed(image.get(), &palette);
+	}
+	return image;
 }
 
 void Bitmap::TiledBlit(Rect const& src_rect, Bitmap const& src, Rect const& dst_rect, Opacity const& opacity, Bitmap::BlendMode blend_mode) {
@@ -662,6 +667,7 @@ void Bitmap::TiledBlit(int ox, int oy, Rect const& src_rect, Bitmap const& src,
 
 	auto mask = CreateMask(opacity, src_rect);
 
+	BumpRevision();
 	pixman_image_composite32(src.GetOperator(mask.get(), blend_mode),
 							 src_bm.get(), mask.get(), bitmap.get(),
 							 ox, oy,
@@ -684,18 +690,19 @@ void Bitmap::StretchBlit(Rect const& dst_rect, Bitmap const& src, Rect const& sr
 
 	Transform xform = Transform::Scale(zoom_x, zoom_y);
 
-	pixman_image_set_transform(src.bitmap.get(), &xform.matrix);
+	// The transform is set on a temporary image, src can be drawn by other threads
+	auto src_img = GetSubimage(src, src.GetRect());
+	pixman_image_set_transform(src_img.get(), &xform.matrix);
 
 	auto mask = CreateMask(opacity, src_rect, &xform);
 
+	BumpRevision();
 	pixman_image_composite32(src.GetOperator(mask.get(), blend_mode),
-							 src.bitmap.get(), mask.get(), bitmap.get(),
+							 src_img.get(), mask.get(), bitmap.get(),
 							 src_rect.x / zoom_x, src_rect.y / zoom_y,
 							 0, 0,
 							 dst_rect.x, dst_rect.y,
 							 dst_rect.width, dst_rect.height);
-
-	pixman_image_set_transform(src.bitmap.get(), nullptr);
 }
 
 void Bitmap::WaverBlit(int x, int y, double zoom_x, double zoom_y, Bitmap const& src, Rect const& src_rect, int depth, double phase, Opacity const& opacity, Bitmap::BlendMode blend_mode) {
@@ -705,7 +712,8 @@ void Bitmap::WaverBlit(int x, int y, double zoom_x, double zoom_y, Bitmap const&
 
 	Transform xform = Transform::Scale(1.0 / zoom_x, 1.0 / zoom_y);
 
-	pixman_image_set_transform(src.bitmap.get(), &xform.matrix);
+	auto src_img = GetSubimage(src, src.GetRect());
+	pixman_image_set_transform(src_img.get(), &xform.matrix);
 
 	auto mask = CreateMask(opacity, src_rect, &xform);
 
@@ -715,6 +723,7 @@ void Bitmap::WaverBlit(int x, int y, double zoom_x, double zoom_y, Bitmap const&
 	const auto yoff = src_rect.y * zoom_y;
 	const auto yclip = y < 0 ? -y : 0;
 	const auto yend = std::min(height, this->height() - y);
+	BumpRevision();
 	for (int i = yclip; i < yend; i++) {
 		int dy = y + i;
 		// RPG_RT starts the effect from the top of the screen even if the image is clipped. The result
@@ -724,14 +733,12 @@ void Bitmap::WaverBlit(int x, int y, double zoom_x, double zoom_y, Bitmap const&
 		const int offset = 2 * zoom_x * depth * std::sin(phase + sy);
 
 		pixman_image_composite32(src.GetOperator(mask.get(), blend_mode),
-								 src.bitmap.get(), mask.get(), bitmap.get(),
+								 src_img.get(), mask.get(), bitmap.get(),
 								 xoff, yoff + i,
 								 0, i,
 								 x + offset, dy,
 								 width, 1);
 	}
-
-	pixman_image_set_transform(src.bitmap.get(), nullptr);
 }
 
 static pixman_color_t PixmanColor(const Color &color) {
@@ -748,6 +755,7 @@ void Bitmap::Fill(const Color &color) {
 
 	pixman_box32_t box = { 0, 0, width(), height() };
 
+	BumpRevision();
 	pixman_image_fill_boxes(PIXMAN_OP_SRC, bitmap.get(), &pcolor, 1, &box);
 }
 
@@ -756,6 +764,7 @@ void Bitmap::FillRect(Rect const& dst_rect, const Color &color) {
 
 	auto timage = PixmanImagePtr{pixman_image_create_solid_fill(&pcolor)};
 
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_OVER,
 			timage.get(), nullptr, bitmap.get(),
 			0, 0,
@@ -770,6 +779,16 @@ void Bitmap::Clear() {
 		return;
 	}
 
+	BumpRevision();
+
+	if (!clip_rects.empty()) {
+		// memset ignores the clip region
+		for (const auto& rect: clip_rects) {
+			ClearRect(rect);
+		}
+		return;
+	}
+
 	memset(pixels(), '\0', height() * pitch());
 }
 
@@ -785,70 +804,44 @@ void Bitmap::ClearRect(Rect const& dst_rect) {
 	box.x2 = Utils::Clamp<int32_t>(box.x2, 0, width());
 	box.y2 = Utils::Clamp<int32_t>(box.y2, 0, height());
 
+	BumpRevision();
 	pixman_image_fill_boxes(PIXMAN_OP_CLEAR, bitmap.get(), &pcolor, 1, &box);
 }
 
-// Hard light lookup table mapping source color to destination color
-// FIXME: Replace this with std::array<std::array<uint8_t,256>,256> when we have C++17
-struct HardLightTable {
-	uint8_t table[256][256] = {};
-};
-
-static constexpr HardLightTable make_hard_light_lookup() {
-	HardLightTable hl;
-	for (int i = 0; i < 256; ++i) {
-		for (int j = 0; j < 256; ++j) {
-			int res = 0;
-			if (i <= 128)
-				res = (2 * i * j) / 255;
-			else
-				res = 255 - 2 * (255 - i) * (255 - j) / 255;
-			hl.table[i][j] = res > 255 ? 255 : res < 0 ? 0 : res;
-		}
+void Bitmap::SetClipRects(const std::vector<Rect>& rects) {
+	std::vector<pixman_box32_t> boxes;
+	boxes.reserve(rects.size());
+	for (const auto& rect: rects) {
+		boxes.push_back({ rect.x, rect.y, rect.x + rect.width, rect.y + rect.height });
 	}
-	return hl;
-}
-
-constexpr auto hard_light = make_hard_light_lookup();
-
 
-// Saturation Tone Inline: Changes a pixel saturation
-static inline void saturation_tone(uint32_t &src_pixel, const int saturation, const int rs, const int gs, const int bs, const int as) {
-	// Algorithm from OpenPDN (MIT license)
-	// Transformation in Y'CbCr color space
-	uint8_t r = (src_pixel >> rs) & 0xFF;
-	uint8_t g = (src_pixel >> gs) & 0xFF;
-	uint8_t b = (src_pixel >> bs) & 0xFF;
-	uint8_t a = (src_pixel >> as) & 0xFF;
+	pixman_region32_t region;
+	pixman_region32_init_rects(&region, boxes.data(), static_cast<int>(boxes.size()));
+	pixman_region32_intersect_rect(&region, &region, 0, 0, width(), height());
 
-	// Y' = 0.299 R' + 0.587 G' + 0.114 B'
-	uint8_t lum = (7471 * b + 38470 * g + 19595 * r) >> 16;
-
-	// Scale Cb/Cr by scale factor "sat"
-	int red = ((lum * 1024 + (r - lum) * saturation) >> 10);
-	red = red > 255 ? 255 : red < 0 ? 0 : red;
-	int green = ((lum * 1024 + (g - lum) * saturation) >> 10);
-	green = green > 255 ? 255 : green < 0 ? 0 : green;
-	int blue = ((lum * 1024 + (b - lum) * saturation) >> 10);
-	blue = blue > 255 ? 255 : blue < 0 ? 0 : blue;
+	// The region is normalized by pixman: the rectangles do not overlap
+	int count = 0;
+	const pixman_box32_t* box = pixman_region32_rectangles(&region, &count);
+	clip_rects.clear();
+	for (int i = 0; i < count; ++i) {
+		clip_rects.emplace_back(box[i].x1, box[i].y1, box[i].x2 - box[i].x1, box[i].y2 - box[i].y1);
+	}
+	if (clip_rects.empty()) {
+		// Everything is clipped
+		clip_rects.emplace_back();
+	}
 
-	src_pixel = ((uint32_t)red << rs) | ((uint32_t)green << gs) | ((uint32_t)blue << bs) | ((uint32_t)a << as);
+	pixman_image_set_clip_region32(bitmap.get(), &region);
+	pixman_region32_fini(&region);
 }
 
-// Color Tone Inline: Changes color of a pixel by hard light table
-static inline void color_tone(uint32_t &src_pixel, const Tone& tone, const int rs, const int gs, const int bs, const int as) {
-	src_pixel = ((uint32_t)hard_light.table[tone.red][(src_pixel >> rs) & 0xFF] << rs)
-		| ((uint32_t)hard_light.table[tone.green][(src_pixel >> gs) & 0xFF] << gs)
-		| ((uint32_t)hard_light.table[tone.blue][(src_pixel >> bs) & 0xFF] << bs)
-		| ((uint32_t)((src_pixel >> as) & 0xFF) << as);
-}
+void Bitmap::ResetClip() {
+	if (clip_rects.empty()) {
+		return;
+	}
 
-static inline void color_tone_alpha(uint32_t &src_pixel, const Tone& tone, const int rs, const int gs, const int bs, const int as) {
-	uint8_t a = (src_pixel >> as) & 0xFF;
-	uint8_t r = ((uint32_t)hard_light.table[tone.red][(src_pixel >> rs) & 0xFF]) * a / 255;
-	uint8_t g = ((uint32_t)hard_light.table[tone.green][(src_pixel >> gs) & 0xFF]) * a / 255;
-	uint8_t b = ((uint32_t)hard_light.table[tone.blue][(src_pixel >> bs) & 0xFF]) * a / 255;
-	src_pixel = ((uint32_t)r << rs) | ((uint32_t)g << gs) | ((uint32_t)b << bs) | ((uint32_t)a << as);
+	pixman_image_set_clip_region32(bitmap.get(), nullptr);
+	clip_rects.clear();
 }
 
 void Bitmap::ToneBlit(int x, int y, Bitmap const& src, Rect const& src_rect, const Tone &tone, Opacity const& opacity) {
@@ -880,6 +873,7 @@ void Bitmap::ToneBlit(int x, int y, Bitmap const& src, Rect const& src_rect, con
 		return;
 	}
 
+	BumpRevision();
 	if (&src != this) {
 		pixman_image_composite32(src.GetOperator(),
 		src.bitmap.get(), nullptr, bitmap.get(),
@@ -889,119 +883,53 @@ void Bitmap::ToneBlit(int x, int y, Bitmap const& src, Rect const& src_rect, con
 		src_rect.width, src_rect.height);
 	}
 
-	const int as = pixel_format.a.shift;
-	const int rs = pixel_format.r.shift;
-	const int gs = pixel_format.g.shift;
-	const int bs = pixel_format.b.shift;
+	BitmapEffects::ToneParams params;
+	params.rs = pixel_format.r.shift;
+	params.gs = pixel_format.g.shift;
+	params.bs = pixel_format.b.shift;
+	params.as = pixel_format.a.shift;
+	params.apply_sat = tone.gray != 128;
+	params.sat = tone.gray > 128 ? 1024 + (tone.gray - 128) * 16 : tone.gray * 8;
+	params.apply_tone = (tone.red != 128 || tone.green != 128 || tone.blue != 128);
+	params.red = tone.red;
+	params.green = tone.green;
+	params.blue = tone.blue;
+
+	if (src_opacity == ImageOpacity::Opaque) {
+		params.alpha = BitmapEffects::AlphaMode::Opaque;
+	} else if (src_opacity == ImageOpacity::Alpha_1Bit) {
+		params.alpha = BitmapEffects::AlphaMode::Alpha_1Bit;
+	} else {
+		params.alpha = BitmapEffects::AlphaMode::Alpha_8Bit;
+	}
+
 	int next_row = pitch() / sizeof(uint32_t);
-	uint32_t* pixels = (uint32_t*)this->pixels();
-	pixels = pixels + (y - 1) * next_row + x;
 
 	const uint16_t limit_height = std::min<uint16_t>(src_rect.height, height());
 	const uint16_t limit_width = std::min<uint16_t>(src_rect.width, width());
 
-	const bool apply_sat = tone.gray != 128;
-	const bool apply_tone = (tone.red != 128 || tone.green != 128 || tone.blue != 128);
-
-	// If Saturation + Color:
-	if (apply_sat && apply_tone) {
-		int sat = tone.gray > 128 ? 1024 + (tone.gray - 128) * 16 : tone.gray * 8;
+	auto tone_rect = [&](const Rect& rect) {
+		uint32_t* pixels = (uint32_t*)this->pixels();
+		pixels = pixels + rect.y * next_row + rect.x;
 
-		if (src_opacity == ImageOpacity::Opaque) {
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					saturation_tone(pixels[j], sat, rs, gs, bs, as);
-					color_tone(pixels[j], tone, rs, gs, bs, as);
-				}
-			}
-		} else if (src_opacity == ImageOpacity::Alpha_1Bit) {
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					uint8_t a = (uint8_t)((pixels[j] >> as) & 0xFF);
-					if (a == 0)
-						continue;
-
-					saturation_tone(pixels[j], sat, rs, gs, bs, as);
-					color_tone(pixels[j], tone, rs, gs, bs, as);
-				}
-			}
-		} else { // 8 Bit Alpha
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					uint8_t a = (uint8_t)((pixels[j] >> as) & 0xFF);
-					if (a == 0) {
-						continue;
-					}
-
-					saturation_tone(pixels[j], sat, rs, gs, bs, as);
-					color_tone_alpha(pixels[j], tone, rs, gs, bs, as);
-				}
-			}
+		for (int i = 0; i < rect.height; ++i) {
+			BitmapEffects::ToneRow(pixels, rect.width, params);
+			pixels += next_row;
 		}
-	}
-
-	// If Only Saturation:
-	else if (apply_sat) {
-		int sat = tone.gray > 128 ? 1024 + (tone.gray - 128) * 16 : tone.gray * 8;
+	};
 
-		if (src_opacity == ImageOpacity::Opaque) {
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					saturation_tone(pixels[j], sat, rs, gs, bs, as);
-				}
-			}
-		} else { // Any kind of alpha
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					uint8_t a = (uint8_t)((pixels[j] >> as) & 0xFF);
-					if (a == 0)
-						continue;
-
-					saturation_tone(pixels[j], sat, rs, gs, bs, as);
-				}
-			}
-		}
+	Rect rect(x, y, limit_width, limit_height);
+	if (clip_rects.empty()) {
+		tone_rect(rect);
+		return;
 	}
 
-	// If Only Color:
-	else if (apply_tone) {
-		if (src_opacity == ImageOpacity::Opaque) {
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					color_tone(pixels[j], tone, rs, gs, bs, as);
-				}
-			}
-		} else if (src_opacity == ImageOpacity::Alpha_1Bit) {
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					uint8_t a = (uint8_t)((pixels[j] >> as) & 0xFF);
-					if (a == 0)
-						continue;
-
-					color_tone(pixels[j], tone, rs, gs, bs, as);
-				}
-			}
-		} else { // 8 Bit Alpha
-			for (uint16_t i = 0; i < limit_height; ++i) {
-				pixels += next_row;
-				for (uint16_t j = 0; j < limit_width; ++j) {
-					uint8_t a = (uint8_t)((pixels[j] >> as) & 0xFF);
-					if (a == 0)
-						continue;
-					else if (a == 255) {
-						color_tone(pixels[j], tone, rs, gs, bs, as);
-					} else {
-						color_tone_alpha(pixels[j], tone, rs, gs, bs, as);
-					}
-				}
-			}
+	// The pixels are changed in place, outside of the clip region of pixman
+	for (const auto& clip: clip_rects) {
+		Rect clipped = rect;
+		clipped.Adjust(clip);
+		if (!clipped.IsEmpty()) {
+			tone_rect(clipped);
 		}
 	}
 }
@@ -1017,6 +945,7 @@ void Bitmap::BlendBlit(int x, int y, Bitmap const& src, Rect const& src_rect, co
 		return;
 	}
 
+	BumpRevision();
 	if (&src != this)
 		pixman_image_composite32(src.GetOperator(),
 								 src.bitmap.get(), nullptr, bitmap.get(),
@@ -1083,6 +1012,7 @@ void Bitmap::Flip(bool horizontal, bool vertical) {
 
 	pixman_image_set_transform(temp.get(), &xform.matrix);
 
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_SRC,
 							 temp.get(), nullptr, bitmap.get(),
 							 0, 0, 0, 0, 0, 0, w, h);
@@ -1097,6 +1027,7 @@ void Bitmap::MaskedBlit(Rect const& dst_rect, Bitmap const& mask, int mx, int my
 
 	auto source = PixmanImagePtr{ pixman_image_create_solid_fill(&tcolor) };
 
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_OVER,
 							 source.get(), mask.bitmap.get(), bitmap.get(),
 							 0, 0,
@@ -1106,6 +1037,7 @@ void Bitmap::MaskedBlit(Rect const& dst_rect, Bitmap const& mask, int mx, int my
 }
 
 void Bitmap::MaskedBlit(Rect const& dst_rect, Bitmap const& mask, int mx, int my, Bitmap const& src, int sx, int sy) {
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_OVER,
 							 src.bitmap.get(), mask.bitmap.get(), bitmap.get(),
 							 sx, sy,
@@ -1119,6 +1051,7 @@ void Bitmap::Blit2x(Rect const& dst_rect, Bitmap const& src, Rect const& src_rec
 
 	pixman_image_set_transform(src.bitmap.get(), &xform.matrix);
 
+	BumpRevision();
 	pixman_image_composite32(PIXMAN_OP_SRC,
 							 src.bitmap.get(), nullptr, bitmap.get(),
 							 src_rect.x, src_rect.y,
@@ -1165,8 +1098,6 @@ void Bitmap::RotateZoomOpacityBlit(int x, int y, int ox, int oy,
 		return;
 	}
 
-	auto* src_img = src.bitmap.get();
-
 	Transform fwd = Transform::Translation(x, y);
 	fwd *= Transform::Rotation(angle);
 	if (zoom_x != 1.0 || zoom_y != 1.0) {
@@ -1181,26 +1112,20 @@ void Bitmap::RotateZoomOpacityBlit(int x, int y, int ox, int oy,
 
 	auto inv = fwd.Inverse();
 
-	PixmanImagePtr temp;
-	if (src_rect != src.GetRect()) {
-		temp = GetSubimage(src, src_rect);
-		src_img = temp.get();
-	}
-
-	pixman_image_set_transform(src_img, &inv.matrix);
+	auto src_img = GetSubimage(src, src_rect);
+	pixman_image_set_transform(src_img.get(), &inv.matrix);
 
 	auto mask = CreateMask(opacity, src_rect, &inv);
 
 	// OP_SRC draws a black rectangle around the rotated image making this operator unusable here
 	blend_mode = (blend_mode == BlendMode::Default ? BlendMode::Normal : blend_mode);
+	BumpRevision();
 	pixman_image_composite32(GetOperator(mask.get(), blend_mode),
-							 src_img, mask.get(), bitmap.get(),
+							 src_img.get(), mask.get(), bitmap.get(),
 							 dst_rect.x, dst_rect.y,
 							 dst_rect.x, dst_rect.y,
 							 dst_rect.x, dst_rect.y,
 							 dst_rect.width, dst_rect.height);
-
-	pixman_image_set_transform(src_img, nullptr);
 }
 
 void Bitmap::ZoomOpacityBlit(int x, int y, int ox, int oy,
@@ -1273,6 +1198,7 @@ void Bitmap::EdgeMirrorBlit(int x, int y, Bitmap const& src, Rect const& src_rec
 
 	const auto dst_rect = GetRect();
 
+	BumpRevision();
 	auto draw = [&](int x, int y) {
 		pixman_image_composite32(src.GetOperator(mask.get()),
 				src.bitmap.get(),
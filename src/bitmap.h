@@ -19,6 +19,7 @@
 #define EP_BITMAP_H
 
 // Headers
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <map>
@@ -102,6 +103,16 @@ public:
 	 */
 	static BitmapRef Create(void *pixels, int width, int height, int pitch, const DynamicFormat& format);
 
+	/**
+	 * Creates a bitmap which draws on the pixel data of source.
+	 * It has its own clip rectangles, so several threads can draw on
+	 * different parts of source at once.
+	 *
+	 * @param source bitmap, must outlive the view
+	 * @return view of source
+	 */
+	static BitmapRef CreateView(Bitmap& source);
+
 	Bitmap(int width, int height, bool transparent);
 	Bitmap(Filesystem_Stream::InputStream stream, bool transparent, uint32_t flags);
 	Bitmap(const uint8_t* data, unsigned bytes, bool transparent, uint32_t flags);
@@ -462,6 +473,38 @@ public:
 	 */
 	void ClearRect(Rect const& dst_rect);
 
+	/**
+	 * Restricts all drawing operations on the bitmap to the given rectangles
+	 * until ResetClip is called. Used to redraw only the damaged parts of the
+	 * screen, see DamageTracker.
+	 *
+	 * @param rects clip rectangles, they may overlap.
+	 */
+	void SetClipRects(const std::vector<Rect>& rects);
+
+	/**
+	 * Removes the clip rectangles set by SetClipRects.
+	 */
+	void ResetClip();
+
+	/** @return clip rectangles, empty when drawing is not restricted */
+	const std::vector<Rect>& GetClipRects() const;
+
+	/**
+	 * Returns a number which changes whenever the bitmap is drawn on
+	 * and is unique among all bitmaps.
+	 * Writes through pixels() are not tracked.
+	 *
+	 * @return revision of the pixel data
+	 */
+	uint64_t GetRevision() const;
+
+	/**
+	 * Changes the revision after the pixel data was drawn on
+	 * through a view, see CreateView.
+	 */
+	void Touch();
+
 	/**
 	 * Rotates bitmap hue.
 	 *
@@ -634,6 +677,14 @@ protected:
 	 */
 	pixman_op_t GetOperator(pixman_image_t* mask = nullptr, BlendMode blend_mode = BlendMode::Default) const;
 	bool read_only = false;
+
+	/** Clip rectangles, pixman normalizes them so they do not overlap */
+	std::vector<Rect> clip_rects;
+
+	uint64_t revision = 0;
+	static std::atomic<uint64_t> next_revision;
+
+	void BumpRevision();
 };
 
 inline ImageOpacity Bitmap::GetImageOpacity() const {
@@ -672,4 +723,20 @@ inline StringView Bitmap::GetFilename() const {
 	return filename;
 }
 
+inline const std::vector<Rect>& Bitmap::GetClipRects() const {
+	return clip_rects;
+}
+
+inline uint64_t Bitmap::GetRevision() const {
+	return revision;
+}
+
+inline void Bitmap::Touch() {
+	BumpRevision();
+}
+
+inline void Bitmap::BumpRevision() {
+	revision = next_revision.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 #endif
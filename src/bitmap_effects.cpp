@@ -0,0 +1,429 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Headers
+#include "bitmap_effects.h"
+#include "bitmap_effects_simd.h"
+#include "bitmap_hslrgb.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define EP_BITMAP_EFFECTS_SSE2
+#  include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#  define EP_BITMAP_EFFECTS_NEON
+#  include <arm_neon.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#  define EP_BITMAP_EFFECTS_AVX2
+#endif
+
+namespace BitmapEffects {
+#ifdef EP_BITMAP_EFFECTS_AVX2
+	// bitmap_effects_avx2.cpp
+	int ToneRowAVX2(uint32_t* pixels, int count, const ToneParams& params);
+#endif
+}
+
+namespace {
+using namespace BitmapEffects;
+
+// Hard light lookup table mapping source color to destination color
+// FIXME: Replace this with std::array<std::array<uint8_t,256>,256> when we have C++17
+struct HardLightTable {
+	uint8_t table[256][256] = {};
+};
+
+constexpr HardLightTable make_hard_light_lookup() {
+	HardLightTable hl;
+	for (int i = 0; i < 256; ++i) {
+		for (int j = 0; j < 256; ++j) {
+			int res = 0;
+			if (i <= 128)
+				res = (2 * i * j) / 255;
+			else
+				res = 255 - 2 * (255 - i) * (255 - j) / 255;
+			hl.table[i][j] = res > 255 ? 255 : res < 0 ? 0 : res;
+		}
+	}
+	return hl;
+}
+
+constexpr auto hard_light = make_hard_light_lookup();
+
+// Saturation Tone Inline: Changes a pixel saturation
+inline void saturation_tone(uint32_t &src_pixel, const int saturation, const int rs, const int gs, const int bs, const int as) {
+	// Algorithm from OpenPDN (MIT license)
+	// Transformation in Y'CbCr color space
+	uint8_t r = (src_pixel >> rs) & 0xFF;
+	uint8_t g = (src_pixel >> gs) & 0xFF;
+	uint8_t b = (src_pixel >> bs) & 0xFF;
+	uint8_t a = (src_pixel >> as) & 0xFF;
+
+	// Y' = 0.299 R' + 0.587 G' + 0.114 B'
+	uint8_t lum = (7471 * b + 38470 * g + 19595 * r) >> 16;
+
+	// Scale Cb/Cr by scale factor "sat"
+	int red = ((lum * 1024 + (r - lum) * saturation) >> 10);
+	red = red > 255 ? 255 : red < 0 ? 0 : red;
+	int green = ((lum * 1024 + (g - lum) * saturation) >> 10);
+	green = green > 255 ? 255 : green < 0 ? 0 : green;
+	int blue = ((lum * 1024 + (b - lum) * saturation) >> 10);
+	blue = blue > 255 ? 255 : blue < 0 ? 0 : blue;
+
+	src_pixel = ((uint32_t)red << rs) | ((uint32_t)green << gs) | ((uint32_t)blue << bs) | ((uint32_t)a << as);
+}
+
+// Color Tone Inline: Changes color of a pixel by hard light table
+inline void color_tone(uint32_t &src_pixel, const ToneParams& p) {
+	src_pixel = ((uint32_t)hard_light.table[p.red][(src_pixel >> p.rs) & 0xFF] << p.rs)
+		| ((uint32_t)hard_light.table[p.green][(src_pixel >> p.gs) & 0xFF] << p.gs)
+		| ((uint32_t)hard_light.table[p.blue][(src_pixel >> p.bs) & 0xFF] << p.bs)
+		| ((uint32_t)((src_pixel >> p.as) & 0xFF) << p.as);
+}
+
+inline void color_tone_alpha(uint32_t &src_pixel, const ToneParams& p) {
+	uint8_t a = (src_pixel >> p.as) & 0xFF;
+	uint8_t r = ((uint32_t)hard_light.table[p.red][(src_pixel >> p.rs) & 0xFF]) * a / 255;
+	uint8_t g = ((uint32_t)hard_light.table[p.green][(src_pixel >> p.gs) & 0xFF]) * a / 255;
+	uint8_t b = ((uint32_t)hard_light.table[p.blue][(src_pixel >> p.bs) & 0xFF]) * a / 255;
+	src_pixel = ((uint32_t)r << p.rs) | ((uint32_t)g << p.gs) | ((uint32_t)b << p.bs) | ((uint32_t)a << p.as);
+}
+
+int ToneRowScalar(uint32_t* pixels, int count, const ToneParams& p) {
+	for (int j = 0; j < count; ++j) {
+		if (p.alpha != AlphaMode::Opaque) {
+			uint8_t a = (uint8_t)((pixels[j] >> p.as) & 0xFF);
+			if (a == 0)
+				continue;
+		}
+
+		if (p.apply_sat) {
+			saturation_tone(pixels[j], p.sat, p.rs, p.gs, p.bs, p.as);
+		}
+		if (p.apply_tone) {
+			// For opaque pixels both give the same result
+			if (p.alpha == AlphaMode::Alpha_8Bit) {
+				color_tone_alpha(pixels[j], p);
+			} else {
+				color_tone(pixels[j], p);
+			}
+		}
+	}
+	return count;
+}
+
+#ifdef EP_BITMAP_EFFECTS_SSE2
+/** Two registers of 4 pixels, the channels of the 8 pixels in one register of 16 bit lanes */
+struct SSE2Ops {
+	using P = __m128i;
+	using H = __m128i;
+	static constexpr int PIXELS = 8;
+
+	static void Load(const uint32_t* pixels, P& lo, P& hi) {
+		lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+		hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 4));
+	}
+
+	static void Store(uint32_t* pixels, P lo, P hi) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), lo);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + 4), hi);
+	}
+
+	static H Channel(P lo, P hi, int shift) {
+		const __m128i count = _mm_cvtsi32_si128(shift);
+		const __m128i mask = _mm_set1_epi32(0xFF);
+		return _mm_packs_epi32(
+			_mm_and_si128(_mm_srl_epi32(lo, count), mask),
+			_mm_and_si128(_mm_srl_epi32(hi, count), mask));
+	}
+
+	static void Join(H r, H g, H b, H a, const ToneParams& p, P& lo, P& hi) {
+		const __m128i zero = _mm_setzero_si128();
+		auto join = [&](H (*unpack)(H, H)) {
+			return _mm_or_si128(
+				_mm_or_si128(_mm_sll_epi32(unpack(r, zero), _mm_cvtsi32_si128(p.rs)),
+					_mm_sll_epi32(unpack(g, zero), _mm_cvtsi32_si128(p.gs))),
+				_mm_or_si128(_mm_sll_epi32(unpack(b, zero), _mm_cvtsi32_si128(p.bs)),
+					_mm_sll_epi32(unpack(a, zero), _mm_cvtsi32_si128(p.as))));
+		};
+		lo = join([](H x, H y) { return _mm_unpacklo_epi16(x, y); });
+		hi = join([](H x, H y) { return _mm_unpackhi_epi16(x, y); });
+	}
+
+	// (19595 r + 38470 g + 7471 b) >> 16, as (r, g) . (19595, 19235) + (b, g) . (7471, 19235)
+	static H Luminance(H r, H g, H b) {
+		const __m128i rg_factor = _mm_set1_epi32((19235 << 16) | 19595);
+		const __m128i bg_factor = _mm_set1_epi32((19235 << 16) | 7471);
+		__m128i lo = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpacklo_epi16(r, g), rg_factor),
+			_mm_madd_epi16(_mm_unpacklo_epi16(b, g), bg_factor));
+		__m128i hi = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpackhi_epi16(r, g), rg_factor),
+			_mm_madd_epi16(_mm_unpackhi_epi16(b, g), bg_factor));
+		return _mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+	}
+
+	// clamp((lum * 1024 + (c - lum) * sat) >> 10), as (c - lum, lum) . (sat, 1024)
+	static H Saturation(H c, H lum, int sat) {
+		const __m128i factor = _mm_set1_epi32((1024 << 16) | sat);
+		__m128i d = _mm_sub_epi16(c, lum);
+		__m128i lo = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(d, lum), factor), 10);
+		__m128i hi = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(d, lum), factor), 10);
+		__m128i res = _mm_packs_epi32(lo, hi);
+		return _mm_min_epi16(_mm_max_epi16(res, _mm_setzero_si128()), _mm_set1_epi16(255));
+	}
+
+	static H HardLight(H c, uint16_t factor, uint16_t mask) {
+		const __m128i m = _mm_set1_epi16(mask);
+		__m128i res = Div255(Mul(_mm_xor_si128(c, m), _mm_set1_epi16(factor)));
+		return _mm_xor_si128(_mm_min_epi16(res, _mm_set1_epi16(255)), m);
+	}
+
+	static H Mul(H x, H y) {
+		return _mm_mullo_epi16(x, y);
+	}
+
+	// x / 255 for any 16 bit x
+	static H Div255(H x) {
+		return _mm_srli_epi16(_mm_mulhi_epu16(x, _mm_set1_epi16(static_cast<short>(0x8081))), 7);
+	}
+
+	static void KeepTransparent(P& lo, P& hi, P orig_lo, P orig_hi, int as) {
+		const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFFu << as));
+		const __m128i zero = _mm_setzero_si128();
+		__m128i keep_lo = _mm_cmpeq_epi32(_mm_and_si128(orig_lo, alpha), zero);
+		__m128i keep_hi = _mm_cmpeq_epi32(_mm_and_si128(orig_hi, alpha), zero);
+		lo = _mm_or_si128(_mm_and_si128(keep_lo, orig_lo), _mm_andnot_si128(keep_lo, lo));
+		hi = _mm_or_si128(_mm_and_si128(keep_hi, orig_hi), _mm_andnot_si128(keep_hi, hi));
+	}
+};
+
+int ToneRowSSE2(uint32_t* pixels, int count, const ToneParams& params) {
+	return ToneRowSimd<SSE2Ops>(pixels, count, params);
+}
+#endif
+
+#ifdef EP_BITMAP_EFFECTS_NEON
+/** Two registers of 4 pixels, the channels of the 8 pixels in one register of 16 bit lanes */
+struct NEONOps {
+	using P = uint32x4_t;
+	using H = uint16x8_t;
+	static constexpr int PIXELS = 8;
+
+	static void Load(const uint32_t* pixels, P& lo, P& hi) {
+		lo = vld1q_u32(pixels);
+		hi = vld1q_u32(pixels + 4);
+	}
+
+	static void Store(uint32_t* pixels, P lo, P hi) {
+		vst1q_u32(pixels, lo);
+		vst1q_u32(pixels + 4, hi);
+	}
+
+	static H Channel(P lo, P hi, int shift) {
+		const int32x4_t count = vdupq_n_s32(-shift);
+		const uint32x4_t mask = vdupq_n_u32(0xFF);
+		return vcombine_u16(
+			vmovn_u32(vandq_u32(vshlq_u32(lo, count), mask)),
+			vmovn_u32(vandq_u32(vshlq_u32(hi, count), mask)));
+	}
+
+	static P Shift(uint16x4_t c, int shift) {
+		return vshlq_u32(vmovl_u16(c), vdupq_n_s32(shift));
+	}
+
+	static void Join(H r, H g, H b, H a, const ToneParams& p, P& lo, P& hi) {
+		lo = vorrq_u32(
+			vorrq_u32(Shift(vget_low_u16(r), p.rs), Shift(vget_low_u16(g), p.gs)),
+			vorrq_u32(Shift(vget_low_u16(b), p.bs), Shift(vget_low_u16(a), p.as)));
+		hi = vorrq_u32(
+			vorrq_u32(Shift(vget_high_u16(r), p.rs), Shift(vget_high_u16(g), p.gs)),
+			vorrq_u32(Shift(vget_high_u16(b), p.bs), Shift(vget_high_u16(a), p.as)));
+	}
+
+	static uint16x4_t Luminance(uint16x4_t r, uint16x4_t g, uint16x4_t b) {
+		uint32x4_t sum = vmull_n_u16(r, 19595);
+		sum = vmlal_n_u16(sum, g, 38470);
+		sum = vmlal_n_u16(sum, b, 7471);
+		return vshrn_n_u32(sum, 16);
+	}
+
+	static H Luminance(H r, H g, H b) {
+		return vcombine_u16(
+			Luminance(vget_low_u16(r), vget_low_u16(g), vget_low_u16(b)),
+			Luminance(vget_high_u16(r), vget_high_u16(g), vget_high_u16(b)));
+	}
+
+	static int16x4_t Saturation(int16x4_t d, int16x4_t lum, int16_t sat) {
+		int32x4_t sum = vmull_n_s16(d, sat);
+		sum = vmlal_n_s16(sum, lum, 1024);
+		return vqmovn_s32(vshrq_n_s32(sum, 10));
+	}
+
+	static H Saturation(H c, H lum, int sat) {
+		int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(c), vreinterpretq_s16_u16(lum));
+		int16x8_t l = vreinterpretq_s16_u16(lum);
+		int16x8_t res = vcombine_s16(
+			Saturation(vget_low_s16(d), vget_low_s16(l), static_cast<int16_t>(sat)),
+			Saturation(vget_high_s16(d), vget_high_s16(l), static_cast<int16_t>(sat)));
+		res = vminq_s16(vmaxq_s16(res, vdupq_n_s16(0)), vdupq_n_s16(255));
+		return vreinterpretq_u16_s16(res);
+	}
+
+	static H HardLight(H c, uint16_t factor, uint16_t mask) {
+		const uint16x8_t m = vdupq_n_u16(mask);
+		uint16x8_t res = Div255(Mul(veorq_u16(c, m), vdupq_n_u16(factor)));
+		return veorq_u16(vminq_u16(res, vdupq_n_u16(255)), m);
+	}
+
+	static H Mul(H x, H y) {
+		return vmulq_u16(x, y);
+	}
+
+	// x / 255 for any 16 bit x
+	static H Div255(H x) {
+		uint32x4_t lo = vshrq_n_u32(vmull_n_u16(vget_low_u16(x), 0x8081), 23);
+		uint32x4_t hi = vshrq_n_u32(vmull_n_u16(vget_high_u16(x), 0x8081), 23);
+		return vcombine_u16(vmovn_u32(lo), vmovn_u32(hi));
+	}
+
+	static void KeepTransparent(P& lo, P& hi, P orig_lo, P orig_hi, int as) {
+		const uint32x4_t alpha = vdupq_n_u32(0xFFu << as);
+		const uint32x4_t zero = vdupq_n_u32(0);
+		lo = vbslq_u32(vceqq_u32(vandq_u32(orig_lo, alpha), zero), orig_lo, lo);
+		hi = vbslq_u32(vceqq_u32(vandq_u32(orig_hi, alpha), zero), orig_hi, hi);
+	}
+};
+
+int ToneRowNEON(uint32_t* pixels, int count, const ToneParams& params) {
+	return ToneRowSimd<NEONOps>(pixels, count, params);
+}
+#endif
+
+using ToneRowFn = int (*)(uint32_t*, int, const ToneParams&);
+
+ToneRowFn GetToneRow(Backend backend) {
+	switch (backend) {
+		case Backend::Scalar:
+			return ToneRowScalar;
+		case Backend::SSE2:
+#ifdef EP_BITMAP_EFFECTS_SSE2
+			return ToneRowSSE2;
+#else
+			break;
+#endif
+		case Backend::AVX2:
+#ifdef EP_BITMAP_EFFECTS_AVX2
+			// Also called from static initialization, before libgcc did it
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) {
+				return ToneRowAVX2;
+			}
+#endif
+			break;
+		case Backend::NEON:
+#ifdef EP_BITMAP_EFFECTS_NEON
+			return ToneRowNEON;
+#else
+			break;
+#endif
+	}
+	return nullptr;
+}
+
+Backend SelectBackend() {
+	const Backend preferred[] = { Backend::AVX2, Backend::SSE2, Backend::NEON };
+	for (auto backend: preferred) {
+		if (GetToneRow(backend)) {
+			return backend;
+		}
+	}
+	return Backend::Scalar;
+}
+
+Backend tone_backend = SelectBackend();
+ToneRowFn tone_row = GetToneRow(tone_backend);
+} // anonymous namespace
+
+void BitmapEffects::ToneRow(uint32_t* pixels, int count, const ToneParams& params) {
+	int done = tone_row(pixels, count, params);
+	if (done < count) {
+		ToneRowScalar(pixels + done, count - done, params);
+	}
+}
+
+void BitmapEffects::HueRow(uint32_t* pixels, int count, int hue) {
+	// Most graphics have few colors, remember the last result for each hash
+	// of the color (bit 0 is set for valid entries, it is the alpha byte)
+	constexpr int cache_bits = 8;
+	uint32_t keys[1 << cache_bits] = {};
+	uint32_t values[1 << cache_bits];
+
+	for (int i = 0; i < count; ++i) {
+		uint32_t pixel = pixels[i];
+		uint8_t a = pixel & 0xFF;
+		if (a == 0)
+			continue;
+
+		uint32_t rgb = pixel & 0xFFFFFF00;
+		uint32_t slot = ((rgb >> 8) * 2654435761u) >> (32 - cache_bits);
+		if (keys[slot] != (rgb | 1)) {
+			uint8_t r = (pixel>>24) & 0xFF;
+			uint8_t g = (pixel>>16) & 0xFF;
+			uint8_t b = (pixel>> 8) & 0xFF;
+			RGB_adjust_HSL(r, g, b, hue);
+			keys[slot] = rgb | 1;
+			values[slot] = ((uint32_t) r << 24) | ((uint32_t) g << 16) | ((uint32_t) b << 8);
+		}
+		pixels[i] = values[slot] | a;
+	}
+}
+
+BitmapEffects::Backend BitmapEffects::GetBackend() {
+	return tone_backend;
+}
+
+bool BitmapEffects::SetBackend(Backend backend) {
+	auto fn = GetToneRow(backend);
+	if (!fn) {
+		return false;
+	}
+	tone_backend = backend;
+	tone_row = fn;
+	return true;
+}
+
+bool BitmapEffects::IsSupported(Backend backend) {
+	return GetToneRow(backend) != nullptr;
+}
+
+const char* BitmapEffects::GetBackendName(Backend backend) {
+	switch (backend) {
+		case Backend::Scalar:
+			return "Scalar";
+		case Backend::SSE2:
+			return "SSE2";
+		case Backend::AVX2:
+			return "AVX2";
+		case Backend::NEON:
+			return "NEON";
+	}
+	return "";
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_BITMAP_EFFECTS_H
+#define EP_BITMAP_EFFECTS_H
+
+// Headers
+#include <cstdint>
+
+/**
+ * Per-pixel color transforms of Bitmap::ToneBlit and Bitmap::HueChangeBlit.
+ *
+ * The tone kernel has a scalar implementation and vectorized ones
+ * (SSE2, AVX2, NEON), the fastest one supported by the CPU is selected
+ * on first use. All of them give the same result as the scalar one.
+ */
+namespace BitmapEffects {
+	enum class Backend {
+		Scalar,
+		SSE2,
+		AVX2,
+		NEON
+	};
+
+	/** How the alpha channel of the pixels is handled, see ImageOpacity */
+	enum class AlphaMode {
+		/** Every pixel is opaque */
+		Opaque,
+		/** Transparent pixels are skipped */
+		Alpha_1Bit,
+		/** Transparent pixels are skipped, the toned color is premultiplied with the alpha */
+		Alpha_8Bit
+	};
+
+	struct ToneParams {
+		/** Channel shifts of the pixel format */
+		int rs = 0;
+		int gs = 0;
+		int bs = 0;
+		int as = 0;
+
+		/** Saturation factor, 1024 is unchanged (see Tone::gray) */
+		bool apply_sat = false;
+		int sat = 1024;
+
+		/** Hard light of the color channels, 128 is unchanged */
+		bool apply_tone = false;
+		uint8_t red = 128;
+		uint8_t green = 128;
+		uint8_t blue = 128;
+
+		AlphaMode alpha = AlphaMode::Opaque;
+	};
+
+	/**
+	 * Applies saturation and color tone to a row of pixels, in place.
+	 *
+	 * @param pixels row
+	 * @param count number of pixels
+	 * @param params tone
+	 */
+	void ToneRow(uint32_t* pixels, int count, const ToneParams& params);
+
+	/**
+	 * Rotates the hue of a row of pixels in place, transparent pixels are skipped.
+	 * The pixels are RGBA with red in the highest byte.
+	 *
+	 * @param pixels row
+	 * @param count number of pixels
+	 * @param hue hue rotation, 0x600 is a full turn
+	 */
+	void HueRow(uint32_t* pixels, int count, int hue);
+
+	/** @return backend used by ToneRow */
+	Backend GetBackend();
+
+	/**
+	 * Selects the backend used by ToneRow, for benchmarks and tests.
+	 *
+	 * @param backend backend
+	 * @return false when the CPU or the build does not support it
+	 */
+	bool SetBackend(Backend backend);
+
+	/** @return whether the backend can be used */
+	bool IsSupported(Backend backend);
+
+	/** @return name of the backend */
+	const char* GetBackendName(Backend backend);
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// AVX2 version of the tone kernel, only called when the CPU supports it.
+// The rest of the program is built for the baseline target, so the target
+// is raised for the functions of this file only.
+
+#include <cstdint>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+
+#if defined(__clang__)
+#  pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#  pragma GCC target("avx2")
+#endif
+
+#include <immintrin.h>
+#include "bitmap_effects_simd.h"
+
+namespace {
+using namespace BitmapEffects;
+
+/**
+ * Like SSE2Ops of bitmap_effects.cpp with 16 pixels. Pack and unpack work
+ * within each 128 bit half, the pixels are shuffled by Channel and restored
+ * in order by Join.
+ */
+struct AVX2Ops {
+	using P = __m256i;
+	using H = __m256i;
+	static constexpr int PIXELS = 16;
+
+	static void Load(const uint32_t* pixels, P& lo, P& hi) {
+		lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels));
+		hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + 8));
+	}
+
+	static void Store(uint32_t* pixels, P lo, P hi) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels), lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + 8), hi);
+	}
+
+	static H Channel(P lo, P hi, int shift) {
+		const __m128i count = _mm_cvtsi32_si128(shift);
+		const __m256i mask = _mm256_set1_epi32(0xFF);
+		return _mm256_packs_epi32(
+			_mm256_and_si256(_mm256_srl_epi32(lo, count), mask),
+			_mm256_and_si256(_mm256_srl_epi32(hi, count), mask));
+	}
+
+	static P Shift(P c, int shift) {
+		return _mm256_sll_epi32(c, _mm_cvtsi32_si128(shift));
+	}
+
+	static void Join(H r, H g, H b, H a, const ToneParams& p, P& lo, P& hi) {
+		const __m256i zero = _mm256_setzero_si256();
+		lo = _mm256_or_si256(
+			_mm256_or_si256(Shift(_mm256_unpacklo_epi16(r, zero), p.rs), Shift(_mm256_unpacklo_epi16(g, zero), p.gs)),
+			_mm256_or_si256(Shift(_mm256_unpacklo_epi16(b, zero), p.bs), Shift(_mm256_unpacklo_epi16(a, zero), p.as)));
+		hi = _mm256_or_si256(
+			_mm256_or_si256(Shift(_mm256_unpackhi_epi16(r, zero), p.rs), Shift(_mm256_unpackhi_epi16(g, zero), p.gs)),
+			_mm256_or_si256(Shift(_mm256_unpackhi_epi16(b, zero), p.bs), Shift(_mm256_unpackhi_epi16(a, zero), p.as)));
+	}
+
+	static H Luminance(H r, H g, H b) {
+		const __m256i rg_factor = _mm256_set1_epi32((19235 << 16) | 19595);
+		const __m256i bg_factor = _mm256_set1_epi32((19235 << 16) | 7471);
+		__m256i lo = _mm256_add_epi32(
+			_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), rg_factor),
+			_mm256_madd_epi16(_mm256_unpacklo_epi16(b, g), bg_factor));
+		__m256i hi = _mm256_add_epi32(
+			_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), rg_factor),
+			_mm256_madd_epi16(_mm256_unpackhi_epi16(b, g), bg_factor));
+		return _mm256_packs_epi32(_mm256_srli_epi32(lo, 16), _mm256_srli_epi32(hi, 16));
+	}
+
+	static H Saturation(H c, H lum, int sat) {
+		const __m256i factor = _mm256_set1_epi32((1024 << 16) | sat);
+		__m256i d = _mm256_sub_epi16(c, lum);
+		__m256i lo = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(d, lum), factor), 10);
+		__m256i hi = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(d, lum), factor), 10);
+		__m256i res = _mm256_packs_epi32(lo, hi);
+		return _mm256_min_epi16(_mm256_max_epi16(res, _mm256_setzero_si256()), _mm256_set1_epi16(255));
+	}
+
+	static H HardLight(H c, uint16_t factor, uint16_t mask) {
+		const __m256i m = _mm256_set1_epi16(mask);
+		__m256i res = Div255(Mul(_mm256_xor_si256(c, m), _mm256_set1_epi16(factor)));
+		return _mm256_xor_si256(_mm256_min_epi16(res, _mm256_set1_epi16(255)), m);
+	}
+
+	static H Mul(H x, H y) {
+		return _mm256_mullo_epi16(x, y);
+	}
+
+	static H Div255(H x) {
+		return _mm256_srli_epi16(_mm256_mulhi_epu16(x, _mm256_set1_epi16(static_cast<short>(0x8081))), 7);
+	}
+
+	static void KeepTransparent(P& lo, P& hi, P orig_lo, P orig_hi, int as) {
+		const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFFu << as));
+		const __m256i zero = _mm256_setzero_si256();
+		lo = _mm256_blendv_epi8(lo, orig_lo, _mm256_cmpeq_epi32(_mm256_and_si256(orig_lo, alpha), zero));
+		hi = _mm256_blendv_epi8(hi, orig_hi, _mm256_cmpeq_epi32(_mm256_and_si256(orig_hi, alpha), zero));
+	}
+};
+} // anonymous namespace
+
+namespace BitmapEffects {
+	// Declared in bitmap_effects.cpp
+	int ToneRowAVX2(uint32_t* pixels, int count, const ToneParams& params) {
+		return ToneRowSimd<AVX2Ops>(pixels, count, params);
+	}
+}
+
+#if defined(__clang__)
+#  pragma clang attribute pop
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_BITMAP_EFFECTS_SIMD_H
+#define EP_BITMAP_EFFECTS_SIMD_H
+
+// Only included by bitmap_effects*.cpp. The AVX2 translation unit is built
+// for another target, so this header must not include any library header
+// and everything has internal linkage, the linker must not mix the versions.
+
+#include "bitmap_effects.h"
+
+namespace BitmapEffects {
+namespace {
+	/**
+	 * Hard light of one channel: table[i][j] of bitmap.cpp for the tone value i.
+	 * For i <= 128 it is min(j * 2i / 255, 255), otherwise
+	 * 255 - (255 - j) * 2(255 - i) / 255. 255 - j is j ^ 255, so both are
+	 * min(f(j ^ mask) , 255) ^ mask with f(x) = x * factor / 255.
+	 */
+	struct HardLight {
+		uint16_t factor;
+		uint16_t mask;
+
+		explicit HardLight(int i) :
+			factor(static_cast<uint16_t>(i <= 128 ? 2 * i : 2 * (255 - i))),
+			mask(static_cast<uint16_t>(i <= 128 ? 0 : 0xFF)) {}
+	};
+
+	/**
+	 * ToneRow for the vector operations Ops, see SSE2Ops.
+	 * Ops::PIXELS pixels are processed at once with the channels in 16 bit
+	 * lanes.
+	 *
+	 * @return number of processed pixels, the rest is left to the scalar kernel
+	 */
+	template <typename Ops>
+	int ToneRowSimd(uint32_t* pixels, int count, const ToneParams& p) {
+		using P = typename Ops::P;
+		using H = typename Ops::H;
+
+		const HardLight hl_r(p.red), hl_g(p.green), hl_b(p.blue);
+		const bool skip_transparent = p.alpha != AlphaMode::Opaque;
+		const bool premultiply = p.apply_tone && p.alpha == AlphaMode::Alpha_8Bit;
+
+		int i = 0;
+		for (; i + Ops::PIXELS <= count; i += Ops::PIXELS) {
+			P lo, hi;
+			Ops::Load(pixels + i, lo, hi);
+
+			H r = Ops::Channel(lo, hi, p.rs);
+			H g = Ops::Channel(lo, hi, p.gs);
+			H b = Ops::Channel(lo, hi, p.bs);
+			H a = Ops::Channel(lo, hi, p.as);
+
+			if (p.apply_sat) {
+				H lum = Ops::Luminance(r, g, b);
+				r = Ops::Saturation(r, lum, p.sat);
+				g = Ops::Saturation(g, lum, p.sat);
+				b = Ops::Saturation(b, lum, p.sat);
+			}
+
+			if (p.apply_tone) {
+				r = Ops::HardLight(r, hl_r.factor, hl_r.mask);
+				g = Ops::HardLight(g, hl_g.factor, hl_g.mask);
+				b = Ops::HardLight(b, hl_b.factor, hl_b.mask);
+				if (premultiply) {
+					r = Ops::Div255(Ops::Mul(r, a));
+					g = Ops::Div255(Ops::Mul(g, a));
+					b = Ops::Div255(Ops::Mul(b, a));
+				}
+			}
+
+			P out_lo, out_hi;
+			Ops::Join(r, g, b, a, p, out_lo, out_hi);
+			if (skip_transparent) {
+				Ops::KeepTransparent(out_lo, out_hi, lo, hi, p.as);
+			}
+			Ops::Store(pixels + i, out_lo, out_hi);
+		}
+		return i;
+	}
+}
+}
+
+#endif
@@ -20,10 +20,10 @@
 #  pragma warning(disable: 4003)
 #endif
 
-#include <map>
-#include <tuple>
 #include <chrono>
 #include <cassert>
+#include <list>
+#include <unordered_map>
 
 #include "async_handler.h"
 #include "cache.h"
@@ -31,7 +31,10 @@
 #include "exfont.h"
 #include "default_graphics.h"
 #include "bitmap.h"
+#include "color.h"
 #include "output.h"
+#include "rect.h"
+#include "tone.h"
 #include "player.h"
 #include <lcf/data.h>
 #include "game_clock.h"
@@ -39,104 +42,205 @@
 using namespace std::chrono_literals;
 
 namespace {
-	std::string MakeHashKey(StringView folder_name, StringView filename, bool transparent) {
-		return ToString(folder_name) + ":" + ToString(filename) + ":" + (transparent ? "T" : " ");
-	}
+	enum class CacheKind {
+		Bitmap,
+		Tile,
+		Effect
+	};
 
-	std::string MakeTileHashKey(StringView chipset_name, int id) {
-		std::string key;
-		key.reserve(chipset_name.size() + sizeof(int) + 2);
-		key.append(reinterpret_cast<char*>(&id), sizeof(id));
-		key.append(1, ':');
-		key.append(chipset_name.begin(), chipset_name.end());
+	/**
+	 * Key of a cached bitmap.
+	 * The strings are views, a lookup does not allocate. The keys of cached
+	 * items point into CacheItem::name.
+	 */
+	struct CacheKey {
+		CacheKind kind = CacheKind::Bitmap;
+		// Bitmap: directory and filename, Tile: chipset name
+		StringView folder;
+		StringView name;
+		bool transparent = false;
+		int tile_id = 0;
+		// Effect
+		const Bitmap* source = nullptr;
+		Rect rect;
+		bool flip_x = false;
+		bool flip_y = false;
+		Tone tone;
+		Color blend;
+	};
 
-		return key;
-	}
+	bool operator==(const CacheKey& l, const CacheKey& r) {
+		if (l.kind != r.kind) {
+			return false;
+		}
 
-	int IdFromTileHash(StringView key) {
-		int id = 0;
-		if (key.size() > sizeof(id)) {
-			std::memcpy(&id, key.data(), sizeof(id));
+		switch (l.kind) {
+			case CacheKind::Bitmap:
+				return l.transparent == r.transparent && l.folder == r.folder && l.name == r.name;
+			case CacheKind::Tile:
+				return l.tile_id == r.tile_id && l.name == r.name;
+			case CacheKind::Effect:
+				return l.source == r.source && l.rect == r.rect && l.flip_x == r.flip_x && l.flip_y == r.flip_y
+					&& l.tone == r.tone && l.blend == r.blend;
 		}
-		return id;
+		return false;
 	}
 
-	const char* NameFromTileHash(StringView key) {
-		int offset = sizeof(int) + 1;
-		if (static_cast<int>(key.size()) < offset) {
-			return "";
+	struct CacheKeyHash {
+		size_t operator()(const CacheKey& key) const {
+			// FNV-1a
+			uint64_t hash = 0xCBF29CE484222325;
+			auto mix = [&hash](uint64_t value) {
+				hash = (hash ^ value) * 0x100000001B3;
+			};
+			auto mix_str = [&mix](StringView str) {
+				for (char c: str) {
+					mix(static_cast<unsigned char>(c));
+				}
+				mix(str.size());
+			};
+
+			mix(static_cast<uint64_t>(key.kind));
+			switch (key.kind) {
+				case CacheKind::Bitmap:
+					mix_str(key.folder);
+					mix_str(key.name);
+					mix(key.transparent);
+					break;
+				case CacheKind::Tile:
+					mix_str(key.name);
+					mix(static_cast<uint32_t>(key.tile_id));
+					break;
+				case CacheKind::Effect:
+					mix(reinterpret_cast<uintptr_t>(key.source));
+					mix(static_cast<uint32_t>(key.rect.x) | static_cast<uint64_t>(static_cast<uint32_t>(key.rect.y)) << 32);
+					mix(static_cast<uint32_t>(key.rect.width) | static_cast<uint64_t>(static_cast<uint32_t>(key.rect.height)) << 32);
+					mix(key.flip_x | key.flip_y << 1);
+					mix(key.tone.red | key.tone.green << 8 | key.tone.blue << 16 | static_cast<uint64_t>(key.tone.gray) << 24);
+					mix(key.blend.red | key.blend.green << 8 | key.blend.blue << 16 | static_cast<uint64_t>(key.blend.alpha) << 24);
+					break;
+			}
+			return static_cast<size_t>(hash);
 		}
-		return key.data() + offset;
+	};
+
+	CacheKey MakeBitmapKey(StringView folder_name, StringView filename, bool transparent) {
+		CacheKey key;
+		key.folder = folder_name;
+		key.name = filename;
+		key.transparent = transparent;
+		return key;
+	}
+
+	CacheKey MakeTileKey(StringView chipset_name, int id) {
+		CacheKey key;
+		key.kind = CacheKind::Tile;
+		key.name = chipset_name;
+		key.tile_id = id;
+		return key;
 	}
 
 	struct CacheItem {
 		BitmapRef bitmap;
 		Game_Clock::time_point last_access;
+		CacheKey key;
+		/** Owns the strings of key */
+		std::string name;
+		/** Keeps the source of an effect alive, key.source must stay valid */
+		BitmapRef source;
 	};
 
-	using key_type = std::string;
-	std::unordered_map<key_type, CacheItem> cache;
-
-	using tile_key_type = std::string;
-	std::unordered_map<tile_key_type, std::weak_ptr<Bitmap>> cache_tiles;
-
-	// rect, flip_x, flip_y, tone, blend
-	using effect_key_type = std::tuple<BitmapRef, Rect, bool, bool, Tone, Color>;
-	std::map<effect_key_type, std::weak_ptr<Bitmap>> cache_effects;
+	/** All cached bitmaps, the most recently used first */
+	std::list<CacheItem> cache_lru;
+	std::unordered_map<CacheKey, std::list<CacheItem>::iterator, CacheKeyHash> cache;
 
 	std::string system_name;
 
 	std::string system2_name;
 
-	constexpr int cache_limit = 10 * 1024 * 1024;
-	size_t cache_size = 0;
+	size_t cache_limit = Cache::default_limit;
+	Cache::Stats cache_stats;
 
+	/**
+	 * Frees unreferenced bitmaps, least recently used first, until the
+	 * cache fits into the limit. Bitmaps used during the last frames are kept.
+	 */
 	void FreeBitmapMemory() {
 		auto cur_ticks = Game_Clock::GetFrameTime();
 
-		for (auto it = cache.begin(); it != cache.end();) {
-			if (it->second.bitmap.use_count() != 1) {
-				// Bitmap is referenced
-				++it;
-				continue;
+		auto it = cache_lru.end();
+		while (cache_stats.bytes > cache_limit && it != cache_lru.begin()) {
+			--it;
+
+			if (cur_ticks - it->last_access <= 50ms) {
+				// This and all items in front were used during the last 3 frames, must be important, keep them.
+				break;
 			}
 
-			auto last_access = cur_ticks - it->second.last_access;
-			bool cache_exhausted = cache_size > cache_limit;
-			if (cache_exhausted) {
-				if (last_access <= 50ms) {
-					// Used during the last 3 frames, must be important, keep it.
-					++it;
-					continue;
-				}
-			} else if (last_access <= 3s) {
-				++it;
+			if (it->bitmap.use_count() != 1) {
+				// Bitmap is referenced
 				continue;
 			}
 
 #ifdef CACHE_DEBUG
-			Output::Debug("Freeing memory of {}/{}", std::get<0>(i.first), std::get<1>(i.first));
+			Output::Debug("Freeing memory of {}/{}", it->key.folder, it->key.name);
 #endif
 
-			cache_size -= it->second.bitmap->GetSize();
+			cache_stats.bytes -= it->bitmap->GetSize();
+			++cache_stats.evictions;
 
-			it = cache.erase(it);
+			cache.erase(it->key);
+			it = cache_lru.erase(it);
 		}
 
 #ifdef CACHE_DEBUG
-		Output::Debug("Bitmap cache size: {}", cache_size / 1024.0 / 1024);
+		Output::Debug("Bitmap cache size: {}", cache_stats.bytes / 1024.0 / 1024);
 #endif
 	}
 
-	BitmapRef AddToCache(const std::string& key, BitmapRef bmp) {
+	/**
+	 * Looks up a cached bitmap and marks it as used.
+	 *
+	 * @param key key
+	 * @return bitmap or nullptr when not cached
+	 */
+	BitmapRef FindInCache(const CacheKey& key) {
+		auto it = cache.find(key);
+		if (it == cache.end()) {
+			++cache_stats.misses;
+			return nullptr;
+		}
+
+		++cache_stats.hits;
+		auto& item = it->second;
+		item->last_access = Game_Clock::GetFrameTime();
+		cache_lru.splice(cache_lru.begin(), cache_lru, item);
+		return item->bitmap;
+	}
+
+	BitmapRef AddToCache(const CacheKey& key, BitmapRef bmp, BitmapRef source = nullptr) {
+		cache_lru.push_front({ bmp, Game_Clock::GetFrameTime(), key, {}, std::move(source) });
+		auto& item = cache_lru.front();
+
+		// Let the key point to the strings of the item
+		item.name = ToString(key.folder) + ToString(key.name);
+		item.key.folder = StringView(item.name.data(), key.folder.size());
+		item.key.name = StringView(item.name.data() + key.folder.size(), key.name.size());
+
+		auto res = cache.emplace(item.key, cache_lru.begin());
+		assert(res.second && "Bitmap is already cached");
+		(void)res;
+
 		if (bmp) {
-			cache_size += bmp->GetSize();
+			cache_stats.bytes += bmp->GetSize();
 #ifdef CACHE_DEBUG
-			Output::Debug("Bitmap cache size (Add): {}", cache_size / 1024.0 / 1024.0);
+			Output::Debug("Bitmap cache size (Add): {}", cache_stats.bytes / 1024.0 / 1024.0);
 #endif
 		}
 
-		return (cache[key] = {bmp, Game_Clock::GetFrameTime()}).bitmap;
+		FreeBitmapMemory();
+
+		return bmp;
 	}
 
 	struct Material {
@@ -246,9 +350,9 @@ namespace {
 
 		BitmapRef bmp;
 
-		const auto key = MakeHashKey(s.directory, filename, transparent);
-		auto it = cache.find(key);
-		if (it == cache.end()) {
+		const auto key = MakeBitmapKey(s.directory, filename, transparent);
+		bmp = FindInCache(key);
+		if (!bmp) {
 			if (filename == CACHE_DEFAULT_BITMAP) {
 				bmp = LoadDummyBitmap<T>(s.directory, filename, true);
 			}
@@ -256,8 +360,6 @@ namespace {
 			if (!bmp) {
 				auto is = FileFinder::OpenImage(s.directory, filename);
 
-				FreeBitmapMemory();
-
 				if (!is) {
 					if (s.warn_missing) {
 						Output::Warning("Image not found: {}/{}", s.directory, filename);
@@ -282,9 +384,6 @@ namespace {
 			}
 
 			bmp = AddToCache(key, bmp);
-		} else {
-			it->second.last_access = Game_Clock::GetFrameTime();
-			bmp = it->second.bitmap;
 		}
 
 		assert(bmp);
@@ -386,11 +485,11 @@ BitmapRef Cache::System(StringView file) {
 }
 
 BitmapRef Cache::Exfont() {
-	const auto key = MakeHashKey("ExFont", "ExFont", false);
+	const auto key = MakeBitmapKey("ExFont", "ExFont", false);
 
-	auto it = cache.find(key);
+	auto bmp = FindInCache(key);
 
-	if (it == cache.end()) {
+	if (!bmp) {
 		// Allow overwriting of built-in exfont with a custom ExFont image file
 		// exfont_custom is filled by Player::CreateGameObjects
 		BitmapRef exfont_img;
@@ -404,16 +503,15 @@ BitmapRef Cache::Exfont() {
 
 		return AddToCache(key, exfont_img);
 	} else {
-		it->second.last_access = Game_Clock::GetFrameTime();
-		return it->second.bitmap;
+		return bmp;
 	}
 }
 
 BitmapRef Cache::Tile(StringView filename, int tile_id) {
-	const auto key = MakeTileHashKey(filename, tile_id);
-	auto it = cache_tiles.find(key);
+	const auto key = MakeTileKey(filename, tile_id);
+	auto bmp = FindInCache(key);
 
-	if (it == cache_tiles.end() || it->second.expired()) {
+	if (!bmp) {
 		BitmapRef chipset = Cache::Chipset(filename);
 		Rect rect = Rect(0, 0, 16, 16);
 
@@ -438,24 +536,23 @@ BitmapRef Cache::Tile(StringView filename, int tile_id) {
 		rect.x += sub_tile_id % 6 * 16;
 		rect.y += sub_tile_id / 6 * 16;
 
-		return(cache_tiles[key] = Bitmap::Create(*chipset, rect)).lock();
-	} else { return it->second.lock(); }
+		return AddToCache(key, Bitmap::Create(*chipset, rect));
+	} else { return bmp; }
 }
 
 BitmapRef Cache::SpriteEffect(const BitmapRef& src_bitmap, const Rect& rect, bool flip_x, bool flip_y, const Tone& tone, const Color& blend) {
-	const effect_key_type key {
-		src_bitmap,
-		rect,
-		flip_x,
-		flip_y,
-		tone,
-		blend
-	};
+	CacheKey key;
+	key.kind = CacheKind::Effect;
+	key.source = src_bitmap.get();
+	key.rect = rect;
+	key.flip_x = flip_x;
+	key.flip_y = flip_y;
+	key.tone = tone;
+	key.blend = blend;
 
-	const auto it = cache_effects.find(key);
+	auto bitmap_effects = FindInCache(key);
 
-	if (it == cache_effects.end() || it->second.expired()) {
-		BitmapRef bitmap_effects;
+	if (!bitmap_effects) {
 
 		auto create = [&rect] () -> BitmapRef {
 			return Bitmap::Create(rect.width, rect.height, true);
@@ -488,25 +585,25 @@ BitmapRef Cache::SpriteEffect(const BitmapRef& src_bitmap, const Rect& rect, boo
 
 		assert(bitmap_effects && "Effect cache used but no effect applied!");
 
-		return(cache_effects[key] = bitmap_effects).lock();
-	} else { return it->second.lock(); }
+		return AddToCache(key, bitmap_effects, src_bitmap);
+	} else { return bitmap_effects; }
 }
 
 void Cache::Clear() {
-	cache_effects.clear();
-	cache.clear();
-	cache_size = 0;
-
-	for (auto& kv : cache_tiles) {
-		auto& key = kv.first;
-		if (kv.second.expired()) {
+	for (auto& item : cache_lru) {
+		if (item.key.kind != CacheKind::Tile || item.bitmap.use_count() == 1) {
 			continue;
 		}
 		Output::Debug("possible leak in cached tilemap {}/{}",
-				NameFromTileHash(key), IdFromTileHash(key));
+				item.key.name, item.key.tile_id);
 	}
 
-	cache_tiles.clear();
+	Output::Debug("Bitmap cache: {} hits, {} misses, {} evictions, {:.1f} MiB",
+			cache_stats.hits, cache_stats.misses, cache_stats.evictions, cache_stats.bytes / 1024.0 / 1024.0);
+
+	cache.clear();
+	cache_lru.clear();
+	cache_stats.bytes = 0;
 }
 
 void Cache::ClearAll() {
@@ -552,3 +649,15 @@ BitmapRef Cache::System2() {
 		return nullptr;
 	}
 }
+
+void Cache::SetLimit(size_t bytes) {
+	cache_limit = bytes;
+	FreeBitmapMemory();
+}
+
+Cache::Stats Cache::GetStats() {
+	Stats stats = cache_stats;
+	stats.entries = cache.size();
+	stats.limit = cache_limit;
+	return stats;
+}
@@ -19,6 +19,7 @@
 #define EP_CACHE_H
 
 // Headers
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -61,6 +62,37 @@ namespace Cache {
 	void Clear();
 	void ClearAll();
 
+	/** Default size of the cached bitmaps in bytes */
+	constexpr size_t default_limit = 10 * 1024 * 1024;
+
+	/** Counters of the bitmap cache */
+	struct Stats {
+		/** Lookups which found a cached bitmap */
+		uint64_t hits = 0;
+		/** Lookups which had to create the bitmap */
+		uint64_t misses = 0;
+		/** Bitmaps freed to stay below the limit */
+		uint64_t evictions = 0;
+		/** Size of all cached bitmaps in bytes */
+		size_t bytes = 0;
+		/** Number of cached bitmaps */
+		size_t entries = 0;
+		/** Limit in bytes, see SetLimit */
+		size_t limit = 0;
+	};
+
+	/**
+	 * Sets the size of the cached bitmaps. When the cache grows beyond it
+	 * the least recently used bitmaps which are not referenced anymore are
+	 * freed.
+	 *
+	 * @param bytes limit in bytes
+	 */
+	void SetLimit(size_t bytes);
+
+	/** @return counters of the bitmap cache */
+	Stats GetStats();
+
 	/** @return the configured system bitmap, or nullptr if there is no system */
 	BitmapRef System();
 
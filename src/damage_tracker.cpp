@@ -0,0 +1,243 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Headers
+#include <algorithm>
+#include <cstring>
+#include "damage_tracker.h"
+#include "bitmap.h"
+#include "color.h"
+#include "drawable.h"
+#include "drawable_list.h"
+#include "opacity.h"
+#include "tone.h"
+
+namespace {
+	Rect Union(const Rect& l, const Rect& r) {
+		const int x1 = std::min(l.x, r.x);
+		const int y1 = std::min(l.y, r.y);
+		const int x2 = std::max(l.x + l.width, r.x + r.width);
+		const int y2 = std::max(l.y + l.height, r.y + r.height);
+		return Rect(x1, y1, x2 - x1, y2 - y1);
+	}
+
+	bool Overlaps(const Rect& l, const Rect& r) {
+		return !l.IsOutOfBounds(r);
+	}
+}
+
+DamageHash& DamageHash::Mix(uint64_t value) {
+	hash = (hash ^ value) * 0x9E3779B97F4A7C15;
+	hash ^= hash >> 32;
+	return *this;
+}
+
+DamageHash& DamageHash::Add(double value) {
+	uint64_t bits;
+	static_assert(sizeof(bits) == sizeof(value), "unexpected double size");
+	std::memcpy(&bits, &value, sizeof(bits));
+	return Mix(bits);
+}
+
+DamageHash& DamageHash::Add(const Rect& rect) {
+	return Add(rect.x).Add(rect.y).Add(rect.width).Add(rect.height);
+}
+
+DamageHash& DamageHash::Add(const Tone& tone) {
+	return Add(tone.red).Add(tone.green).Add(tone.blue).Add(tone.gray);
+}
+
+DamageHash& DamageHash::Add(const Color& color) {
+	return Add(color.red).Add(color.green).Add(color.blue).Add(color.alpha);
+}
+
+DamageHash& DamageHash::Add(const Opacity& opacity) {
+	return Add(opacity.top).Add(opacity.bottom).Add(opacity.split);
+}
+
+DamageHash& DamageHash::Add(StringView text) {
+	Mix(text.size());
+	for (char c: text) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3;
+	}
+	return *this;
+}
+
+DamageHash& DamageHash::Add(const Bitmap* bitmap) {
+	Mix(reinterpret_cast<uintptr_t>(bitmap));
+	return Mix(bitmap ? bitmap->GetRevision() : 0);
+}
+
+DamageHash& DamageHash::Add(const BitmapRef& bitmap) {
+	return Add(bitmap.get());
+}
+
+uint64_t DamageHash::Get() const {
+	return hash;
+}
+
+const std::vector<Rect>& DamageTracker::Collect(DrawableList& list, const Bitmap& dst, uint64_t background) {
+	damage.clear();
+	next_entries.clear();
+
+	if (list.IsDirty()) {
+		list.Sort();
+	}
+
+	const Rect screen_rect = dst.GetRect();
+	bool full = !valid
+		|| &dst != screen
+		|| dst.GetWidth() != screen_width
+		|| dst.GetHeight() != screen_height
+		|| dst.GetRevision() != screen_revision
+		|| background != this->background;
+
+	bool tracked = true;
+	for (auto* drawable: list) {
+		if (!drawable->IsVisible()) {
+			continue;
+		}
+
+		Rect rect;
+		DamageHash hash;
+		if (!drawable->GetDamage(rect, hash)) {
+			tracked = false;
+			continue;
+		}
+		rect.Adjust(screen_rect);
+		if (rect.IsEmpty()) {
+			rect = Rect();
+		}
+		next_entries.push_back({ drawable, rect, hash.Get() });
+	}
+
+	this->background = background;
+	pending = true;
+	// The area covered by untracked drawables is unknown, the next frame must be drawn completely
+	valid = tracked;
+
+	if (full || !tracked) {
+		DamageAll(dst);
+		return damage;
+	}
+
+	index.clear();
+	for (size_t i = 0; i < entries.size(); ++i) {
+		index[entries[i].drawable] = i;
+	}
+	matched.assign(entries.size(), false);
+
+	size_t last_index = 0;
+	bool first = true;
+	for (const auto& entry: next_entries) {
+		auto it = index.find(entry.drawable);
+		if (it == index.end()) {
+			damage.push_back(entry.rect);
+			continue;
+		}
+
+		const auto i = it->second;
+		if (!first && i < last_index) {
+			// The drawing order changed, overlapping drawables would be wrong
+			DamageAll(dst);
+			return damage;
+		}
+		first = false;
+		last_index = i;
+		matched[i] = true;
+
+		const auto& old = entries[i];
+		if (old.hash != entry.hash || old.rect != entry.rect) {
+			damage.push_back(old.rect);
+			damage.push_back(entry.rect);
+		}
+	}
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (!matched[i]) {
+			damage.push_back(entries[i].rect);
+		}
+	}
+
+	Merge(damage);
+	return damage;
+}
+
+void DamageTracker::Drawn(const Bitmap& dst) {
+	if (!pending) {
+		return;
+	}
+
+	entries.swap(next_entries);
+	screen = &dst;
+	screen_width = dst.GetWidth();
+	screen_height = dst.GetHeight();
+	screen_revision = dst.GetRevision();
+	pending = false;
+}
+
+void DamageTracker::Reset() {
+	entries.clear();
+	next_entries.clear();
+	screen = nullptr;
+	valid = false;
+	pending = false;
+}
+
+void DamageTracker::DamageAll(const Bitmap& dst) {
+	damage.clear();
+	damage.push_back(dst.GetRect());
+}
+
+void DamageTracker::Merge(std::vector<Rect>& rects) {
+	rects.erase(std::remove_if(rects.begin(), rects.end(), [](const Rect& r) { return r.IsEmpty(); }), rects.end());
+
+	// Merging two rectangles can make the result overlap others, repeat until stable
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (size_t i = 0; i < rects.size(); ++i) {
+			for (size_t j = i + 1; j < rects.size(); ) {
+				if (Overlaps(rects[i], rects[j])) {
+					rects[i] = Union(rects[i], rects[j]);
+					rects[j] = rects.back();
+					rects.pop_back();
+					merged = true;
+				} else {
+					++j;
+				}
+			}
+		}
+	}
+
+	if (static_cast<int>(rects.size()) > max_rects) {
+		Rect bounds = Bounds(rects);
+		rects.clear();
+		rects.push_back(bounds);
+	}
+}
+
+Rect DamageTracker::Bounds(const std::vector<Rect>& rects) {
+	Rect bounds;
+	for (const auto& rect: rects) {
+		if (rect.IsEmpty()) {
+			continue;
+		}
+		bounds = bounds.IsEmpty() ? rect : Union(bounds, rect);
+	}
+	return bounds;
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of EasyRPG Player.
+ *
+ * EasyRPG Player is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * EasyRPG Player is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with EasyRPG Player. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_DAMAGE_TRACKER_H
+#define EP_DAMAGE_TRACKER_H
+
+// Headers
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "memory_management.h"
+#include "rect.h"
+#include "string_view.h"
+
+class Bitmap;
+class Color;
+class Drawable;
+class DrawableList;
+class Tone;
+struct Opacity;
+
+/**
+ * Hash of everything which affects the output of a drawable,
+ * see Drawable::GetDamage.
+ */
+class DamageHash {
+public:
+	template <typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+	DamageHash& Add(T value) {
+		return Mix(static_cast<uint64_t>(value));
+	}
+
+	DamageHash& Add(double value);
+	DamageHash& Add(const Rect& rect);
+	DamageHash& Add(const Tone& tone);
+	DamageHash& Add(const Color& color);
+	DamageHash& Add(const Opacity& opacity);
+	DamageHash& Add(StringView text);
+
+	/**
+	 * Adds the identity and the revision of a bitmap.
+	 *
+	 * @param bitmap bitmap, can be null
+	 */
+	DamageHash& Add(const Bitmap* bitmap);
+	DamageHash& Add(const BitmapRef& bitmap);
+
+	/** @return the hash */
+	uint64_t Get() const;
+
+private:
+	DamageHash& Mix(uint64_t value);
+
+	uint64_t hash = 0xCBF29CE484222325;
+};
+
+/**
+ * Finds the parts of the screen which changed since the last drawn frame.
+ *
+ * Every visible drawable reports the screen rectangle it covers and a hash
+ * of its state. Drawables which changed their hash or rectangle damage the
+ * old and the new rectangle, added and removed drawables the rectangle they
+ * cover. The screen is damaged completely when a drawable is not tracked,
+ * when the drawing order changed or when the screen was changed elsewhere.
+ */
+class DamageTracker {
+public:
+	/** Maximum number of damaged rectangles, more are merged into one */
+	static constexpr int max_rects = 8;
+
+	/**
+	 * Compares the drawables of the list with the last drawn frame.
+	 *
+	 * @param list drawables, sorted when needed
+	 * @param dst screen the drawables are drawn on
+	 * @param background hash of the scene background drawn below the drawables
+	 * @return damaged parts of dst which must be redrawn, empty when nothing changed
+	 */
+	const std::vector<Rect>& Collect(DrawableList& list, const Bitmap& dst, uint64_t background);
+
+	/**
+	 * Must be called after the damaged parts returned by Collect were drawn.
+	 *
+	 * @param dst screen the drawables were drawn on
+	 */
+	void Drawn(const Bitmap& dst);
+
+	/** Forgets the last frame, the next Collect damages the whole screen */
+	void Reset();
+
+	/**
+	 * Merges overlapping rectangles. When more than max_rects remain
+	 * they are replaced by their bounding rectangle.
+	 *
+	 * @param rects rectangles, empty ones are removed
+	 */
+	static void Merge(std::vector<Rect>& rects);
+
+	/** @return bounding rectangle of rects */
+	static Rect Bounds(const std::vector<Rect>& rects);
+
+private:
+	struct Entry {
+		Drawable* drawable;
+		Rect rect;
+		uint64_t hash;
+	};
+
+	void DamageAll(const Bitmap& dst);
+
+	std::vector<Entry> entries;
+	std::vector<Entry> next_entries;
+	std::unordered_map<Drawable*, size_t> index;
+	std::vector<bool> matched;
+	std::vector<Rect> damage;
+
+	const Bitmap* screen = nullptr;
+	int screen_width = 0;
+	int screen_height = 0;
+	uint64_t screen_revision = 0;
+	uint64_t background = 0;
+	bool valid = false;
+	bool pending = false;
+};
+
+#endif
@@ -23,6 +23,17 @@ Drawable::~Drawable() {
 	DrawableMgr::Remove(this);
 }
 
+bool Drawable::GetDamage(Rect&, DamageHash&) {
+	return false;
+}
+
+bool Drawable::PrepareBand() {
+	return false;
+}
+
+void Drawable::DrawBand(Bitmap&) const {
+}
+
 void Drawable::SetZ(Z_t nz) {
 	if (_z != nz) DrawableMgr::OnUpdateZ(this);
 	_z = nz;
@@ -22,7 +22,9 @@
 #include <memory>
 
 class Bitmap;
+class DamageHash;
 class Drawable;
+class Rect;
 
 template <typename T>
 static constexpr bool IsDrawable = std::is_base_of<Drawable,T>::value;
@@ -57,6 +59,34 @@ public:
 
 	virtual void Draw(Bitmap& dst) = 0;
 
+	/**
+	 * Reports what the next Draw call outputs, used by the DamageTracker to
+	 * redraw only the changed parts of the screen. Called once per frame
+	 * before Draw. The state added to the hash must not be changed by Draw.
+	 *
+	 * @param rect screen rectangle covered by Draw
+	 * @param hash receives all state which affects the output of Draw
+	 * @return false when the drawable is not tracked, the whole screen is redrawn then
+	 */
+	virtual bool GetDamage(Rect& rect, DamageHash& hash);
+
+	/**
+	 * Prepares drawing with DrawBand, see BandRenderer. Called once per
+	 * frame on the main thread instead of Draw.
+	 *
+	 * @return false when DrawBand is not supported, Draw is called then
+	 */
+	virtual bool PrepareBand();
+
+	/**
+	 * Draws the drawable after PrepareBand. Called by several threads at once,
+	 * each with dst restricted to another band of the screen, so it must not
+	 * change any state.
+	 *
+	 * @param dst view of the screen clipped to the band
+	 */
+	virtual void DrawBand(Bitmap& dst) const;
+
 	Z_t GetZ() const;
 
 	void SetZ(Z_t z);
@@ -20,10 +20,13 @@
 #include "fps_overlay.h"
 #include "game_clock.h"
 #include "bitmap.h"
+#include "cache.h"
 #include "utils.h"
 #include "input.h"
 #include "font.h"
+#include "damage_tracker.h"
 #include "drawable_mgr.h"
+#include "player.h"
 
 using namespace std::chrono_literals;
 
@@ -40,6 +43,20 @@ FpsOverlay::FpsOverlay() :
 void FpsOverlay::UpdateText() {
 	auto fps = Utils::RoundTo<int>(Game_Clock::GetFPS());
 	text = "FPS: " + std::to_string(fps);
+
+	if (Player::debug_flag) {
+		// Bitmap cache usage and hit rate since the last refresh
+		auto stats = Cache::GetStats();
+		auto hits = stats.hits - last_cache_hits;
+		auto lookups = hits + stats.misses - last_cache_misses;
+		text += fmt::format(" Cache: {:.1f}M", stats.bytes / 1024.0 / 1024.0);
+		if (lookups > 0) {
+			text += fmt::format(" {}%", hits * 100 / lookups);
+		}
+		last_cache_hits = stats.hits;
+		last_cache_misses = stats.misses;
+	}
+
 	fps_dirty = true;
 }
 
@@ -109,3 +126,20 @@ void FpsOverlay::Draw(Bitmap& dst) {
 	}
 }
 
+bool FpsOverlay::GetDamage(Rect& rect, DamageHash& hash) {
+	hash.Add(draw_fps).Add(last_speed_mod);
+
+	if (draw_fps) {
+		hash.Add(text);
+		Rect size = Text::GetSize(*Font::DefaultBitmapFont(), text);
+		rect = Rect(1, 2, size.width + 1, size.height - 1);
+	}
+
+	if (last_speed_mod > 1) {
+		// Drawn at the right border, the whole top is covered
+		Rect size = Text::GetSize(*Font::DefaultBitmapFont(), "> x" + std::to_string(last_speed_mod));
+		rect = Rect(0, 2, Player::screen_width, size.height - 1);
+	}
+
+	return true;
+}
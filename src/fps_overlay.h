@@ -18,6 +18,7 @@
 #ifndef EP_FPS_OVERLAY_H
 #define EP_FPS_OVERLAY_H
 
+#include <cstdint>
 #include <deque>
 #include <string>
 #include "drawable.h"
@@ -28,6 +29,7 @@
 /**
  * FpsOverlay class.
  * Shows current FPS and the speedup indicator.
+ * In debug mode the usage of the bitmap cache is shown as well.
  */
 class FpsOverlay : public Drawable {
 public:
@@ -35,6 +37,8 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 	/**
 	 * Update the fps overlay.
 	 *
@@ -69,6 +73,9 @@ private:
 
 	std::string text;
 
+	uint64_t last_cache_hits = 0;
+	uint64_t last_cache_misses = 0;
+
 	int last_speed_mod = 1;
 	bool speedup_dirty = true;
 	bool fps_dirty = true;
@@ -20,6 +20,7 @@
 #include <vector>
 #include "cache.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "main_data.h"
 #include "frame.h"
 #include "drawable_mgr.h"
@@ -47,6 +48,15 @@ void Frame::Draw(Bitmap& dst) {
 	}
 }
 
+bool Frame::GetDamage(Rect& rect, DamageHash& hash) {
+	if (frame_bitmap) {
+		rect = frame_bitmap->GetRect();
+		hash.Add(frame_bitmap);
+	}
+
+	return true;
+}
+
 void Frame::OnFrameGraphicReady(FileRequestResult* result) {
 	frame_bitmap = Cache::Frame(result->file);
 }
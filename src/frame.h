@@ -32,6 +32,8 @@ public:
 	Frame();
 
 	void Draw(Bitmap& dst) override;
+
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
 	void Update();
 
 private:
@@ -58,6 +58,8 @@ void Game_ConfigVideo::Hide() {
 	stretch.SetOptionVisible(false);
 	touch_ui.SetOptionVisible(false);
 	game_resolution.SetOptionVisible(false);
+	render_threads.SetOptionVisible(false);
+	image_cache_size.SetOptionVisible(false);
 }
 
 void Game_ConfigAudio::Hide() {
@@ -308,6 +310,18 @@ void Game_Config::LoadFromArgs(CmdlineParser& cp) {
 			}
 			continue;
 		}
+		if (cp.ParseNext(arg, 1, "--render-threads")) {
+			if (arg.ParseValue(0, li_value)) {
+				video.render_threads.Set(li_value);
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--image-cache-size")) {
+			if (arg.ParseValue(0, li_value)) {
+				video.image_cache_size.Set(li_value);
+			}
+			continue;
+		}
 		if (cp.ParseNext(arg, 1, "--autobattle-algo")) {
 			std::string svalue;
 			if (arg.ParseValue(0, svalue)) {
@@ -348,10 +362,74 @@ void Game_Config::LoadFromArgs(CmdlineParser& cp) {
 			}
 			continue;
 		}
+		if (cp.ParseNext(arg, 1, "--threads")) {
+			if (arg.ParseValue(0, li_value)) {
+				multiplayer.server_threads.Set(li_value);
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--interest-radius")) {
+			if (arg.ParseValue(0, li_value)) {
+				multiplayer.server_interest_radius.Set(li_value);
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--tick-rate")) {
+			if (arg.ParseValue(0, li_value)) {
+				multiplayer.server_tick_rate.Set(li_value);
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--metrics-address")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_metrics_address.Set(std::move(svalue));
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--metrics-file")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_metrics_file.Set(std::move(svalue));
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--cluster-shard")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_cluster_shard.Set(std::move(svalue));
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--cluster-shards")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_cluster_shards.Set(std::move(svalue));
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--cluster-secret")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_cluster_secret.Set(std::move(svalue));
+			}
+			continue;
+		}
+		if (cp.ParseNext(arg, 1, "--capture-file")) {
+			std::string svalue;
+			if (arg.ParseValue(0, svalue)) {
+				multiplayer.server_capture_file.Set(std::move(svalue));
+			}
+			continue;
+		}
 		if (cp.ParseNext(arg, 0, "--no-heartbeats")) {
 			multiplayer.no_heartbeats.Set(true);
 			continue;
 		}
+		if (cp.ParseNext(arg, 0, "--no-compression")) {
+			multiplayer.no_compression.Set(true);
+			continue;
+		}
 
 		cp.SkipNext();
 	}
@@ -375,6 +453,8 @@ void Game_Config::LoadFromStream(Filesystem_Stream::InputStream& is) {
 	video.scaling_mode.FromIni(ini);
 	video.stretch.FromIni(ini);
 	video.touch_ui.FromIni(ini);
+	video.render_threads.FromIni(ini);
+	video.image_cache_size.FromIni(ini);
 	video.game_resolution.FromIni(ini);
 
 	if (ini.HasValue("Video", "WindowX") && ini.HasValue("Video", "WindowY") && ini.HasValue("Video", "WindowWidth") && ini.HasValue("Video", "WindowHeight")) {
@@ -447,6 +527,15 @@ void Game_Config::LoadFromStream(Filesystem_Stream::InputStream& is) {
 	multiplayer.server_bind_address.FromIni(ini);
 	multiplayer.server_bind_address_2.FromIni(ini);
 	multiplayer.server_max_users.FromIni(ini);
+	multiplayer.server_threads.FromIni(ini);
+	multiplayer.server_interest_radius.FromIni(ini);
+	multiplayer.server_tick_rate.FromIni(ini);
+	multiplayer.server_metrics_address.FromIni(ini);
+	multiplayer.server_metrics_file.FromIni(ini);
+	multiplayer.server_cluster_shard.FromIni(ini);
+	multiplayer.server_cluster_shards.FromIni(ini);
+	multiplayer.server_cluster_secret.FromIni(ini);
+	multiplayer.server_capture_file.FromIni(ini);
 	multiplayer.server_picture_names.FromIni(ini);
 	multiplayer.server_picture_prefixes.FromIni(ini);
 	multiplayer.server_virtual_3d_maps.FromIni(ini);
@@ -473,6 +562,8 @@ void Game_Config::WriteToStream(Filesystem_Stream::OutputStream& os) const {
 	video.scaling_mode.ToIni(os);
 	video.stretch.ToIni(os);
 	video.touch_ui.ToIni(os);
+	video.render_threads.ToIni(os);
+	video.image_cache_size.ToIni(os);
 	video.game_resolution.ToIni(os);
 
 	// only preserve when toggling between window and fullscreen is supported
@@ -540,6 +631,15 @@ void Game_Config::WriteToStream(Filesystem_Stream::OutputStream& os) const {
 	multiplayer.server_bind_address.ToIni(os);
 	multiplayer.server_bind_address_2.ToIni(os);
 	multiplayer.server_max_users.ToIni(os);
+	multiplayer.server_threads.ToIni(os);
+	multiplayer.server_interest_radius.ToIni(os);
+	multiplayer.server_tick_rate.ToIni(os);
+	multiplayer.server_metrics_address.ToIni(os);
+	multiplayer.server_metrics_file.ToIni(os);
+	multiplayer.server_cluster_shard.ToIni(os);
+	multiplayer.server_cluster_shards.ToIni(os);
+	multiplayer.server_cluster_secret.ToIni(os);
+	multiplayer.server_capture_file.ToIni(os);
 	multiplayer.server_picture_names.ToIni(os);
 	multiplayer.server_picture_prefixes.ToIni(os);
 	multiplayer.server_virtual_3d_maps.ToIni(os);
@@ -75,6 +75,8 @@ struct Game_ConfigVideo {
 		Utils::MakeSvArray("Scale to screen size (Causes scaling artifacts)", "Scale to multiple of the game resolution", "Like Nearest, but output is blurred to avoid artifacts")};
 	BoolConfigParam stretch{ "Stretch", "Stretch to the width of the window/screen", "Video", "Stretch", false };
 	BoolConfigParam touch_ui{ "Touch Ui", "Display the touch ui", "Video", "TouchUi", true };
+	RangeConfigParam<int> render_threads{ "Render Threads", "Number of threads drawing the screen (1: Off)", "Video", "RenderThreads", 1, 1, 16 };
+	RangeConfigParam<int> image_cache_size{ "Image Cache Size", "Memory in MiB used to keep images loaded", "Video", "ImageCacheSize", 10, 1, 1024 };
 	EnumConfigParam<GameResolution, 3> game_resolution{ "Resolution", "Game resolution. Changes require a restart.", "Video", "GameResolution", GameResolution::Original,
 		Utils::MakeSvArray("Original (Recommended)", "Widescreen (Experimental)", "Ultrawide (Experimental)"),
 		Utils::MakeSvArray("original", "widescreen", "ultrawide"),
@@ -107,10 +109,20 @@ struct Game_ConfigInput {
 
 struct Game_ConfigMultiplayer {
 	BoolConfigParam no_heartbeats{ "", "", "Multiplayer", "NoHeartbeats", false };
+	BoolConfigParam no_compression{ "", "", "Multiplayer", "NoCompression", false };
 	BoolConfigParam server_auto_start{ "", "", "Multiplayer", "ServerAutoStart", false };
 	StringConfigParam server_bind_address{ "", "", "Multiplayer", "ServerBindAddress", "[::]:6500" };
 	StringConfigParam server_bind_address_2{ "", "", "Multiplayer", "ServerBindAddress2", "" };
 	RangeConfigParam<int> server_max_users{ "", "", "Multiplayer", "ServerMaxUsers", 10, 0, 100 };
+	RangeConfigParam<int> server_threads{ "", "", "Multiplayer", "ServerThreads", 1, 1, 64 };
+	RangeConfigParam<int> server_interest_radius{ "", "", "Multiplayer", "ServerInterestRadius", 0, 0, 500 };
+	RangeConfigParam<int> server_tick_rate{ "", "", "Multiplayer", "ServerTickRate", 0, 0, 100 };
+	StringConfigParam server_metrics_address{ "", "", "Multiplayer", "ServerMetricsAddress", "" };
+	StringConfigParam server_metrics_file{ "", "", "Multiplayer", "ServerMetricsFile", "" };
+	StringConfigParam server_cluster_shard{ "", "", "Multiplayer", "ServerClusterShard", "" };
+	StringConfigParam server_cluster_shards{ "", "", "Multiplayer", "ServerClusterShards", "" };
+	StringConfigParam server_cluster_secret{ "", "", "Multiplayer", "ServerClusterSecret", "" };
+	StringConfigParam server_capture_file{ "", "", "Multiplayer", "ServerCaptureFile", "" };
 	StringConfigParam server_picture_names{ "", "", "Multiplayer", "ServerPictureNames", "" };
 	StringConfigParam server_picture_prefixes{ "", "", "Multiplayer", "ServerPicturePrefixes", "" };
 	StringConfigParam server_virtual_3d_maps{ "", "", "Multiplayer", "ServerVirtual3DMaps", "" };
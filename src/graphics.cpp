@@ -29,8 +29,12 @@
 #include "transition.h"
 #include "scene.h"
 #include "drawable_mgr.h"
+#include "band_renderer.h"
 #include "baseui.h"
+#include "damage_tracker.h"
 #include "game_clock.h"
+#include "game_system.h"
+#include "main_data.h"
 
 using namespace std::chrono_literals;
 
@@ -44,6 +48,11 @@ namespace Graphics {
 	std::unique_ptr<FpsOverlay> fps_overlay;
 
 	std::string window_title_key;
+
+	DamageTracker damage_tracker;
+	uint64_t GetBackgroundKey();
+
+	std::unique_ptr<BandRenderer> band_renderer;
 }
 
 void Graphics::Init() {
@@ -56,6 +65,7 @@ void Graphics::Init() {
 }
 
 void Graphics::Quit() {
+	band_renderer.reset();
 	fps_overlay.reset();
 	message_overlay.reset();
 	statustext_overlay.reset();
@@ -119,7 +129,42 @@ void Graphics::Draw(Bitmap& dst) {
 		min_z = transition.GetZ() + 1;
 		dst.Clear();
 	}
+
+	if (min_z != std::numeric_limits<Drawable::Z_t>::min()) {
+		damage_tracker.Reset();
+		LocalDraw(dst, min_z, max_z);
+		DisplayUi->SetDisplayDamage(dst.GetRect());
+		return;
+	}
+
+	const auto& damage = damage_tracker.Collect(DrawableMgr::GetLocalList(), dst, GetBackgroundKey());
+	if (damage.empty()) {
+		DisplayUi->SetDisplayDamage(Rect());
+		return;
+	}
+
+	const bool full = damage.size() == 1 && damage.front() == dst.GetRect();
+	if (!full) {
+		dst.SetClipRects(damage);
+	}
 	LocalDraw(dst, min_z, max_z);
+	if (!full) {
+		dst.ResetClip();
+	}
+
+	damage_tracker.Drawn(dst);
+	DisplayUi->SetDisplayDamage(DamageTracker::Bounds(damage));
+}
+
+uint64_t Graphics::GetBackgroundKey() {
+	// The background depends on the scene and for the default scene on the system background color
+	DamageHash hash;
+	hash.Add(reinterpret_cast<uintptr_t>(current_scene.get()));
+	hash.Add(DrawableMgr::GetLocalList().empty());
+	if (Main_Data::game_system) {
+		hash.Add(Main_Data::game_system->GetBackgroundColor());
+	}
+	return hash.Get();
 }
 
 void Graphics::LocalDraw(Bitmap& dst, Drawable::Z_t min_z, Drawable::Z_t max_z) {
@@ -129,7 +174,19 @@ void Graphics::LocalDraw(Bitmap& dst, Drawable::Z_t min_z, Drawable::Z_t max_z)
 		current_scene->DrawBackground(dst);
 	}
 
-	drawable_list.Draw(dst, min_z, max_z);
+	if (band_renderer) {
+		band_renderer->Draw(drawable_list, dst, min_z, max_z);
+	} else {
+		drawable_list.Draw(dst, min_z, max_z);
+	}
+}
+
+void Graphics::SetRenderThreads(int threads) {
+	if (threads <= 1) {
+		band_renderer.reset();
+	} else if (!band_renderer || band_renderer->GetThreads() != threads) {
+		band_renderer = std::make_unique<BandRenderer>(threads);
+	}
 }
 
 std::shared_ptr<Scene> Graphics::UpdateSceneCallback() {
@@ -53,6 +53,13 @@ namespace Graphics {
 
 	void LocalDraw(Bitmap& dst, Drawable::Z_t min_z, Drawable::Z_t max_z);
 
+	/**
+	 * Sets the number of threads drawing the screen, see BandRenderer.
+	 *
+	 * @param threads thread count, 1 draws on the calling thread only
+	 */
+	void SetRenderThreads(int threads);
+
 	std::shared_ptr<Scene> UpdateSceneCallback();
 
 	/**
@@ -20,6 +20,7 @@
 #include "message_overlay.h"
 #include "player.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "game_message.h"
 #include "drawable_mgr.h"
 #include "baseui.h"
@@ -60,6 +61,18 @@ void MessageOverlay::Draw(Bitmap& dst) {
 	dirty = false;
 }
 
+bool MessageOverlay::GetDamage(Rect& rect, DamageHash& hash) {
+	if (!IsAnyMessageVisible() && !show_all) {
+		return true;
+	}
+
+	// Draw shows the bitmap before it is refreshed, the change is visible one frame later
+	rect = Rect(ox, oy, bitmap->GetWidth(), bitmap->GetHeight());
+	hash.Add(bitmap).Add(dirty);
+
+	return true;
+}
+
 void MessageOverlay::AddMessage(const std::string& message, Color color) {
 	if (message.empty()) {
 		return;
@@ -17,12 +17,15 @@
  */
 
 #include "chatui.h"
+#include <functional>
 #include <memory>
+#include <thread>
 #include <vector>
 #include "../window_base.h"
 #include "../scene.h"
 #include "../scene_debug.h"
 #include "../bitmap.h"
+#include "../damage_tracker.h"
 #include "../output.h"
 #include "../drawable_mgr.h"
 #include "../font.h"
@@ -78,6 +81,12 @@ public:
 			*room_status, r_rect, Opacity::Opaque());
 	};
 
+	bool GetDamage(Rect& rect, DamageHash& hash) {
+		rect = bounds;
+		hash.Add(conn_status).Add(room_status);
+		return true;
+	}
+
 	void RefreshTheme() { }
 
 	void SetConnectionStatus(bool status, bool connecting = false) {
@@ -159,6 +168,7 @@ class DrawableChatLog : public Drawable {
 	bool overlay_oneline_flag = false;
 	bool overlay_auto_remove_flag = false;
 	float counter = 0;
+	bool prepared = false; // Prepare already ran for this frame
 	std::vector<DrawableChatEntry> messages;
 	Window_Base scroll_box; // box used as rendered design for a scrollbar
 	int scroll_position = 0;
@@ -374,6 +384,19 @@ class DrawableChatLog : public Drawable {
 		for(int i = 0; i < messages.size(); i++)
 			messages[i].dirty = true;
 	}
+
+	// removes expired messages, done once per frame
+	void Prepare() {
+		// automatically remove messages
+		if (overlay_flag && overlay_auto_remove_flag && messages.size() > 0) {
+			++counter;
+			// the delay is 10 seconds
+			if (Game_Clock::GetFPS() > 0.0f && counter > Game_Clock::GetFPS()*10.0f) {
+				counter = 0.0f;
+				RemoveFirstChatEntry();
+			}
+		}
+	}
 public:
 	DrawableChatLog(int x, int y, int w, int h)
 		: Drawable(Priority::Priority_Maximum, Drawable::Flags::Global),
@@ -408,6 +431,10 @@ public:
 	}
 
 	void Draw(Bitmap& dst) {
+		if(!prepared)
+			Prepare();
+		prepared = false;
+
 		// y offset to draw next message, from bottom of log panel
 		int next_height = -scroll_position;
 		unsigned int n_messages = messages.size();
@@ -439,17 +466,21 @@ public:
 			if(next_height > bounds.height)
 				break;
 		}
+	};
 
-		// automatically remove messages
-		if (overlay_flag && overlay_auto_remove_flag && messages.size() > 0) {
-			++counter;
-			// the delay is 10 seconds
-			if (Game_Clock::GetFPS() > 0.0f && counter > Game_Clock::GetFPS()*10.0f) {
-				counter = 0.0f;
-				RemoveFirstChatEntry();
-			}
+	bool GetDamage(Rect& rect, DamageHash& hash) {
+		// the removal counter advances once per frame, also when nothing is drawn
+		Prepare();
+		prepared = true;
+
+		rect = bounds;
+		hash.Add(bounds).Add(scroll_position).Add(visibility_flags).Add(overlay_flag);
+		for(auto& dmsg : messages) {
+			if(MessageVisible(dmsg, visibility_flags))
+				hash.Add(dmsg.render_graphic).Add(dmsg.dirty);
 		}
-	};
+		return true;
+	}
 
 	void RefreshTheme() {
 		auto new_theme = Cache::SystemOrBlack();
@@ -639,6 +670,13 @@ public:
 		dst.FillRect(selected_rect, Color(255, 255, 255, 100));
 	};
 
+	bool GetDamage(Rect& rect, DamageHash& hash) {
+		rect = bounds;
+		hash.Add(label).Add(type_text).Add(caret)
+			.Add(caret_index_tail).Add(caret_index_head).Add(scroll);
+		return true;
+	}
+
 	void RefreshTheme() { }
 
 	void UpdateTypeText(std::u32string text) {
@@ -760,6 +798,11 @@ public:
 
 	void Draw(Bitmap& dst) { }
 
+	bool GetDamage(Rect& rect, DamageHash& hash) {
+		// only holds the other drawables
+		return true;
+	}
+
 	void AddLogEntry(ChatEntry* msg) {
 		d_log.AddChatEntry(msg);
 	}
@@ -963,67 +1006,139 @@ uint32_t StringToCRC32(std::string& value) {
 	return *((uint32_t*)digest.data());
 }
 
-// https://cryptopp.com/wiki/Hash_Functions
+/**
+ * Key derivation worker
+ *  PBKDF2 takes a visible moment, so it runs on its own thread. The callback
+ *  of the latest request is called from ChatUi::Update on the main thread,
+ *  the results of older requests are discarded.
+ */
+std::mutex key_derivation_mutex;
+unsigned int key_derivation_serial = 0;
+bool key_derivation_done = false;
+std::string derived_key;
+std::function<void(std::string)> key_derivation_callback;
+
+void DeriveKeyAsync(std::string password, std::function<void(std::string)> callback) {
+	unsigned int serial;
+	{
+		const std::lock_guard<std::mutex> lock(key_derivation_mutex);
+		serial = ++key_derivation_serial;
+		key_derivation_done = false;
+		key_derivation_callback = std::move(callback);
+	}
+	std::thread([password = std::move(password), serial]() {
+		std::string key = GetPasswordHash(password);
+		const std::lock_guard<std::mutex> lock(key_derivation_mutex);
+		if (serial != key_derivation_serial)
+			return;
+		derived_key = std::move(key);
+		key_derivation_done = true;
+	}).detach();
+}
+
+void DeliverDerivedKey() {
+	std::function<void(std::string)> callback;
+	std::string key;
+	{
+		const std::lock_guard<std::mutex> lock(key_derivation_mutex);
+		if (!key_derivation_done)
+			return;
+		key_derivation_done = false;
+		key = std::move(derived_key);
+		callback = std::move(key_derivation_callback);
+	}
+	if (callback)
+		callback(std::move(key));
+}
+
+/**
+ * AES-GCM contexts of the current key
+ *  The key schedule and the GHASH tables are only set up again when the key
+ *  changes, each message only resynchronizes the contexts with its own IV.
+ * Messages are base64(IV + ciphertext + MAC).
+ */
+struct CryptCipher {
+	std::mutex m_mutex;
+	std::string password;
+	bool keyed = false;
+	CryptoPP::GCM<CryptoPP::AES>::Encryption encryptor;
+	CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor;
+	CryptoPP::AutoSeededRandomPool prng;
+
+	// https://cryptopp.com/wiki/Hash_Functions
+	void SetPassword(const std::string& _password) {
+		if (keyed && password == _password)
+			return;
+		CryptoPP::byte key[CryptoPP::AES::MAX_KEYLENGTH];
+		CryptoPP::SHA256().CalculateDigest(key, (CryptoPP::byte*)_password.c_str(), _password.length());
+		encryptor.SetKey(key, CryptoPP::AES::MAX_KEYLENGTH);
+		decryptor.SetKey(key, CryptoPP::AES::MAX_KEYLENGTH);
+		password = _password;
+		keyed = true;
+	}
+} crypt_cipher;
+
+constexpr size_t CRYPT_MAC_SIZE = 16;
+
 // https://cryptopp.com/wiki/Authenticated_Encryption
 std::string EncryptMessage(const std::string& password, const std::string& plain) {
-	CryptoPP::byte key[CryptoPP::AES::MAX_KEYLENGTH];
-	CryptoPP::SHA256().CalculateDigest(key, (CryptoPP::byte*)password.c_str(), password.length());
+	const std::lock_guard<std::mutex> lock(crypt_cipher.m_mutex);
 
-	CryptoPP::AutoSeededRandomPool prng;
-	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE];
-	prng.GenerateBlock(iv, CryptoPP::AES::BLOCKSIZE);
+	// IV, ciphertext and MAC, encoded at once
+	std::string data(CryptoPP::AES::BLOCKSIZE + plain.size() + CRYPT_MAC_SIZE, '\0');
+	CryptoPP::byte* iv = (CryptoPP::byte*)data.data();
+	CryptoPP::byte* cipher = iv + CryptoPP::AES::BLOCKSIZE;
+	crypt_cipher.prng.GenerateBlock(iv, CryptoPP::AES::BLOCKSIZE);
 
-	std::string cipher;
 	try {
-		CryptoPP::GCM<CryptoPP::AES>::Encryption encryptor;
-		encryptor.SetKeyWithIV(key, CryptoPP::AES::MAX_KEYLENGTH, iv, CryptoPP::AES::BLOCKSIZE);
-
-		CryptoPP::StringSource(plain, true,
-			new CryptoPP::AuthenticatedEncryptionFilter(encryptor,
-				new CryptoPP::StringSink(cipher)
-			)
-		);
+		crypt_cipher.SetPassword(password);
+		crypt_cipher.encryptor.EncryptAndAuthenticate(cipher, cipher + plain.size(), CRYPT_MAC_SIZE,
+			iv, CryptoPP::AES::BLOCKSIZE, nullptr, 0,
+			(const CryptoPP::byte*)plain.data(), plain.size());
 	} catch(const CryptoPP::Exception& e) {
+		crypt_cipher.keyed = false;
+		data.resize(CryptoPP::AES::BLOCKSIZE);
 		Output::Debug("EncryptMessage exception: {}", e.what());
 	}
 
 	std::string result;
 	CryptoPP::Base64Encoder encoder(new CryptoPP::StringSink(result), false);
-	encoder.Put(iv, sizeof(iv));
-	encoder.Put((CryptoPP::byte*)cipher.c_str(), cipher.length());
+	encoder.Put((CryptoPP::byte*)data.data(), data.size());
 	encoder.MessageEnd();
 
 	return std::move(result);
 }
 
 std::string DecryptMessage(const std::string& password, const std::string& data, std::string& recovered) {
-	CryptoPP::byte key[CryptoPP::AES::MAX_KEYLENGTH];
-	CryptoPP::SHA256().CalculateDigest(key, (CryptoPP::byte*)password.c_str(), password.length());
-
-	CryptoPP::byte iv[CryptoPP::AES::BLOCKSIZE];
-	std::string cipher;
-
-	CryptoPP::Base64Decoder decoder;
+	std::string decoded;
+	CryptoPP::Base64Decoder decoder(new CryptoPP::StringSink(decoded));
 	decoder.Put((CryptoPP::byte*)data.data(), data.size());
 	decoder.MessageEnd();
 
-	CryptoPP::word64 size = decoder.MaxRetrievable();
-	decoder.Get(iv, CryptoPP::AES::BLOCKSIZE);
-	size_t cipher_size = size-CryptoPP::AES::BLOCKSIZE;
-	cipher.resize(cipher_size);
-	decoder.Get((CryptoPP::byte*)cipher.data(), cipher_size);
-
+	recovered = "";
 	std::string exception_what;
-	try {
-		CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor;
-		decryptor.SetKeyWithIV(key, CryptoPP::AES::MAX_KEYLENGTH, iv, CryptoPP::AES::BLOCKSIZE);
+	if (decoded.size() < CryptoPP::AES::BLOCKSIZE + CRYPT_MAC_SIZE) {
+		exception_what = "DecryptMessage: message too short";
+		Output::Debug("{}", exception_what);
+		return std::move(exception_what);
+	}
+	const CryptoPP::byte* iv = (const CryptoPP::byte*)decoded.data();
+	const CryptoPP::byte* cipher = iv + CryptoPP::AES::BLOCKSIZE;
+	size_t cipher_size = decoded.size() - CryptoPP::AES::BLOCKSIZE - CRYPT_MAC_SIZE;
 
-		CryptoPP::StringSource(cipher, true,
-			new CryptoPP::AuthenticatedDecryptionFilter(decryptor,
-				new CryptoPP::StringSink(recovered)
-			)
-		);
+	const std::lock_guard<std::mutex> lock(crypt_cipher.m_mutex);
+	try {
+		crypt_cipher.SetPassword(password);
+		recovered.resize(cipher_size);
+		if (!crypt_cipher.decryptor.DecryptAndVerify((CryptoPP::byte*)recovered.data(),
+				cipher + cipher_size, CRYPT_MAC_SIZE, iv, CryptoPP::AES::BLOCKSIZE,
+				nullptr, 0, cipher, cipher_size)) {
+			recovered = "";
+			exception_what = "DecryptMessage: message hash or MAC not valid";
+			Output::Debug("{}", exception_what);
+		}
 	} catch(const CryptoPP::Exception& e) {
+		crypt_cipher.keyed = false;
 		recovered = "";
 		exception_what = e.what();
 		Output::Debug("DecryptMessage exception: {}", exception_what);
@@ -1251,11 +1366,11 @@ void InputsTyping() {
 				std::string chat_crypt_password = fnd.next(" ");
 				if (chat_crypt_password != "") {
 					AddClientInfo("CRYPT: Generating encryption key ...");
-					std::thread([chat_crypt_password]() {
-						GMI().GetConfig().client_chat_crypt_key.Set(GetPasswordHash(chat_crypt_password));
+					DeriveKeyAsync(chat_crypt_password, [](std::string key) {
+						GMI().GetConfig().client_chat_crypt_key.Set(key);
 						SendKeyHash();
 						AddClientInfo("CRYPT: Done");
-					}).detach();
+					});
 				}
 			}
 		// command: !log
@@ -1354,6 +1469,7 @@ void ChatUi::Update() {
 				Initialize();
 		}
 	} else {
+		DeliverDerivedKey();
 		ProcessInputs();
 	}
 }
@@ -66,17 +66,21 @@ void ClientConnection::HandleCloseOrTerm(bool terminated) {
 }
 
 void ClientConnection::HandleData(std::string_view data) {
-	std::lock_guard lock(m_receive_mutex);
 	if (data.size() == 4 && data.substr(0, 3) == "\uFFFD") {
 		std::string_view code = data.substr(3, 1);
 		if (code == "0")
 			Output::Warning("Server exited");
 		else if (code == "1")
 			Output::Warning("Access denied. Too many users");
+		std::lock_guard lock(m_receive_mutex);
 		m_system_queue.push(SystemMessage::TERMINATED);
 		return;
 	}
-	m_data_queue.push(std::move(std::string(data)));
+	if (!overflowing && m_data_ring.TryPush(data))
+		return;
+	std::lock_guard lock(m_receive_mutex);
+	m_overflow_queue.emplace(data);
+	overflowing = true;
 }
 
 void ClientConnection::Open() {
@@ -86,6 +90,8 @@ void ClientConnection::Open() {
 	socket->OnWarning = [](std::string_view m) { Output::Warning(m); };
 	socket->SetReadTimeout(cfg->no_heartbeats.Get() ? 0 : 6000);
 	socket->SetRemoteAddress(addr_host, addr_port);
+	// renegotiated on every connection
+	SetProtocol(Packet::PROTOCOL_TEXT);
 	socket->ConfigSocks5(socks5_addr_host, socks5_addr_port);
 	socket->OnData = [this](auto p1) { HandleData(p1); };
 	socket->OnConnect = [this]() { HandleOpen(); };
@@ -110,16 +116,39 @@ void ClientConnection::Send(std::string_view data) {
 	socket->Send(data);
 }
 
+void ClientConnection::SetCompression(bool enabled) {
+	if (!connected)
+		return;
+	socket->SetCompression(enabled);
+}
+
 void ClientConnection::Receive() {
-	std::lock_guard lock(m_receive_mutex);
-	while (!m_system_queue.empty()) {
-		DispatchSystem(m_system_queue.front());
-		m_system_queue.pop();
+	std::queue<SystemMessage> system_queue;
+	std::queue<std::string> overflow_queue;
+	{
+		std::lock_guard lock(m_receive_mutex);
+		std::swap(system_queue, m_system_queue);
+		// taken before the ring is drained: the ring only has older frames
+		if (overflowing)
+			std::swap(overflow_queue, m_overflow_queue);
 	}
-	while (!m_data_queue.empty()) {
-		Dispatch(m_data_queue.front());
-		m_data_queue.pop();
+	while (!system_queue.empty()) {
+		DispatchSystem(system_queue.front());
+		system_queue.pop();
 	}
+	m_data_ring.Drain([this](std::string_view data) {
+		Dispatch(data);
+	});
+	if (overflow_queue.empty())
+		return;
+	while (!overflow_queue.empty()) {
+		Dispatch(overflow_queue.front());
+		overflow_queue.pop();
+	}
+	// back to the ring once the frames in between have been taken as well
+	std::lock_guard lock(m_receive_mutex);
+	if (m_overflow_queue.empty())
+		overflowing = false;
 }
 
 /**
@@ -142,15 +171,13 @@ void ClientConnection::FlushQueue() {
 			const auto& e = m_queue.front();
 			if (namecmp(e->GetName(), include))
 				break;
-			std::string data = std::move(e->ToBytes());
+			std::string data = Encode(*e);
 			// prevent overflow
 			if (bulk.size() + data.size() > MAX_BULK_SIZE) {
 				Send(bulk);
 				bulk.clear();
 			}
-			if (!bulk.empty())
-				bulk += Packet::MSG_DELIM;
-			bulk += data;
+			AppendBulk(bulk, data, IsBinary());
 			m_queue.pop();
 		}
 		if (!bulk.empty())
@@ -20,7 +20,9 @@
 #define EP_CLIENTCONNECTION_H
 
 #include <mutex>
+#include <atomic>
 #include "connection.h"
+#include "spsc_ring.h"
 #include "../game_config.h"
 
 class ConnectorSocket;
@@ -47,6 +49,9 @@ public:
 	void Close() override;
 	void Send(std::string_view data) override;
 
+	// compresses the frames sent from now on, until the next connection
+	void SetCompression(bool enabled);
+
 	template<typename T, typename... Args>
 	void SendPacketAsync(Args... args) {
 		if (connected) {
@@ -70,8 +75,17 @@ private:
 	bool connecting = false;
 	bool connected = false;
 
+	/**
+	 * Received frames
+	 *  The socket thread copies them into m_data_ring, Receive dispatches
+	 *  them in place on the game thread. Only if the ring is full, they
+	 *  go to m_overflow_queue until Receive has emptied it, to keep the order.
+	 *  m_receive_mutex guards the system queue and the overflow queue.
+	 */
+	SpscFrameRing m_data_ring{ 1024 * 1024 };
+	std::queue<std::string> m_overflow_queue;
+	std::atomic<bool> overflowing{ false };
 	std::queue<SystemMessage> m_system_queue;
-	std::queue<std::string> m_data_queue;
 	std::mutex m_receive_mutex;
 
 	std::queue<std::unique_ptr<Packet>> m_queue;
@@ -0,0 +1,141 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compression.h"
+#include "packet.h"
+#include <algorithm>
+#include <zlib.h>
+
+using namespace FrameCompression;
+using Multiplayer::Packet;
+
+namespace {
+	// small window, the frames are at most 4 KiB in practice
+	constexpr int WINDOW_BITS = 13;
+	constexpr int MEM_LEVEL = 7;
+	// the dictionary is part of the wire format, newer names are not added
+	constexpr size_t DICTIONARY_NAMES = 29;
+	static_assert(DICTIONARY_NAMES <= Multiplayer::PacketIds::names_size);
+
+	// the trailer of Z_SYNC_FLUSH
+	constexpr std::string_view SYNC_TAIL{ "\0\0\xff\xff", 4 };
+
+	const std::string& GetDictionary() {
+		static const std::string dictionary = []() {
+			std::string d;
+			for (size_t i = 0; i < DICTIONARY_NAMES; ++i) {
+				d += Packet::MSG_DELIM;
+				d += Multiplayer::PacketIds::names[i];
+				d += Packet::PARAM_DELIM;
+			}
+			return d;
+		}();
+		return dictionary;
+	}
+
+	const Bytef* ToBytef(std::string_view s) {
+		return reinterpret_cast<const Bytef*>(s.data());
+	}
+}
+
+Deflater::Deflater() : stream(new z_stream()) {
+	ok = deflateInit2(stream.get(), Z_BEST_SPEED, Z_DEFLATED, -WINDOW_BITS,
+		MEM_LEVEL, Z_DEFAULT_STRATEGY) == Z_OK;
+	if (ok) {
+		const std::string& dictionary = GetDictionary();
+		ok = deflateSetDictionary(stream.get(), ToBytef(dictionary), dictionary.size()) == Z_OK;
+	}
+}
+
+Deflater::~Deflater() {
+	deflateEnd(stream.get());
+}
+
+bool Deflater::Compress(std::string_view data, std::string& out) {
+	if (!ok)
+		return false;
+	out.assign(MARK);
+	// a flush without input would not add anything
+	if (data.empty())
+		return true;
+	stream->next_in = const_cast<Bytef*>(ToBytef(data));
+	stream->avail_in = data.size();
+	do {
+		size_t used = out.size();
+		out.resize(used + deflateBound(stream.get(), stream->avail_in) + SYNC_TAIL.size() + 8);
+		stream->next_out = reinterpret_cast<Bytef*>(out.data() + used);
+		stream->avail_out = out.size() - used;
+		int err = deflate(stream.get(), Z_SYNC_FLUSH);
+		out.resize(out.size() - stream->avail_out);
+		if (err != Z_OK && err != Z_BUF_ERROR) {
+			ok = false;
+			return false;
+		}
+	} while (stream->avail_out == 0);
+	if (out.size() >= MARK.size() + SYNC_TAIL.size() &&
+			std::string_view(out).substr(out.size() - SYNC_TAIL.size()) == SYNC_TAIL)
+		out.resize(out.size() - SYNC_TAIL.size());
+	return true;
+}
+
+Inflater::Inflater() : stream(new z_stream()) {
+	ok = inflateInit2(stream.get(), -WINDOW_BITS) == Z_OK;
+	if (ok) {
+		// raw streams take the dictionary right away
+		const std::string& dictionary = GetDictionary();
+		ok = inflateSetDictionary(stream.get(), ToBytef(dictionary), dictionary.size()) == Z_OK;
+	}
+}
+
+Inflater::~Inflater() {
+	inflateEnd(stream.get());
+}
+
+bool Inflater::Decompress(std::string_view data, std::string& out) {
+	if (!ok || !IsCompressed(data))
+		return false;
+	out.clear();
+	if (data.size() == MARK.size())
+		return true;
+	auto inflate_all = [this, &out](std::string_view input) {
+		stream->next_in = const_cast<Bytef*>(ToBytef(input));
+		stream->avail_in = input.size();
+		// the output is full as long as there can be more of it
+		do {
+			size_t used = out.size();
+			// one byte more than allowed tells a bomb from a frame of the maximum size
+			if (used > MAX_OUTPUT_SIZE)
+				return false;
+			out.resize(std::min(used + input.size() * 4 + 1024, MAX_OUTPUT_SIZE + 1));
+			stream->next_out = reinterpret_cast<Bytef*>(out.data() + used);
+			stream->avail_out = out.size() - used;
+			int err = inflate(stream.get(), Z_SYNC_FLUSH);
+			out.resize(out.size() - stream->avail_out);
+			if (err != Z_OK && err != Z_BUF_ERROR)
+				return false;
+		} while (stream->avail_out == 0);
+		return true;
+	};
+	ok = inflate_all(data.substr(MARK.size())) && inflate_all(SYNC_TAIL);
+	if (!ok) {
+		inflateReset(stream.get());
+		out.clear();
+		out.shrink_to_fit();
+	}
+	return ok;
+}
@@ -0,0 +1,85 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_COMPRESSION_H
+#define EP_MULTIPLAYER_COMPRESSION_H
+
+#include <string>
+#include <string_view>
+#include <memory>
+
+struct z_stream_s;
+
+/**
+ * Per-connection deflate stream (see ProtocolPacket)
+ *  Every frame is compressed with the context of the previous frames of
+ *  the same connection and flushed to a byte boundary, so that it can be
+ *  inflated as soon as it arrives. The empty block of the flush is not
+ *  sent (as in permessage-deflate).
+ * Compressed frames start with MARK, text frames start with a packet name
+ *  and binary frames with Packet::BINARY_MARK, so both sides can mix them.
+ * The window of both sides starts with the packet names.
+ */
+namespace FrameCompression {
+	constexpr std::string_view MARK{ "\1", 1 };
+
+	// frames that could grow above the frame size limit are not compressed
+	constexpr size_t MAX_INPUT_SIZE = 60000;
+	// so no frame inflates to more, larger ones are decompression bombs
+	constexpr size_t MAX_OUTPUT_SIZE = MAX_INPUT_SIZE;
+
+	inline bool IsCompressed(std::string_view data) {
+		return data.size() >= MARK.size() && data.substr(0, MARK.size()) == MARK;
+	}
+
+	class Deflater {
+	public:
+		Deflater();
+		~Deflater();
+
+		/**
+		 * Replaces out with MARK and the compressed data
+		 *  @return false on error, the stream cannot be used anymore
+		 */
+		bool Compress(std::string_view data, std::string& out);
+
+	private:
+		std::unique_ptr<z_stream_s> stream;
+		bool ok = false;
+	};
+
+	class Inflater {
+	public:
+		Inflater();
+		~Inflater();
+
+		/**
+		 * Replaces out with the data of a frame that starts with MARK
+		 *  At most MAX_OUTPUT_SIZE bytes, beyond that the stream is reset
+		 *  and out is released.
+		 *  @return false on error, the stream cannot be used anymore
+		 */
+		bool Decompress(std::string_view data, std::string& out);
+
+	private:
+		std::unique_ptr<z_stream_s> stream;
+		bool ok = false;
+	};
+}
+
+#endif
@@ -46,36 +46,59 @@ void Connection::ParseAddress(std::string address, std::string& host, uint16_t&
 }
 
 void Connection::SendPacket(const Packet& p) {
-	Send(p.ToBytes());
+	std::string data;
+	AppendBulk(data, Encode(p), IsBinary());
+	Send(data);
 }
 
-Connection::ParameterList Connection::Split(std::string_view src,
-		std::string_view delim) {
-	std::vector<std::string_view> r;
+std::string Connection::Encode(const Packet& p) const {
+	if (IsBinary())
+		return p.ToBinary();
+	return p.ToBytes();
+}
+
+void Connection::AppendBulk(std::string& bulk, std::string_view data, bool binary) {
+	if (binary) {
+		if (bulk.empty())
+			bulk += Packet::BINARY_MARK;
+	} else if (!bulk.empty()) {
+		bulk += Packet::MSG_DELIM;
+	}
+	bulk += data;
+}
+
+void Connection::Split(std::string_view src, ParameterList& args) {
 	size_t p{}, p2{};
-	while ((p = src.find(delim, p)) != src.npos) {
-		r.emplace_back(src.substr(p2, p - p2));
-		p += delim.size();
+	while ((p = src.find(Packet::PARAM_DELIM, p)) != src.npos) {
+		args.emplace_back(src.substr(p2, p - p2));
+		p += Packet::PARAM_DELIM.size();
 		p2 = p;
 	}
-	r.emplace_back(src.substr(p2));
-	return r;
+	args.emplace_back(src.substr(p2));
 }
 
-void Connection::DispatchOne(std::string_view name, ParameterList args) {
-	auto it = handlers.find(std::string(name));
-	if (it != handlers.end()) {
-		std::invoke(it->second, args);
+void Connection::DispatchOne(uint8_t id, size_t size, const ParameterList& args) {
+	OnDispatch(id, size);
+	const auto& handler = handlers[id];
+	if (id != 0 && handler) {
+		std::invoke(handler, args);
 	} else {
 		Output::Debug("Connection: Unregistered packet received");
 	}
 }
 
-void Connection::Dispatch(const std::string_view data) {
-	std::vector<std::string_view> mstrs = Split(data, Packet::MSG_DELIM);
-	for (auto& mstr : mstrs) {
-		auto p = mstr.find(Multiplayer::Packet::PARAM_DELIM);
-		if (p == mstr.npos) {
+void Connection::DispatchText(std::string_view data) {
+	size_t p{}, p2{};
+	while (p2 <= data.size()) {
+		p = data.find(Packet::MSG_DELIM, p2);
+		if (p == data.npos)
+			p = data.size();
+		std::string_view mstr = data.substr(p2, p - p2);
+		p2 = p + Packet::MSG_DELIM.size();
+
+		args.clear();
+		auto pd = mstr.find(Packet::PARAM_DELIM);
+		if (pd == mstr.npos) {
 			/**
 			 * Usually npos is the maximum value of size_t.
 			 * Adding PARAM_DELIM.size() to it is undefined behavior.
@@ -83,13 +106,73 @@ void Connection::Dispatch(const std::string_view data) {
 			 * duplicated code because the statement in else clause will handle it.
 			 */
 			// the data has no parameter list
-			DispatchOne(mstr);
+			DispatchOne(Packet::GetPacketId(mstr), mstr.size(), args);
 		} else {
-			auto namestr = mstr.substr(0, p);
-			auto argstr = mstr.substr(p + Packet::PARAM_DELIM.size());
-			DispatchOne(namestr, Split(argstr));
+			Split(mstr.substr(pd + Packet::PARAM_DELIM.size()), args);
+			DispatchOne(Packet::GetPacketId(mstr.substr(0, pd)), mstr.size(), args);
+		}
+	}
+}
+
+void Connection::DispatchBinary(std::string_view data) {
+	size_t pos = 0;
+	while (pos < data.size()) {
+		uint64_t msg_size;
+		if (!Packet::ReadVarint(data, pos, msg_size) || msg_size == 0 ||
+				msg_size > data.size() - pos) {
+			Output::Debug("Connection: Malformed binary packet received");
+			return;
+		}
+		std::string_view msg = data.substr(pos, msg_size);
+		pos += msg_size;
+
+		args.clear();
+		size_t msg_pos = 1;
+		bool malformed = false;
+		while (msg_pos < msg.size()) {
+			uint64_t header;
+			if (!Packet::ReadVarint(msg, msg_pos, header)) {
+				malformed = true;
+				break;
+			}
+			if (header & 1) {
+				uint64_t str_size = header >> 1;
+				if (str_size > msg.size() - msg_pos) {
+					malformed = true;
+					break;
+				}
+				args.emplace_back(msg.substr(msg_pos, str_size));
+				msg_pos += str_size;
+			} else {
+				uint32_t zigzag = static_cast<uint32_t>(header >> 1);
+				args.emplace_back(static_cast<int>((zigzag >> 1) ^ (~(zigzag & 1) + 1)));
+			}
+		}
+		if (malformed) {
+			Output::Debug("Connection: Malformed binary packet received");
+			continue;
+		}
+
+		uint8_t id = static_cast<uint8_t>(msg[0]);
+		if (id == 0) {
+			// the name is the first parameter
+			if (args.empty() || args.front().IsNumber()) {
+				Output::Debug("Connection: Malformed binary packet received");
+				continue;
+			}
+			id = Packet::GetPacketId(args.front());
+			args.erase(args.begin());
 		}
+		DispatchOne(id, msg.size(), args);
+	}
+}
+
+void Connection::Dispatch(const std::string_view data) {
+	if (!data.empty() && data[0] == Packet::BINARY_MARK[0]) {
+		DispatchBinary(data.substr(Packet::BINARY_MARK.size()));
+		return;
 	}
+	DispatchText(data);
 }
 
 void Connection::RegisterSystemHandler(SystemMessage m, SystemMessageHandler h) {
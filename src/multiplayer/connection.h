@@ -24,6 +24,8 @@
 #include <memory>
 #include <map>
 #include <vector>
+#include <array>
+#include <optional>
 #include <functional>
 #include <type_traits>
 #include <string>
@@ -49,25 +51,42 @@ public:
 
 	void SendPacket(const Packet& p);
 
-	using ParameterList = std::vector<std::string_view>;
+	/**
+	 * Negotiated protocol version for sending, see Packet::PROTOCOL_*
+	 *  Receiving accepts both, binary frames start with Packet::BINARY_MARK.
+	 */
+	void SetProtocol(int _protocol) { protocol = _protocol; }
+	int GetProtocol() const { return protocol; }
+	bool IsBinary() const { return protocol >= Packet::PROTOCOL_BINARY; }
+
+	// encodes with the negotiated protocol, ready to be joined with AppendBulk
+	std::string Encode(const Packet& p) const;
+	// joins encoded packets into one frame
+	static void AppendBulk(std::string& bulk, std::string_view data, bool binary);
+
+	using ParameterList = std::vector<Packet::Parameter>;
 
 	template<typename M, typename = std::enable_if_t<std::conjunction_v<
 		std::is_convertible<M, Packet>,
 		std::is_constructible<M, const ParameterList&>
 	>>>
 	void RegisterHandler(std::function<void (M&)> h) {
-		handlers.emplace(M::packet_name, [this, h](const ParameterList& args) {
-			std::unique_ptr<M> pack;
-			bool invoke = true;
+		constexpr uint8_t id = Packet::GetPacketId(M::packet_name);
+		static_assert(id != 0, "the packet name is missing from PacketIds::names");
+		// the first registration wins
+		if (handlers[id])
+			return;
+		handlers[id] = [h](const ParameterList& args) {
+			// decoded on the stack
+			std::optional<M> pack;
 			try {
-				pack.reset(new M(args));
+				pack.emplace(args);
 			} catch (const std::exception& e) {
-				invoke = false;
 				Output::Debug("Connection: RegisterHandler exception: {}", e.what());
+				return;
 			}
-			if (invoke)
-				std::invoke(h, *pack);
-		});
+			std::invoke(h, *pack);
+		};
 	}
 
 	enum class SystemMessage {
@@ -88,12 +107,24 @@ protected:
 	void Dispatch(const std::string_view data);
 	void DispatchSystem(SystemMessage m);
 
+	// called for every received message before its handler, size is the encoded size
+	virtual void OnDispatch(uint8_t id, size_t size) {}
+
 private:
-	static std::vector<std::string_view> Split(std::string_view src, std::string_view delim = Packet::PARAM_DELIM);
+	int protocol{ Packet::PROTOCOL_TEXT };
+
+	// appends the parameters to args
+	static void Split(std::string_view src, ParameterList& args);
+
+	void DispatchText(std::string_view data);
+	void DispatchBinary(std::string_view data);
 
-	void DispatchOne(std::string_view name, ParameterList args = ParameterList());
+	void DispatchOne(uint8_t id, size_t size, const ParameterList& args);
 
-	std::map<std::string, std::function<void (const ParameterList&)>> handlers;
+	// indexed by packet id, see Packet::GetPacketId
+	std::array<std::function<void (const ParameterList&)>, 256> handlers;
+	// reused by every message to avoid allocations
+	ParameterList args;
 	SystemMessageHandler sys_handlers[static_cast<size_t>(SystemMessage::_PLACEHOLDER)];
 };
 
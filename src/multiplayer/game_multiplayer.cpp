@@ -102,6 +102,18 @@ void Game_Multiplayer::SpawnOtherPlayer(int id) {
 	DrawableMgr::SetLocalList(old_list);
 }
 
+void Game_Multiplayer::UpdatePlayerTile(PlayerOther& player) {
+	int x = player.ch->GetX();
+	int y = player.ch->GetY();
+	if (player.tile) {
+		auto [tile_x, tile_y] = *player.tile;
+		players_tiles.Move(0, tile_x, tile_y, x, y);
+	} else {
+		players_tiles.Add(0, x, y);
+	}
+	player.tile = { x, y };
+}
+
 // this assumes that the player is stopped
 // return true if player moves normally, false if players teleports
 static bool MovePlayerToPos(Game_PlayerOther& player, int x, int y) {
@@ -147,6 +159,9 @@ void Game_Multiplayer::InitConnection() {
 	using Connection = Multiplayer::Connection;
 
 	connection->RegisterSystemHandler(SystemMessage::OPEN, [this](Connection& _) {
+		// old servers ignore it and the connection stays on text
+		connection->SendPacket(ProtocolPacket(Packet::PROTOCOL_BINARY,
+			cfg.no_compression.Get() ? Packet::COMPRESSION_NONE : Packet::COMPRESSION_DEFLATE));
 		SendBasicData();
 		connection->SendPacket(NamePacket(cfg.client_chat_name.Get()));
 		CUI().SetStatusConnection(true);
@@ -211,7 +226,7 @@ void Game_Multiplayer::InitConnection() {
 			connection->SendPacketAsync<SyncSwitchPacket>(p.switch_id, value_bin);
 		}
 		if (p.sync_type >= 1) {
-			sync_switches.push_back(p.switch_id);
+			sync_switches.Add(p.switch_id);
 		}
 	});
 	connection->RegisterHandler<SyncVariablePacket>([this](SyncVariablePacket& p) {
@@ -231,19 +246,19 @@ void Game_Multiplayer::InitConnection() {
 			connection->SendPacketAsync<SyncVariablePacket>(p.var_id, value);
 		}
 		if (p.sync_type >= 1) {
-			sync_vars.push_back(p.var_id);
+			sync_vars.Add(p.var_id);
 		}
 	});
 	connection->RegisterHandler<SyncEventPacket>([this](SyncEventPacket& p) {
 		if (p.trigger_type != 1) {
-			sync_events.push_back(p.event_id);
+			sync_events.Add(p.event_id);
 		}
 		if (p.trigger_type >= 1) {
-			sync_action_events.push_back(p.event_id);
+			sync_action_events.Add(p.event_id);
 		}
 	});
 	connection->RegisterHandler<SyncPicturePacket>([this](SyncPicturePacket& p) {
-		sync_picture_names.push_back(p.picture_name);
+		sync_picture_names.insert(p.picture_name);
 	});
 	// <<-
 	connection->RegisterHandler<ConfigPacket>([this](ConfigPacket& p) {
@@ -251,15 +266,15 @@ void Game_Multiplayer::InitConnection() {
 			Strfnd fnd(p.config);
 			while (!fnd.at_end()) {
 				if (global_sync_picture_names.size() < 500)
-					global_sync_picture_names.emplace_back(Utils::UnescapeString(fnd.next_esc(",")));
+					global_sync_picture_names.insert(Utils::UnescapeString(fnd.next_esc(",")));
 				else
 					break;
 			}
 		} else if (p.type == 1) {
 			Strfnd fnd(p.config);
 			while (!fnd.at_end()) {
-				if (global_sync_picture_prefixes.size() < 500)
-					global_sync_picture_prefixes.emplace_back(Utils::UnescapeString(fnd.next_esc(",")));
+				if (global_sync_picture_prefixes.Size() < 500)
+					global_sync_picture_prefixes.Add(Utils::UnescapeString(fnd.next_esc(",")));
 				else
 					break;
 			}
@@ -281,7 +296,13 @@ void Game_Multiplayer::InitConnection() {
 		}
 	});
 	connection->RegisterHandler<BattleAnimIdListSyncPacket>([this](BattleAnimIdListSyncPacket& p) {
-		sync_battle_anim_ids.assign(p.ids.begin(), p.ids.end());
+		sync_battle_anim_ids.Clear();
+		for (int id : p.ids)
+			sync_battle_anim_ids.Add(id);
+	});
+	connection->RegisterHandler<ProtocolPacket>([this](ProtocolPacket& p) {
+		connection->SetProtocol(Packet::GetSupportedProtocol(p.version));
+		connection->SetCompression(p.compression == Packet::COMPRESSION_DEFLATE);
 	});
 	connection->RegisterHandler<RoomPacket>([this](RoomPacket& p) {
 		if (p.room_id != room_id) {
@@ -318,11 +339,17 @@ void Game_Multiplayer::InitConnection() {
 			player.name_tag.reset();
 			DrawableMgr::SetLocalList(old_list);
 		}
+		if (player.tile) {
+			auto [tile_x, tile_y] = *player.tile;
+			players_tiles.Remove(0, tile_x, tile_y);
+			player.tile.reset();
+		}
 		// virtual 3d
 		auto cfg_it = virtual_3d_map_configs.find(room_id);
 		if (cfg_it != virtual_3d_map_configs.end()) {
 			for (const auto& it : player.previous_pos) {
-				players_pos_cache.erase(it.second);
+				auto [type, x, y] = it.second;
+				players_pos_cache.Remove(type, x, y);
 				if (cfg_it->second.refresh_switch_id != -1 && it.first == 1)
 					Main_Data::game_switches->Flip(cfg_it->second.refresh_switch_id);
 			}
@@ -594,11 +621,12 @@ void Game_Multiplayer::SwitchRoom(int map_id, bool room_switch) {
 
 void Game_Multiplayer::Reset() {
 	players.clear();
-	players_pos_cache.clear();
-	sync_switches.clear();
-	sync_vars.clear();
-	sync_events.clear();
-	sync_action_events.clear();
+	players_pos_cache.Clear();
+	players_tiles.Clear();
+	sync_switches.Clear();
+	sync_vars.Clear();
+	sync_events.Clear();
+	sync_action_events.Clear();
 	sync_picture_names.clear();
 	ResetRepeatingFlash();
 	if (Main_Data::game_pictures) {
@@ -696,11 +724,11 @@ void Game_Multiplayer::MainPlayerTriggeredEvent(int event_id, bool action) {
 		connection->SendPacketAsync<SyncEventPacket>(event_id, action);
 	};
 	if (action) {
-		if (std::find(sync_action_events.begin(), sync_action_events.end(), event_id) != sync_action_events.end()) {
+		if (sync_action_events.Contains(event_id)) {
 			sep(1);
 		}
 	} else {
-		if (std::find(sync_events.begin(), sync_events.end(), event_id) != sync_events.end()) {
+		if (sync_events.Contains(event_id)) {
 			sep(0);
 		}
 	}
@@ -718,38 +746,12 @@ void Game_Multiplayer::SePlayed(const lcf::rpg::Sound& sound) {
 }
 
 bool Game_Multiplayer::IsPictureSynced(int pic_id, Game_Pictures::ShowParams& params) {
-	bool picture_synced = false;
-
-	for (auto& picture_name : global_sync_picture_names) {
-		if (picture_name == params.name) {
-			picture_synced = true;
-			break;
-		}
-	}
-
-	if (!picture_synced) {
-		for (auto& picture_prefix : global_sync_picture_prefixes) {
-			std::string name_lower = params.name;
-			std::transform(name_lower.begin(), name_lower.end(), name_lower.begin(), [](unsigned char c) { return std::tolower(c); });
-			if (name_lower.rfind(picture_prefix, 0) == 0) {
-				picture_synced = true;
-				break;
-			}
-		}
-	}
+	bool picture_synced = global_sync_picture_names.count(params.name) > 0 ||
+		global_sync_picture_prefixes.MatchesLower(params.name);
 
 	sync_picture_cache[pic_id] = picture_synced;
 
-	if (!picture_synced) {
-		for (auto& picture_name : sync_picture_names) {
-			if (picture_name == params.name) {
-				picture_synced = true;
-				break;
-			}
-		}
-	}
-
-	return picture_synced;
+	return picture_synced || sync_picture_names.count(params.name) > 0;
 }
 
 void Game_Multiplayer::PictureShown(int pic_id, Game_Pictures::ShowParams& params) {
@@ -778,16 +780,7 @@ void Game_Multiplayer::PictureErased(int pic_id) {
 }
 
 bool Game_Multiplayer::IsBattleAnimSynced(int anim_id) {
-	bool anim_synced = false;
-
-	for (auto& battle_anim_id : sync_battle_anim_ids) {
-		if (battle_anim_id == anim_id) {
-			anim_synced = true;
-			break;
-		}
-	}
-
-	return anim_synced;
+	return sync_battle_anim_ids.Contains(anim_id);
 }
 
 void Game_Multiplayer::PlayerBattleAnimShown(int anim_id) {
@@ -841,13 +834,13 @@ void Game_Multiplayer::ApplyTone(Tone tone) {
 }
 
 void Game_Multiplayer::SwitchSet(int switch_id, int value_bin) {
-	if (std::find(sync_switches.begin(), sync_switches.end(), switch_id) != sync_switches.end()) {
+	if (sync_switches.Contains(switch_id)) {
 		connection->SendPacketAsync<SyncSwitchPacket>(switch_id, value_bin);
 	}
 }
 
 void Game_Multiplayer::VariableSet(int var_id, int value) {
-	if (std::find(sync_vars.begin(), sync_vars.end(), var_id) != sync_vars.end()) {
+	if (sync_vars.Contains(var_id)) {
 		connection->SendPacketAsync<SyncVariablePacket>(var_id, value);
 	}
 }
@@ -867,10 +860,8 @@ void Game_Multiplayer::EventLocationChanged(int event_id, int x, int y) {
 int Game_Multiplayer::GetTerrainTag(int original_terrain_id, int x, int y) {
 	auto cfg_it = virtual_3d_map_configs.find(room_id);
 	if (cfg_it != virtual_3d_map_configs.end()) {
-		auto it = players_pos_cache.find(std::make_tuple(
-			cfg_it->second.character_event_id != -1 ? 1 : 0, x, y));
-		if (it != players_pos_cache.end())
-			return it->second;
+		if (players_pos_cache.Contains(cfg_it->second.character_event_id != -1 ? 1 : 0, x, y))
+			return cfg_it->second.character_terrain_id;
 	}
 	return original_terrain_id;
 }
@@ -896,13 +887,11 @@ void Game_Multiplayer::MapUpdate() {
 
 		bool is_virtual_3d_map = false;
 		bool virtual_3d_updated = false;
-		int virtual_3d_character_terrain_id;
 		int virtual_3d_refresh_switch_id;
 
 		auto cfg_it = virtual_3d_map_configs.find(room_id);
 		if (cfg_it != virtual_3d_map_configs.end()) {
 			is_virtual_3d_map = true;
-			virtual_3d_character_terrain_id = cfg_it->second.character_terrain_id;
 			virtual_3d_refresh_switch_id = cfg_it->second.refresh_switch_id;
 		}
 
@@ -918,14 +907,16 @@ void Game_Multiplayer::MapUpdate() {
 			}
 			if (!q.empty() && is_virtual_3d_map) {
 				auto [type, x, y] = q.front();
-				auto it = p.second.previous_pos.find(type);
-				if (it != p.second.previous_pos.end())
-					players_pos_cache.erase(it->second);
-				auto pos = std::make_tuple(type, x, y);
-				if (players_pos_cache.size() < 100)
-					players_pos_cache[pos] = virtual_3d_character_terrain_id;
-				if (type > -1 && type < 2)
-					p.second.previous_pos[type] = pos;
+				if (type > -1 && type < 2) {
+					auto it = p.second.previous_pos.find(type);
+					if (it != p.second.previous_pos.end()) {
+						auto [_, previous_x, previous_y] = it->second;
+						players_pos_cache.Move(type, previous_x, previous_y, x, y);
+					} else {
+						players_pos_cache.Add(type, x, y);
+					}
+					p.second.previous_pos[type] = std::make_tuple(type, x, y);
+				}
 				virtual_3d_updated = true;
 			}
 			if (!q.empty() && ch->IsStopping()) {
@@ -958,42 +949,24 @@ void Game_Multiplayer::MapUpdate() {
 			ch->SetProcessed(false);
 			ch->Update();
 			p.second.sprite->Update();
+			UpdatePlayerTile(p.second);
+		}
 
-			if (check_name_tag_overlap) {
-				bool overlap = false;
-				int x = ch->GetX();
-				int y = ch->GetY();
-				for (auto& p2 : players) {
-					auto& ch2 = p2.second.ch;
-					int x2 = ch2->GetX();
-					if (x == x2) {
-						int y2 = ch2->GetY();
-						if (y == 0) {
-							if (Game_Map::LoopVertical() && y2 == Game_Map::GetTilesY() - 1) {
-								overlap = true;
-								break;
-							}
-						} else if (y2 == y - 1) {
-							overlap = true;
-							break;
-						}
-					}
-				}
-				if (!overlap) {
-					auto& player = Main_Data::game_player;
-					if (x == player->GetX()) {
-						if (y == 0) {
-							if (Game_Map::LoopVertical() && player->GetY() == Game_Map::GetTilesY() - 1) {
-								overlap = true;
-							}
-						} else if (player->GetY() == y - 1) {
-							overlap = true;
-						}
-					}
-				}
+		// a name tag is transparent if someone stands on the tile above
+		if (check_name_tag_overlap) {
+			auto& player = Main_Data::game_player;
+			for (auto& p : players) {
 				auto name_tag = p.second.name_tag.get();
-				if (name_tag)
-					name_tag->SetTransparent(overlap);
+				if (!name_tag)
+					continue;
+				int x = p.second.ch->GetX();
+				int y = p.second.ch->GetY();
+				int above_y = y - 1;
+				if (y == 0)
+					above_y = Game_Map::LoopVertical() ? Game_Map::GetTilesY() - 1 : -1;
+				bool overlap = above_y != -1 && (players_tiles.Contains(0, x, above_y) ||
+					(x == player->GetX() && above_y == player->GetY()));
+				name_tag->SetTransparent(overlap);
 			}
 		}
 
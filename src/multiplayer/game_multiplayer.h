@@ -21,10 +21,13 @@
 
 #include <string>
 #include <bitset>
+#include <unordered_set>
 #include "../string_view.h"
 #include "../game_config.h"
 #include "../game_pictures.h"
 #include "../tone.h"
+#include "sync_tables.h"
+#include "tile_hash.h"
 #include <lcf/rpg/sound.h>
 
 class ClientConnection;
@@ -131,23 +134,26 @@ private:
 	std::map<int, std::string> global_players_system;
 	std::map<int, PlayerOther> players;
 	std::vector<PlayerOther> dc_players; // disconnect and player fade
-	std::map<std::tuple<int8_t, int16_t, int16_t>, uint8_t> players_pos_cache; // {type, x, y} = any
-	std::vector<int> sync_switches;
-	std::vector<int> sync_vars;
-	std::vector<int> sync_events;
-	std::vector<int> sync_action_events;
-	std::vector<std::string> sync_picture_names; // for badge conditions
-	std::vector<std::string> global_sync_picture_names;
-	std::vector<std::string> global_sync_picture_prefixes;
+	TileHash players_pos_cache; // virtual 3d: {type, x, y} of the consumed move commands
+	TileHash players_tiles; // {0, x, y} of the characters, for the name tags
+	// looked up on every switch/variable write of the interpreter
+	SyncIdSet sync_switches;
+	SyncIdSet sync_vars;
+	SyncIdSet sync_events;
+	SyncIdSet sync_action_events;
+	std::unordered_set<std::string> sync_picture_names; // for badge conditions
+	std::unordered_set<std::string> global_sync_picture_names;
+	SyncPrefixTrie global_sync_picture_prefixes;
 	std::map<int, Virtual3DMapConfig> virtual_3d_map_configs;
 	std::map<int, bool> sync_picture_cache;
-	std::vector<int> sync_battle_anim_ids;
+	SyncIdSet sync_battle_anim_ids;
 	int last_flash_frame_index{-1};
 	std::unique_ptr<std::array<int, 5>> last_frame_flash;
 	std::map<int, std::array<int, 5>> repeating_flashes;
 	std::shared_ptr<int> sys_graphic_request_id;
 
 	void SpawnOtherPlayer(int id);
+	void UpdatePlayerTile(PlayerOther& player);
 	void ResetRepeatingFlash();
 	void InitConnection();
 };
@@ -0,0 +1,471 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gateway.h"
+#include <algorithm>
+#include <optional>
+#include "messages.h"
+#include "strfnd.h"
+#include "../output.h"
+
+using namespace Multiplayer;
+using namespace Messages;
+
+namespace {
+	constexpr size_t MAX_BULK_SIZE = Connection::MAX_QUEUE_SIZE - Packet::MSG_DELIM.size();
+
+	// the old shard is closed by the gateway if it does not close the link by itself
+	constexpr int HANDOFF_TIMEOUT_TICKS = 5;
+
+	constexpr uint8_t PROTOCOL_ID = Packet::GetPacketId(ProtocolPacket::packet_name);
+	constexpr uint8_t ROOM_ID = Packet::GetPacketId(RoomPacket::packet_name);
+	constexpr uint8_t CHAT_ID = Packet::GetPacketId(ChatPacket::packet_name);
+	constexpr uint8_t GATEWAY_ID = Packet::GetPacketId(GatewayPacket::packet_name);
+
+	// the state of the player, in the order it is replayed to a new shard
+	constexpr uint8_t REPLAYED_IDS[] = {
+		PROTOCOL_ID,
+		Packet::GetPacketId(NamePacket::packet_name),
+		Packet::GetPacketId(MovePacket::packet_name),
+		Packet::GetPacketId(SpeedPacket::packet_name),
+		Packet::GetPacketId(SpritePacket::packet_name),
+		Packet::GetPacketId(FacingPacket::packet_name),
+		Packet::GetPacketId(HiddenPacket::packet_name),
+		Packet::GetPacketId(SystemPacket::packet_name),
+		// only the crypt key hash
+		CHAT_ID,
+	};
+
+	bool IsReplayed(uint8_t id) {
+		for (uint8_t replayed_id : REPLAYED_IDS) {
+			if (id == replayed_id)
+				return true;
+		}
+		return false;
+	}
+
+	bool IsBinaryFrame(std::string_view data) {
+		return !data.empty() && data[0] == Packet::BINARY_MARK[0];
+	}
+
+	/**
+	 * Calls f(id, message) for every message of a frame, see Connection::Dispatch
+	 *  The binary messages keep their size prefix, so that they can be joined
+	 *  again with Connection::AppendBulk. Named binary messages have the id 0.
+	 */
+	template<typename F>
+	void ForEachMessage(std::string_view data, bool binary, F&& f) {
+		if (binary) {
+			size_t pos = Packet::BINARY_MARK.size();
+			while (pos < data.size()) {
+				size_t begin = pos;
+				uint64_t msg_size;
+				if (!Packet::ReadVarint(data, pos, msg_size) || msg_size == 0 ||
+						msg_size > data.size() - pos)
+					return;
+				uint8_t id = static_cast<uint8_t>(data[pos]);
+				pos += msg_size;
+				f(id, data.substr(begin, pos - begin));
+			}
+			return;
+		}
+		size_t p{}, p2{};
+		while (p2 <= data.size()) {
+			p = data.find(Packet::MSG_DELIM, p2);
+			if (p == data.npos)
+				p = data.size();
+			std::string_view msg = data.substr(p2, p - p2);
+			p2 = p + Packet::MSG_DELIM.size();
+			f(Packet::GetPacketId(msg.substr(0, msg.find(Packet::PARAM_DELIM))), msg);
+		}
+	}
+
+	// decodes the few messages that the gateway looks into
+	class MessageDecoder : public Connection {
+	public:
+		std::optional<int> room_id;
+		std::optional<int> protocol;
+		std::optional<int> chat_visibility;
+		int chat_crypt_key_hash = 0;
+
+		MessageDecoder() {
+			RegisterHandler<RoomPacket>([this](RoomPacket& p) { room_id = p.room_id; });
+			RegisterHandler<ProtocolPacket>([this](ProtocolPacket& p) { protocol = p.version; });
+			RegisterHandler<ChatPacket>([this](ChatPacket& p) {
+				chat_visibility = p.visibility;
+				chat_crypt_key_hash = p.crypt_key_hash;
+			});
+		}
+
+		void Decode(std::string_view msg, bool binary) {
+			room_id.reset();
+			protocol.reset();
+			chat_visibility.reset();
+			if (binary) {
+				buf.assign(Packet::BINARY_MARK);
+				buf += msg;
+				Dispatch(buf);
+			} else {
+				Dispatch(msg);
+			}
+		}
+
+	protected:
+		void Open() override {}
+		void Close() override {}
+		void Send(std::string_view data) override {}
+
+	private:
+		std::string buf;
+	};
+
+	// the loop thread only
+	MessageDecoder decoder;
+}
+
+void ClusterGateway::SetConfig(const Game_ConfigMultiplayer& _cfg) {
+	cfg = _cfg;
+	Connection::ParseAddress(cfg.server_bind_address.Get(), addr_host, addr_port);
+	shards.clear();
+	Strfnd fnd(cfg.server_cluster_shards.Get());
+	while (!fnd.at_end()) {
+		std::string address = fnd.next(",");
+		if (address.empty())
+			continue;
+		Shard& shard = shards.emplace_back();
+		Connection::ParseAddress(address, shard.host, shard.port);
+	}
+}
+
+void ClusterGateway::Start(bool wait_thread) {
+	if (running)
+		return;
+	if (shards.empty()) {
+		Output::Warning("S: Gateway: ServerClusterShards has no addresses");
+		return;
+	}
+	if (cfg.server_cluster_secret.Get().empty()) {
+		Output::Warning("S: Gateway: ServerClusterSecret is not set, the shards refuse the gateway");
+		return;
+	}
+	running = true;
+	stop_requested = false;
+
+	listener.reset(new ServerListener(addr_host, addr_port));
+	listener->OnInfo = [](std::string_view m) { Output::Info("S: Gateway: {}", m); };
+	listener->OnWarning = [](std::string_view m) { Output::Warning("S: Gateway: {}", m); };
+	listener->OnConnection = [this](std::unique_ptr<Socket> socket) {
+		HandleConnection(std::move(socket));
+	};
+	listener->OnTimer = [this](uv_loop_t* loop) {
+		HandleTimer(loop);
+	};
+	Output::Info("S: Gateway: {} shards", shards.size());
+	listener->Start(wait_thread);
+}
+
+void ClusterGateway::Stop() {
+	std::lock_guard lock(m_mutex);
+	if (!running)
+		return;
+	running = false;
+	for (const auto& it : sessions) {
+		Session& session = *it.second;
+		session.client->Send("\uFFFD0");
+		session.client->Close();
+		if (session.link)
+			session.link->Close();
+	}
+	for (const auto& link : closing_links) {
+		link.first->Close();
+	}
+	for (const auto& shard : shards) {
+		if (shard.relay)
+			shard.relay->Close();
+	}
+	listener->Stop();
+	Output::Info("S: Gateway: Stopped");
+}
+
+size_t ClusterGateway::GetShardIndex(int room_id) const {
+	return static_cast<unsigned int>(room_id) % shards.size();
+}
+
+void ClusterGateway::HandleTimer(uv_loop_t* loop) {
+	if (stop_requested.exchange(false)) {
+		Stop();
+		return;
+	}
+	std::lock_guard lock(m_mutex);
+	dead_sessions[1].clear();
+	std::swap(dead_sessions[0], dead_sessions[1]);
+	dead_links[1].clear();
+	std::swap(dead_links[0], dead_links[1]);
+	if (!running)
+		return;
+
+	for (auto& link : closing_links) {
+		if (++link.second == HANDOFF_TIMEOUT_TICKS)
+			link.first->Close();
+	}
+
+	// the relays are reconnected every tick until the shard is up
+	std::string heartbeat = HeartbeatPacket().ToBytes();
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (!shards[i].relay)
+			ConnectRelay(loop, i);
+		else if (shards[i].relay_open)
+			shards[i].relay->Send(heartbeat);
+	}
+}
+
+void ClusterGateway::HandleConnection(std::unique_ptr<Socket> socket) {
+	std::lock_guard lock(m_mutex);
+	int id = ++session_id;
+	auto& session = sessions[id];
+	session.reset(new Session());
+	session->id = id;
+	session->client = std::move(socket);
+
+	Session* s = session.get();
+	Socket* client = s->client.get();
+	client->SetReadTimeout(cfg.no_heartbeats.Get() ? 0 : 6000);
+	client->OnInfo = [](std::string_view m) { Output::Info("S: Gateway: {}", m); };
+	client->OnWarning = [](std::string_view m) { Output::Warning("S: Gateway: {}", m); };
+	client->OnOpen = []() {};
+	client->OnData = [this, s](std::string_view data) {
+		std::lock_guard lock(m_mutex);
+		HandleClientData(*s, data);
+	};
+	client->OnClose = [this, s]() {
+		std::lock_guard lock(m_mutex);
+		s->client_closed = true;
+		// the shard announces the leave
+		if (s->link)
+			s->link->Close();
+		CheckSessionClosed(*s);
+	};
+	client->Open();
+}
+
+void ClusterGateway::HandleClientData(Session& session, std::string_view data) {
+	const bool binary = IsBinaryFrame(data);
+	std::string bulk;
+	ForEachMessage(data, binary, [&](uint8_t id, std::string_view msg) {
+		// only the gateway itself talks to the shards with these
+		if (id == GATEWAY_ID)
+			return;
+		std::string rewritten;
+		bool replayed = IsReplayed(id);
+		if (id == PROTOCOL_ID) {
+			decoder.Decode(msg, binary);
+			if (!decoder.protocol)
+				return;
+			// the frames of the shards are passed as they are, they cannot be compressed
+			ProtocolPacket p(*decoder.protocol, Packet::COMPRESSION_NONE);
+			rewritten = binary ? p.ToBinary() : p.ToBytes();
+			msg = rewritten;
+		} else if (id == ROOM_ID) {
+			decoder.Decode(msg, binary);
+			if (decoder.room_id) {
+				size_t shard_index = GetShardIndex(*decoder.room_id);
+				if (!session.link || session.shard != static_cast<int>(shard_index)) {
+					// the messages before the room packet belong to the old room
+					SendToLink(session, bulk);
+					bool handoff = session.link != nullptr;
+					if (handoff)
+						CloseLink(session, true);
+					OpenLink(session, shard_index, handoff);
+					ReplayState(session);
+				}
+			}
+		} else if (id == CHAT_ID) {
+			decoder.Decode(msg, binary);
+			replayed = decoder.chat_visibility == CV_CRYPT && decoder.chat_crypt_key_hash != 0;
+		}
+		if (replayed)
+			session.state[id] = { binary, std::string(msg) };
+		// nothing is forwarded before the first room packet, the state is replayed
+		if (!session.link)
+			return;
+		if (bulk.size() + msg.size() > MAX_BULK_SIZE)
+			SendToLink(session, bulk);
+		Connection::AppendBulk(bulk, msg, binary);
+	});
+	SendToLink(session, bulk);
+}
+
+void ClusterGateway::HandleRelayData(size_t from_shard, std::string_view data) {
+	// the relays only receive the CV_GLOBAL messages and the heartbeats
+	const bool binary = IsBinaryFrame(data);
+	std::string bulk;
+	ForEachMessage(data, binary, [&bulk, binary](uint8_t id, std::string_view msg) {
+		if (id == CHAT_ID)
+			Connection::AppendBulk(bulk, msg, binary);
+	});
+	if (bulk.empty())
+		return;
+	for (size_t i = 0; i < shards.size(); ++i) {
+		if (i != from_shard && shards[i].relay_open)
+			shards[i].relay->Send(bulk);
+	}
+}
+
+void ClusterGateway::OpenLink(Session& session, size_t shard_index, bool handoff) {
+	const Shard& shard = shards[shard_index];
+	session.shard = shard_index;
+	session.link_open = false;
+	session.link_pending.clear();
+	session.link.reset(new LinkSocket());
+
+	Session* s = &session;
+	LinkSocket* link = session.link.get();
+	link->OnInfo = [](std::string_view m) { Output::Debug("S: Gateway: {}", m); };
+	link->OnWarning = [](std::string_view m) { Output::Warning("S: Gateway: {}", m); };
+	// the frames of the shard go to the client as they are, whole frames only,
+	// so a handoff cannot cut a frame in half
+	link->OnData = [s](std::string_view data) {
+		s->client->Send(data);
+	};
+	link->OnOpen = [this, s]() {
+		std::lock_guard lock(m_mutex);
+		s->link_open = true;
+		for (const auto& data : s->link_pending) {
+			s->link->Send(data);
+		}
+		s->link_pending.clear();
+	};
+	link->OnClose = [this, s]() {
+		std::lock_guard lock(m_mutex);
+		// the shard is gone or restarting, the client will reconnect
+		s->link_open = false;
+		dead_links[0].push_back(std::move(s->link));
+		if (!s->client_closed)
+			s->client->Close();
+		CheckSessionClosed(*s);
+	};
+
+	if (handoff) {
+		std::string bulk = GatewayPacket(GatewayPacket::TYPE_HANDOFF_IN,
+			cfg.server_cluster_secret.Get()).ToBytes();
+		SendToLink(session, bulk);
+	}
+	link->Connect(session.client->GetStream()->loop, shard.host, shard.port);
+}
+
+void ClusterGateway::CloseLink(Session& session, bool handoff) {
+	LinkSocket* link = session.link.get();
+	// the old shard may still send the leave of the others, it is not for this room
+	link->OnData = [](std::string_view data) {};
+	link->OnOpen = []() {};
+	link->OnClose = [this, link]() {
+		std::lock_guard lock(m_mutex);
+		auto it = std::find_if(closing_links.begin(), closing_links.end(),
+			[link](const auto& closing) { return closing.first.get() == link; });
+		if (it == closing_links.end())
+			return;
+		dead_links[0].push_back(std::move(it->first));
+		closing_links.erase(it);
+	};
+	if (handoff && session.link_open) {
+		// the shard closes the link once it has handled everything before
+		link->Send(GatewayPacket(GatewayPacket::TYPE_HANDOFF_OUT,
+			cfg.server_cluster_secret.Get()).ToBytes());
+	} else {
+		link->Close();
+	}
+	closing_links.emplace_back(std::move(session.link), 0);
+	session.shard = -1;
+	session.link_open = false;
+	session.link_pending.clear();
+}
+
+void ClusterGateway::SendToLink(Session& session, std::string& bulk) {
+	if (bulk.empty())
+		return;
+	if (session.link) {
+		if (session.link_open)
+			session.link->Send(bulk);
+		else
+			session.link_pending.push_back(bulk);
+	}
+	bulk.clear();
+}
+
+void ClusterGateway::ReplayState(Session& session) {
+	std::string bulk;
+	bool bulk_binary = false;
+	for (uint8_t id : REPLAYED_IDS) {
+		const auto& it = session.state.find(id);
+		if (it == session.state.end())
+			continue;
+		const auto& [binary, msg] = it->second;
+		// a bulk has one encoding, the first messages may still be text
+		if (!bulk.empty() && (binary != bulk_binary || bulk.size() + msg.size() > MAX_BULK_SIZE))
+			SendToLink(session, bulk);
+		bulk_binary = binary;
+		Connection::AppendBulk(bulk, msg, binary);
+	}
+	SendToLink(session, bulk);
+}
+
+void ClusterGateway::CheckSessionClosed(Session& session) {
+	if (!session.client_closed || session.link)
+		return;
+	const auto& it = sessions.find(session.id);
+	if (it == sessions.end())
+		return;
+	dead_sessions[0].push_back(std::move(it->second));
+	sessions.erase(it);
+}
+
+void ClusterGateway::ConnectRelay(uv_loop_t* loop, size_t shard_index) {
+	Shard& shard = shards[shard_index];
+	shard.relay.reset(new LinkSocket());
+	LinkSocket* relay = shard.relay.get();
+	// retried every tick while the shard is down
+	relay->OnInfo = [](std::string_view m) { Output::Debug("S: Gateway: {}", m); };
+	relay->OnWarning = [](std::string_view m) { Output::Debug("S: Gateway: {}", m); };
+	relay->OnOpen = [this, shard_index]() {
+		std::lock_guard lock(m_mutex);
+		Shard& shard = shards[shard_index];
+		shard.relay_open = true;
+		shard.relay->Send(GatewayPacket(GatewayPacket::TYPE_RELAY,
+			cfg.server_cluster_secret.Get()).ToBytes());
+		Output::Info("S: Gateway: Relay to {}:{} opened", shard.host, shard.port);
+	};
+	relay->OnData = [this, shard_index](std::string_view data) {
+		std::lock_guard lock(m_mutex);
+		HandleRelayData(shard_index, data);
+	};
+	relay->OnClose = [this, shard_index]() {
+		std::lock_guard lock(m_mutex);
+		Shard& shard = shards[shard_index];
+		if (shard.relay_open)
+			Output::Info("S: Gateway: Relay to {}:{} closed", shard.host, shard.port);
+		shard.relay_open = false;
+		dead_links[0].push_back(std::move(shard.relay));
+	};
+	relay->Connect(loop, shard.host, shard.port);
+}
+
+static ClusterGateway _instance;
+
+ClusterGateway& Gateway() {
+	return _instance;
+}
@@ -0,0 +1,117 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_GATEWAY_H
+#define EP_MULTIPLAYER_GATEWAY_H
+
+#include <atomic>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "socket.h"
+#include "../game_config.h"
+
+/**
+ * Front of a cluster of servers (ServerClusterShards)
+ *  Every room belongs to one shard: room_id % number of shards. The gateway
+ *  accepts the clients and opens one link per client to the shard of its
+ *  room. When the client enters a room of another shard, the link is
+ *  replaced and the latest state of the player (protocol, name, position,
+ *  sprite ...) is replayed to the new shard before the room packet.
+ * The frames of the shards are passed to the clients as they are, only the
+ *  frames of the clients are split into messages. The CV_GLOBAL chat is
+ *  relayed between the shards through one more link per shard.
+ * Everything runs on the loop of the listener, except Stop.
+ */
+class ClusterGateway {
+public:
+	void SetConfig(const Game_ConfigMultiplayer& _cfg);
+
+	void Start(bool wait_thread = false);
+	void Stop();
+
+	// async-signal-safe, the loop calls Stop with its next timer tick
+	void RequestStop() { stop_requested = true; }
+
+private:
+	struct Shard {
+		std::string host;
+		uint16_t port{ 6500 };
+		std::unique_ptr<LinkSocket> relay;
+		bool relay_open = false;
+	};
+
+	struct Session {
+		int id;
+		std::unique_ptr<Socket> client;
+		bool client_closed = false;
+
+		// link to the shard of the room, none before the first room packet
+		std::unique_ptr<LinkSocket> link;
+		int shard = -1;
+		bool link_open = false;
+		// sent before the link is connected
+		std::vector<std::string> link_pending;
+
+		// latest encoded message of each replayed packet, and its encoding
+		std::map<uint8_t, std::pair<bool, std::string>> state;
+	};
+
+	Game_ConfigMultiplayer cfg;
+	std::string addr_host;
+	uint16_t addr_port{ 6500 };
+
+	bool running = false;
+	std::atomic<bool> stop_requested{ false };
+	std::unique_ptr<ServerListener> listener;
+	std::vector<Shard> shards;
+
+	// guards the sessions, the loop thread and Stop
+	std::mutex m_mutex;
+	int session_id = 0;
+	std::map<int, std::unique_ptr<Session>> sessions;
+
+	/**
+	 * Closed, but libuv may still be closing their handles
+	 *  Deleted by the second timer tick after they were added.
+	 */
+	std::vector<std::unique_ptr<Session>> dead_sessions[2];
+	// links to the old shard after a handoff, and the ticks since then
+	std::vector<std::pair<std::unique_ptr<LinkSocket>, int>> closing_links;
+	std::vector<std::unique_ptr<LinkSocket>> dead_links[2];
+
+	void HandleTimer(uv_loop_t* loop);
+	void HandleConnection(std::unique_ptr<Socket> socket);
+	void HandleClientData(Session& session, std::string_view data);
+	void HandleRelayData(size_t from_shard, std::string_view data);
+
+	size_t GetShardIndex(int room_id) const;
+	void OpenLink(Session& session, size_t shard_index, bool handoff);
+	void CloseLink(Session& session, bool handoff);
+	void SendToLink(Session& session, std::string& bulk);
+	void ReplayState(Session& session);
+	void CheckSessionClosed(Session& session);
+	void ConnectRelay(uv_loop_t* loop, size_t shard_index);
+};
+
+ClusterGateway& Gateway();
+
+#endif
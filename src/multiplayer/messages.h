@@ -31,7 +31,11 @@ namespace Messages {
 		CV_NULL = 0,
 		CV_LOCAL = 1,
 		CV_GLOBAL = 2,
-		CV_CRYPT = 4
+		CV_CRYPT = 4,
+		// server only: local, limited to the clients within the interest radius
+		CV_NEARBY = 8,
+		// server only: to one client, after the earlier packets of the sender
+		CV_DIRECT = 16
 	};
 
 	static const std::map<VisibilityType, std::string> VisibilityNames = {
@@ -60,6 +64,64 @@ namespace Messages {
 		HeartbeatPacket(const ParameterList& v) : Packet(packet_name) {}
 	};
 
+	/**
+	 * Protocol
+	 *  The client sends the highest version it supports when connected,
+	 *  the server replies with the version that both sides will use.
+	 *  Servers that do not know this packet ignore it (v1).
+	 * The compression is negotiated the same way, older peers leave it out.
+	 */
+
+	class ProtocolPacket : public Packet {
+	public:
+		constexpr static std::string_view packet_name{ "pv" };
+		ProtocolPacket() : Packet(packet_name) {}
+		ProtocolPacket(int _version, int _compression = Packet::COMPRESSION_NONE)
+			: Packet(packet_name), version(_version), compression(_compression) {}
+		void Encode(Writer& w) const override { AppendPartial(w, version, compression); }
+		ProtocolPacket(const ParameterList& v)
+			: Packet(packet_name), version(Decode<int>(v.at(0))),
+			compression(v.size() > 1 ? Decode<int>(v.at(1)) : Packet::COMPRESSION_NONE) {}
+		int version{Packet::PROTOCOL_TEXT};
+		int compression{Packet::COMPRESSION_NONE};
+	};
+
+	/**
+	 * Gateway
+	 *  Sent by the cluster gateway to the shards, see ClusterGateway.
+	 *  The shards only accept it with ServerClusterShard and the
+	 *  ServerClusterSecret of the gateway, the players cannot forge it.
+	 */
+
+	class GatewayPacket : public Packet {
+	public:
+		constexpr static std::string_view packet_name{ "gw" };
+		// the connection relays the CV_GLOBAL chat between the shards
+		constexpr static int TYPE_RELAY = 0;
+		// the player comes from another shard, no "joined" announcement
+		constexpr static int TYPE_HANDOFF_IN = 1;
+		// the player moves to another shard, no "left" announcement
+		constexpr static int TYPE_HANDOFF_OUT = 2;
+		GatewayPacket() : Packet(packet_name) {}
+		GatewayPacket(int _type, std::string _secret)
+			: Packet(packet_name), type(_type), secret(std::move(_secret)) {}
+		void Encode(Writer& w) const override { AppendPartial(w, type, secret); }
+		GatewayPacket(const ParameterList& v)
+			: Packet(packet_name), type(Decode<int>(v.at(0))),
+			secret(v.size() > 1 ? std::string(v.at(1)) : "") {}
+		// an empty secret accepts nobody, compared in constant time
+		bool IsAuthorized(std::string_view expected) const {
+			if (expected.empty() || secret.size() != expected.size())
+				return false;
+			unsigned char diff = 0;
+			for (size_t i = 0; i < secret.size(); ++i)
+				diff |= secret[i] ^ expected[i];
+			return diff == 0;
+		}
+		int type;
+		std::string secret;
+	};
+
 	/**
 	 * Room
 	 */
@@ -69,7 +131,7 @@ namespace Messages {
 		constexpr static std::string_view packet_name{ "room" };
 		RoomPacket() {}
 		RoomPacket(int _room_id) : Packet(packet_name), room_id(_room_id) {}
-		std::string ToBytes() const override { return Build(room_id); }
+		void Encode(Writer& w) const override { AppendPartial(w, room_id); }
 		RoomPacket(const ParameterList& v)
 			: Packet(packet_name), room_id(Decode<int>(v.at(0))) {}
 		int room_id;
@@ -85,8 +147,8 @@ namespace Messages {
 			: Packet(std::move(_packet_name)) {}
 		PlayerPacket(std::string_view _packet_name, int _id) // S2C
 			: Packet(std::move(_packet_name)), id(_id) {}
-		void Append(std::string& s) const { AppendPartial(s, id); }
-		PlayerPacket(std::string_view _packet_name, std::string_view _id)
+		void Append(Writer& w) const { AppendPartial(w, id); }
+		PlayerPacket(std::string_view _packet_name, const Packet::Parameter& _id)
 			: Packet(std::move(_packet_name)), id(Decode<int>(_id)) {}
 		int id{0};
 	};
@@ -100,10 +162,8 @@ namespace Messages {
 		constexpr static std::string_view packet_name{ "j" };
 		JoinPacket() : PlayerPacket(packet_name) {}
 		JoinPacket(int _id) : PlayerPacket(packet_name, _id) {} // S2C
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			return r;
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
 		}
 		JoinPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)) {}
@@ -118,10 +178,8 @@ namespace Messages {
 		constexpr static std::string_view packet_name{ "l" };
 		LeavePacket() : PlayerPacket(packet_name) {}
 		LeavePacket(int _id) : PlayerPacket(packet_name, _id) {} // S2C
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			return r;
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
 		}
 		LeavePacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)) {}
@@ -139,11 +197,9 @@ namespace Messages {
 			: PlayerPacket(packet_name), name(std::move(_name)) {}
 		NamePacket(int _id, std::string _name) // S2C
 			: PlayerPacket(packet_name, _id), name(std::move(_name)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, name);
-			return r;
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, name);
 		}
 		NamePacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
@@ -164,12 +220,10 @@ namespace Messages {
 		ChatPacket(int _id, int _t, int _v, int _r, std::string _n, std::string _m) // S2C
 			: PlayerPacket(packet_name, _id), type(_t), visibility(_v),
 			room_id(_r), name(std::move(_n)), message(std::move(_m)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, type, visibility, room_id, crypt_key_hash, name, message, sys_name);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, type, visibility, room_id, crypt_key_hash, name, message, sys_name);
+		}
 		ChatPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			type(Decode<int>(v.at(1))), visibility(Decode<int>(v.at(2))),
@@ -196,12 +250,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), type(_type), x(_x), y(_y) {}
 		MovePacket(int _id, int _type, int _x, int _y) // S2C
 			: PlayerPacket(packet_name, _id), type(_type), x(_x), y(_y) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, type, x, y);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, type, x, y);
+		}
 		MovePacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			type(Decode<int>(v.at(1))), // 0: normal, 1: event location
@@ -218,7 +270,7 @@ namespace Messages {
 		constexpr static std::string_view packet_name{ "tp" };
 		TeleportPacket() : Packet(packet_name) {}
 		TeleportPacket(int _x, int _y) : Packet(packet_name), x(_x), y(_y) {}
-		std::string ToBytes() const override { return Build(x, y); }
+		void Encode(Writer& w) const override { AppendPartial(w, x, y); }
 		TeleportPacket(const ParameterList& v)
 			: Packet(packet_name), x(Decode<int>(v.at(0))), y(Decode<int>(v.at(1))) {}
 		int x, y;
@@ -236,12 +288,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), x(_x), y(_y) {}
 		JumpPacket(int _id, int _x, int _y) // S2C
 			: PlayerPacket(packet_name,  _id), x(_x), y(_y) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, x, y);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, x, y);
+		}
 		JumpPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			x(Decode<int>(v.at(1))), y(Decode<int>(v.at(2))) {}
@@ -260,12 +310,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), facing(_facing) {}
 		FacingPacket(int _id, int _facing) // S2C
 			: PlayerPacket(packet_name, _id), facing(_facing) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, facing);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, facing);
+		}
 		FacingPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)), facing(Decode<int>(v.at(1))) {}
 		int facing{0};
@@ -283,12 +331,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), speed(_speed) {}
 		SpeedPacket(int _id, int _speed) // S2C
 			: PlayerPacket(packet_name, _id), speed(_speed) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, speed);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, speed);
+		}
 		SpeedPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)), speed(Decode<int>(v.at(1))) {}
 		int speed{0};
@@ -306,12 +352,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), name(_n), index(_i) {}
 		SpritePacket(int _id, std::string _n, int _i) // S2C
 			: PlayerPacket(packet_name, _id), name(_n), index(_i) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, name, index);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, name, index);
+		}
 		SpritePacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			name(v.at(1)), index(Decode<int>(v.at(2))) {}
@@ -337,12 +381,10 @@ namespace Messages {
 			: PlayerPacket(std::move(_packet_name)), r(_r), g(_g), b(_b), p(_p), f(_f) {}
 		FlashPacket(std::string_view _packet_name, int _id, int _r, int _g, int _b, int _p, int _f) // S2C
 			: PlayerPacket(std::move(_packet_name), _id), r(_r), g(_g), b(_b), p(_p), f(_f) {}
-		std::string ToBytes() const override {
-			std::string res {GetName()};
-			PlayerPacket::Append(res);
-			AppendPartial(res, r, g, b, p, f);
-			return res;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, r, g, b, p, f);
+		}
 		FlashPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			r(Decode<int>(v.at(1))), g(Decode<int>(v.at(2))), b(Decode<int>(v.at(3))),
@@ -388,11 +430,9 @@ namespace Messages {
 		constexpr static std::string_view packet_name{ "rrfl" };
 		RemoveRepeatingFlashPacket() : PlayerPacket(packet_name) {} // C2S
 		RemoveRepeatingFlashPacket(int _id) : PlayerPacket(packet_name, _id) {} // S2C
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+		}
 		RemoveRepeatingFlashPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)) {}
 	};
@@ -409,12 +449,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), hidden_bin(_hidden_bin) {}
 		HiddenPacket(int _id, int _hidden_bin) // S2C
 			: PlayerPacket(packet_name, _id), hidden_bin(_hidden_bin) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, hidden_bin);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, hidden_bin);
+		}
 		HiddenPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)),
 			hidden_bin(Decode<int>(v.at(1))) {}
@@ -433,12 +471,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), name(std::move(_name)) {}
 		SystemPacket(int _id, std::string _name) // S2C
 			: PlayerPacket(packet_name, _id), name(std::move(_name)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, name);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, name);
+		}
 		SystemPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)), name(v.at(1)) {}
 		std::string name{""};
@@ -456,12 +492,10 @@ namespace Messages {
 			: PlayerPacket(packet_name), snd(std::move(_d)) {}
 		SEPacket(int _id, lcf::rpg::Sound _d) // S2C
 			: PlayerPacket(packet_name, _id), snd(std::move(_d)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, snd.name, snd.volume, snd.tempo, snd.balance);
-			return r;
-		};
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, snd.name, snd.volume, snd.tempo, snd.balance);
+		}
 		static lcf::rpg::Sound BuildSound(const ParameterList& v) {
 			lcf::rpg::Sound s;
 			s.name = v.at(1);
@@ -489,9 +523,9 @@ namespace Messages {
 				int _mx, int _my, int _panx, int _pany)
 			: PlayerPacket(std::move(_packet_name), _id), pic_id(_pic_id), params(_p),
 			map_x(_mx), map_y(_my), pan_x(_panx), pan_y(_pany) {}
-		void Append(std::string& s) const {
-			PlayerPacket::Append(s);
-			AppendPartial(s, pic_id, params.position_x, params.position_y,
+		void Append(Writer& w) const {
+			PlayerPacket::Append(w);
+			AppendPartial(w, pic_id, params.position_x, params.position_y,
 					map_x, map_y, pan_x, pan_y,
 					params.magnify, params.top_trans, params.bottom_trans,
 					params.red, params.green, params.blue, params.saturation,
@@ -543,11 +577,9 @@ namespace Messages {
 		ShowPicturePacket(int _id, int _pid, Game_Pictures::ShowParams _p, // S2C
 				int _mx, int _my, int _px, int _py)
 			: PicturePacket(packet_name, _id, _pid, params, _mx, _my, _px, _py), params(std::move(_p)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PicturePacket::Append(r);
-			AppendPartial(r, params.name, params.use_transparent_color, params.fixed_to_map);
-			return r;
+		void Encode(Writer& w) const override {
+			PicturePacket::Append(w);
+			AppendPartial(w, params.name, params.use_transparent_color, params.fixed_to_map);
 		}
 		Game_Pictures::ShowParams BuildParams(const ParameterList& v) const {
 			Game_Pictures::ShowParams p;
@@ -576,11 +608,9 @@ namespace Messages {
 		MovePicturePacket(int _id, int _pid, Game_Pictures::MoveParams _p, // S2C
 				int _mx, int _my, int _px, int _py)
 			: PicturePacket(packet_name, _id, _pid, params, _mx, _my, _px, _py), params(std::move(_p)) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PicturePacket::Append(r);
-			AppendPartial(r, params.duration);
-			return r;
+		void Encode(Writer& w) const override {
+			PicturePacket::Append(w);
+			AppendPartial(w, params.duration);
 		}
 		Game_Pictures::MoveParams BuildParams(const ParameterList& v) const {
 			Game_Pictures::MoveParams p;
@@ -603,11 +633,9 @@ namespace Messages {
 		ErasePicturePacket() : PlayerPacket(packet_name) {}
 		ErasePicturePacket(int _pid) : PlayerPacket(packet_name), pic_id(_pid) {} // C2S
 		ErasePicturePacket(int _id, int _pid) : PlayerPacket(packet_name, _id), pic_id(_pid) {} // S2C
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, pic_id);
-			return r;
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, pic_id);
 		}
 		ErasePicturePacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)), pic_id(Decode<int>(v.at(1))) {}
@@ -626,11 +654,9 @@ namespace Messages {
 			: PlayerPacket(packet_name), anim_id(_anim_id) {}
 		ShowPlayerBattleAnimPacket(int _id, int _anim_id) // S2C
 			: PlayerPacket(packet_name, _id), anim_id(_anim_id) {}
-		std::string ToBytes() const override {
-			std::string r {GetName()};
-			PlayerPacket::Append(r);
-			AppendPartial(r, anim_id);
-			return r;
+		void Encode(Writer& w) const override {
+			PlayerPacket::Append(w);
+			AppendPartial(w, anim_id);
 		}
 		ShowPlayerBattleAnimPacket(const ParameterList& v)
 			: PlayerPacket(packet_name, v.at(0)), anim_id(Decode<int>(v.at(1))) {}
@@ -647,7 +673,7 @@ namespace Messages {
 		ConfigPacket() {}
 		ConfigPacket(int _type, std::string _config)
 			: Packet(packet_name), type(_type), config(std::move(_config)) {} // S2C
-		std::string ToBytes() const override { return Build(type, config); }
+		void Encode(Writer& w) const override { AppendPartial(w, type, config); }
 		ConfigPacket(const ParameterList& v)
 			: Packet(packet_name), type(Decode<int>(v.at(0))), config(v.at(1)) {}
 		int type;
@@ -664,7 +690,7 @@ namespace Messages {
 		BattleAnimIdListSyncPacket() : Packet(packet_name) {}
 		BattleAnimIdListSyncPacket(const ParameterList& v) : Packet(packet_name) {
 			std::transform(v.begin(), v.end(), std::back_inserter(ids),
-				[&](std::string_view s) {
+				[&](const Packet::Parameter& s) {
 					return Decode<int>(s);
 				});
 		}
@@ -683,7 +709,7 @@ namespace Messages {
 		SyncSwitchPacket() : Packet(packet_name) {}
 		SyncSwitchPacket(int _switch_id, int _sync_type)
 			: Packet(packet_name), switch_id(_switch_id), sync_type(_sync_type) {}
-		std::string ToBytes() const override { return Build(switch_id, sync_type); }
+		void Encode(Writer& w) const override { AppendPartial(w, switch_id, sync_type); }
 		SyncSwitchPacket(const ParameterList& v)
 			: Packet(packet_name), switch_id(Decode<int>(v.at(0))), sync_type(Decode<int>(v.at(1))) {}
 		int switch_id;
@@ -700,7 +726,7 @@ namespace Messages {
 		SyncVariablePacket() : Packet(packet_name) {}
 		SyncVariablePacket(int _var_id, int _value) : Packet(packet_name),
 			var_id(_var_id), sync_type(_value) {}
-		std::string ToBytes() const override { return Build(var_id, sync_type); }
+		void Encode(Writer& w) const override { AppendPartial(w, var_id, sync_type); }
 		SyncVariablePacket(const ParameterList& v)
 			: Packet(packet_name), var_id(Decode<int>(v.at(0))), sync_type(Decode<int>(v.at(1))) {}
 		int var_id;
@@ -717,7 +743,7 @@ namespace Messages {
 		SyncEventPacket() : Packet(packet_name) {}
 		SyncEventPacket(int _event_id, int _trigger_type) : Packet(packet_name),
 			event_id(_event_id), trigger_type(_trigger_type) {}
-		std::string ToBytes() const override { return Build(event_id, trigger_type); }
+		void Encode(Writer& w) const override { AppendPartial(w, event_id, trigger_type); }
 		SyncEventPacket(const ParameterList& v)
 			: Packet(packet_name),
 			event_id(Decode<int>(v.at(0))), trigger_type(Decode<int>(v.at(1))) {}
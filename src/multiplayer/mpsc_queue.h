@@ -0,0 +1,98 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_MPSC_QUEUE_H
+#define EP_MULTIPLAYER_MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * Lock-free multi-producer single-consumer queue
+ *  Push can be called from any thread, Pop only from the consumer thread.
+ *
+ * Intrusive linked list with a stub node (Dmitry Vyukov):
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/non-intrusive-mpsc-node-based-queue
+ *
+ * A push that is still in progress is not visible yet, so Pop can return
+ *  false for a short moment although Size is not 0.
+ */
+template<typename T>
+class MpscQueue {
+	struct Node {
+		std::atomic<Node*> next{ nullptr };
+		T value;
+
+		Node() = default;
+		Node(T&& _value) : value(std::move(_value)) {}
+	};
+
+	// producers exchange the head, the consumer owns the tail
+	std::atomic<Node*> head;
+	Node* tail;
+	std::atomic<size_t> size{ 0 };
+
+public:
+	MpscQueue() {
+		Node* stub = new Node();
+		head = stub;
+		tail = stub;
+	}
+
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+
+	~MpscQueue() {
+		T value;
+		while (Pop(value)) {}
+		delete tail;
+	}
+
+	void Push(T value) {
+		Node* node = new Node(std::move(value));
+		size.fetch_add(1, std::memory_order_relaxed);
+		Node* prev = head.exchange(node, std::memory_order_acq_rel);
+		// seq_cst: the consumer may check a sleeping flag right after this
+		prev->next.store(node);
+	}
+
+	bool Pop(T& value) {
+		// seq_cst: pairs with the store in Push for the sleeping flag checks
+		Node* next = tail->next.load();
+		if (!next)
+			return false;
+		value = std::move(next->value);
+		delete tail;
+		// next becomes the new stub
+		tail = next;
+		size.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// approximate when called concurrently
+	size_t Size() const {
+		return size.load(std::memory_order_relaxed);
+	}
+
+	bool Empty() const {
+		return Size() == 0;
+	}
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include "../drawable_mgr.h"
 #include "../filefinder.h"
 #include "../bitmap.h"
+#include "../damage_tracker.h"
 #include "../sprite_character.h"
 #include "game_playerother.h"
 #include "playerother.h"
@@ -36,6 +37,32 @@ NameTag::NameTag(int id, PlayerOther& player, std::string nickname)
 }
 
 void NameTag::Draw(Bitmap& dst) {
+	if (!prepared) {
+		Prepare();
+	}
+	prepared = false;
+
+	if (shown) {
+		dst.Blit(draw_x, draw_y, *effects_img, effects_img->GetRect(), Opacity(draw_opacity));
+	}
+}
+
+bool NameTag::GetDamage(Rect& rect, DamageHash& hash) {
+	// The animations advance once per frame, Draw uses this state
+	Prepare();
+	prepared = true;
+
+	if (shown) {
+		rect = Rect(draw_x, draw_y, effects_img->GetWidth(), effects_img->GetHeight());
+		hash.Add(effects_img).Add(draw_opacity);
+	}
+
+	return true;
+}
+
+void NameTag::Prepare() {
+	shown = false;
+
 	auto nametag_mode = GMI().GetNametagMode();
 
 	if (nametag_mode == Game_Multiplayer::NametagMode::NONE || nickname.empty() || !player.sprite.get()) {
@@ -91,8 +118,8 @@ void NameTag::Draw(Bitmap& dst) {
 	}
 
 	if (!player.ch->IsSpriteHidden()) {
-		int x = player.ch->GetScreenX() - nick_img->GetWidth() / 2;
-		int y = (player.ch->GetScreenY() - player.sprite->GetHeight()) + GetSpriteYOffset();
+		draw_x = player.ch->GetScreenX() - nick_img->GetWidth() / 2;
+		draw_y = (player.ch->GetScreenY() - player.sprite->GetHeight()) + GetSpriteYOffset();
 
 		if (transparent && base_opacity > 16) {
 			SetBaseOpacity(base_opacity - 1);
@@ -100,7 +127,8 @@ void NameTag::Draw(Bitmap& dst) {
 			SetBaseOpacity(base_opacity + 1);
 		}
 
-		dst.Blit(x, y, *effects_img, effects_img->GetRect(), Opacity(GetOpacity()));
+		draw_opacity = GetOpacity();
+		shown = true;
 	}
 }
 
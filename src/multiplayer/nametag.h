@@ -31,6 +31,8 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 	void SetSystemGraphic(StringView sys_name);
 
 	void SetEffectsDirty();
@@ -53,6 +55,15 @@ private:
 	int flash_frames_left;
 	int last_valid_sprite_y_offset;
 
+	// result of Prepare
+	bool prepared = false;
+	bool shown = false;
+	int draw_x = 0;
+	int draw_y = 0;
+	int draw_opacity = 0;
+
+	/** Updates the images, the position and the animations for the next Draw */
+	void Prepare();
 	void SetBaseOpacity(int val);
 	int GetOpacity();
 	int GetSpriteYOffset();
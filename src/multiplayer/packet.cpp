@@ -27,7 +27,80 @@ using namespace Multiplayer;
  */
 
 std::string Packet::ToBytes() const {
-	return Build();
+	TextWriter w(packet_name);
+	Encode(w);
+	return std::move(w.data);
+}
+
+std::string Packet::ToBinary() const {
+	BinaryWriter w(packet_name);
+	Encode(w);
+	return w.Finish();
+}
+
+void Packet::TextWriter::Write(int x) {
+	data += PARAM_DELIM;
+	data += ToString(x);
+}
+
+void Packet::TextWriter::Write(bool x) {
+	data += PARAM_DELIM;
+	data += ToString(x);
+}
+
+void Packet::TextWriter::Write(std::string_view x) {
+	data += PARAM_DELIM;
+	data += ToString(x);
+}
+
+Packet::BinaryWriter::BinaryWriter(std::string_view packet_name) {
+	uint8_t id = GetPacketId(packet_name);
+	data += static_cast<char>(id);
+	if (id == 0)
+		Write(packet_name);
+}
+
+void Packet::BinaryWriter::Write(int x) {
+	// zigzag: small negative numbers stay small
+	uint32_t zigzag = (static_cast<uint32_t>(x) << 1) ^ static_cast<uint32_t>(x >> 31);
+	// the lowest bit tells it is not a string
+	WriteVarint(data, static_cast<uint64_t>(zigzag) << 1);
+}
+
+void Packet::BinaryWriter::Write(bool x) {
+	Write(x ? 1 : 0);
+}
+
+void Packet::BinaryWriter::Write(std::string_view x) {
+	WriteVarint(data, (static_cast<uint64_t>(x.size()) << 1) | 1);
+	data += x;
+}
+
+std::string Packet::BinaryWriter::Finish() const {
+	std::string r;
+	r.reserve(data.size() + 2);
+	WriteVarint(r, data.size());
+	r += data;
+	return r;
+}
+
+void Packet::WriteVarint(std::string& s, uint64_t x) {
+	while (x >= 0x80) {
+		s += static_cast<char>((x & 0x7F) | 0x80);
+		x >>= 7;
+	}
+	s += static_cast<char>(x);
+}
+
+bool Packet::ReadVarint(std::string_view s, size_t& pos, uint64_t& x) {
+	x = 0;
+	for (int shift = 0; shift < 64 && pos < s.size(); shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(s[pos++]);
+		x |= static_cast<uint64_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;
 }
 
 // this function will perform a parse of data with DELIMs
@@ -114,6 +187,11 @@ int Packet::Decode(std::string_view s) {
 	return r;
 }
 
+/**
+ * Protocol 1 (text) has always read "0" as true, the clients that only
+ *  speak it see the same flags from every sender. The binary protocol
+ *  reads 0 as false, see Decode(const Parameter&).
+ */
 template<>
 bool Packet::Decode(std::string_view s) {
 	if (s == "1")
@@ -122,3 +200,17 @@ bool Packet::Decode(std::string_view s) {
 		return true;
 	throw std::runtime_error("Multiplayer::Packet::Decode<bool> failed");
 }
+
+template<>
+int Packet::Decode(const Parameter& p) {
+	if (p.IsNumber())
+		return p.GetNumber();
+	return Decode<int>(std::string_view(p));
+}
+
+template<>
+bool Packet::Decode(const Parameter& p) {
+	if (p.IsNumber())
+		return p.GetNumber() != 0;
+	return Decode<bool>(std::string_view(p));
+}
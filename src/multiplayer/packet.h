@@ -20,25 +20,198 @@
 #define EP_MULTIPLAYER_PACKET_H
 
 #include <string>
+#include <string_view>
+#include <array>
+#include <cstdint>
 #include <charconv>
 #include <stdexcept>
 
 namespace Multiplayer {
 
+/**
+ * Binary packet ids, built at compile time
+ *  The id of a name is its index + 1. Append only, the ids are on the wire.
+ *  Names are looked up through a perfect hash table, the seed is searched
+ *  by the compiler so that no two names share a slot.
+ */
+namespace PacketIds {
+	constexpr std::string_view names[] = {
+		"hb", "room", "j", "l", "name", "say", "m", "tp", "jmp", "f", "spd",
+		"spr", "fl", "rfl", "rrfl", "h", "sys", "se", "ap", "mp", "rp", "ba",
+		"cfg", "bas", "ss", "sv", "sev", "sp", "pv", "gw",
+	};
+	constexpr size_t names_size = sizeof(names) / sizeof(std::string_view);
+	static_assert(names_size < 256);
+
+	constexpr size_t TABLE_SIZE = 256;
+
+	// FNV-1a
+	constexpr uint32_t Hash(std::string_view name, uint32_t seed) {
+		uint32_t h = 2166136261u ^ seed;
+		for (char c : name) {
+			h ^= static_cast<uint8_t>(c);
+			h *= 16777619u;
+		}
+		return h % TABLE_SIZE;
+	}
+
+	constexpr bool IsPerfect(uint32_t seed) {
+		std::array<bool, TABLE_SIZE> used{};
+		for (size_t i = 0; i < names_size; ++i) {
+			uint32_t slot = Hash(names[i], seed);
+			if (used[slot])
+				return false;
+			used[slot] = true;
+		}
+		return true;
+	}
+
+	constexpr uint32_t FindSeed() {
+		for (uint32_t seed = 0; seed < 100000; ++seed) {
+			if (IsPerfect(seed))
+				return seed;
+		}
+		return UINT32_MAX;
+	}
+
+	constexpr uint32_t seed = FindSeed();
+	static_assert(seed != UINT32_MAX, "no perfect hash seed for the packet names");
+
+	constexpr std::array<uint8_t, TABLE_SIZE> BuildTable() {
+		std::array<uint8_t, TABLE_SIZE> table{};
+		for (size_t i = 0; i < names_size; ++i)
+			table[Hash(names[i], seed)] = static_cast<uint8_t>(i + 1);
+		return table;
+	}
+
+	constexpr std::array<uint8_t, TABLE_SIZE> table = BuildTable();
+
+	constexpr uint8_t Get(std::string_view name) {
+		uint8_t id = table[Hash(name, seed)];
+		return id != 0 && names[id - 1] == name ? id : 0;
+	}
+}
+
 class Packet {
 public:
 	constexpr static std::string_view PARAM_DELIM = "\uFFFF";
 	constexpr static std::string_view MSG_DELIM = "\uFFFE";
+	// first byte of a binary (v2) frame, text frames never start with it
+	constexpr static std::string_view BINARY_MARK{ "\0", 1 };
+
+	/**
+	 * Protocol versions
+	 *  1: text, parameters joined by PARAM_DELIM, messages joined by MSG_DELIM
+	 *  2: binary, see BinaryWriter
+	 */
+	constexpr static int PROTOCOL_TEXT = 1;
+	constexpr static int PROTOCOL_BINARY = 2;
+
+	// unknown versions are spoken as text
+	constexpr static int GetSupportedProtocol(int version) {
+		return version == PROTOCOL_BINARY ? PROTOCOL_BINARY : PROTOCOL_TEXT;
+	}
+
+	/**
+	 * Stream compression, negotiated along with the protocol version
+	 *  0: none, 1: deflate, see FrameCompression
+	 */
+	constexpr static int COMPRESSION_NONE = 0;
+	constexpr static int COMPRESSION_DEFLATE = 1;
+
+	/**
+	 * A received parameter
+	 *  Text parameters keep the string, binary integers are already decoded.
+	 */
+	class Parameter {
+	public:
+		Parameter(std::string_view _str) : str(_str) {}
+		Parameter(int _num) : num(_num), is_num(true) {}
+
+		operator std::string_view() const { return str; }
+
+		bool IsNumber() const { return is_num; }
+		int GetNumber() const { return num; }
+
+	private:
+		std::string_view str;
+		int num{0};
+		bool is_num{false};
+	};
+
+	/**
+	 * Parameter encoder
+	 */
+	class Writer {
+	public:
+		virtual ~Writer() = default;
+
+		virtual void Write(int x) = 0;
+		virtual void Write(bool x) = 0;
+		virtual void Write(std::string_view x) = 0;
+		void Write(const char* x) { Write(std::string_view(x)); }
+
+		std::string data;
+	};
+
+	class TextWriter : public Writer {
+	public:
+		TextWriter(std::string_view packet_name) { data = packet_name; }
+
+		void Write(int x) override;
+		void Write(bool x) override;
+		void Write(std::string_view x) override;
+		using Writer::Write;
+	};
+
+	/**
+	 * Message: varint size of the rest, 1-byte packet id, parameters
+	 *  (packet id 0: the packet name follows as the first parameter)
+	 * Parameter: varint of zigzag(int) << 1, or (string size << 1) | 1
+	 *  followed by the bytes of the string
+	 */
+	class BinaryWriter : public Writer {
+	public:
+		BinaryWriter(std::string_view packet_name);
+
+		void Write(int x) override;
+		void Write(bool x) override;
+		void Write(std::string_view x) override;
+		using Writer::Write;
+
+		// prepends the message size
+		std::string Finish() const;
+	};
+
+	static void WriteVarint(std::string& s, uint64_t x);
+	static bool ReadVarint(std::string_view s, size_t& pos, uint64_t& x);
 
 	Packet() {}
 	Packet(std::string_view _packet_name) : packet_name(_packet_name) {}
 
 	virtual ~Packet() = default;
-	virtual std::string ToBytes() const;
+
+	std::string ToBytes() const;
+	std::string ToBinary() const;
 
 	std::string_view GetName() const { return packet_name; }
 
+	/**
+	 * Binary packet ids, see PacketIds
+	 *  @return 0 if the packet has no id
+	 */
+	constexpr static uint8_t GetPacketId(std::string_view name) {
+		return PacketIds::Get(name);
+	}
+	constexpr static std::string_view GetPacketName(uint8_t id) {
+		if (id == 0 || id > PacketIds::names_size)
+			return "";
+		return PacketIds::names[id - 1];
+	}
+
 protected:
+	virtual void Encode(Writer& w) const {}
+
 	static std::string Sanitize(std::string_view param);
 
 	static std::string ToString(const char* x) { return ToString(std::string_view(x)); }
@@ -46,31 +219,20 @@ protected:
 	static std::string ToString(bool x) { return x ? "1" : "0"; }
 	static std::string ToString(std::string_view v) { return Sanitize(v); }
 
-	template<typename... Args>
-	std::string Build(Args... args) const {
-		std::string r {packet_name};
-		AppendPartial(r, args...);
-		return r;
-	}
-
-	static void AppendPartial(std::string& s) {}
-
-	template<typename T>
-	static void AppendPartial(std::string& s, T t) {
-		s += PARAM_DELIM;
-		s += ToString(t);
-	}
+	static void AppendPartial(Writer& w) {}
 
 	template<typename T, typename... Args>
-	static void AppendPartial(std::string& s, T t, Args... args) {
-		s += PARAM_DELIM;
-		s += ToString(t);
-		AppendPartial(s, args...);
+	static void AppendPartial(Writer& w, T t, Args... args) {
+		w.Write(t);
+		AppendPartial(w, args...);
 	}
 
 	template<typename T>
 	static T Decode(std::string_view s);
 
+	template<typename T>
+	static T Decode(const Parameter& p);
+
 private:
 	std::string packet_name{ "" };
 };
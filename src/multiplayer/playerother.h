@@ -22,6 +22,8 @@
 #include <deque>
 #include <memory>
 #include <map>
+#include <optional>
+#include <utility>
 
 struct Game_PlayerOther;
 struct Sprite_Character;
@@ -38,6 +40,9 @@ struct PlayerOther {
 	// type => pos
 	std::map<int8_t, std::tuple<int8_t, int16_t, int16_t>> previous_pos;
 
+	// x, y of ch in Game_Multiplayer::players_tiles
+	std::optional<std::pair<int, int>> tile;
+
 	// create a shadow of this
 	// shadow has no name, no battle animation and no move commands
 	// but it is visible, in other words this function modifies the
@@ -19,17 +19,27 @@
 #include "server.h"
 #include "socket.h"
 #include <thread>
+#include <atomic>
+#include <array>
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <optional>
+#include <fstream>
+#include <cstdio>
 #include "../utils.h"
 #include "../output.h"
 #include "strfnd.h"
 
 #ifdef SERVER
 #  include <csignal>
+#  include <cstdlib>
 #  include <getopt.h>
 #  include <fstream>
 #  include <ostream>
 #  include <istream>
 #  include <lcf/inireader.h>
+#  include "gateway.h"
 #endif
 
 using namespace Multiplayer;
@@ -40,22 +50,42 @@ constexpr size_t MAX_BULK_SIZE = Connection::MAX_QUEUE_SIZE -
 
 class ServerConnection : public Connection {
 	std::unique_ptr<Socket> socket;
+	ServerMetrics* metrics;
+	TrafficCapture* capture;
+	// 0 if the connection is not captured
+	uint32_t capture_connection = 0;
 
 	void HandleData(std::string_view data) {
+		metrics->frames_in.fetch_add(1, std::memory_order_relaxed);
+		metrics->bytes_in.fetch_add(data.size(), std::memory_order_relaxed);
+		capture->RecordData(capture_connection, data);
 		Dispatch(data);
 		DispatchSystem(SystemMessage::EOD);
 	}
 
 	void HandleOpen() {
+		capture_connection = capture->RecordOpen();
 		DispatchSystem(SystemMessage::OPEN);
 	}
 
 	void HandleClose() {
+		capture->RecordClose(capture_connection);
 		DispatchSystem(SystemMessage::CLOSE);
 	}
 
+	void OnDispatch(uint8_t id, size_t size) override {
+		metrics->packets_in.Record(id, size);
+	}
+
+	void CountOut(size_t frame_size) {
+		metrics->frames_out.fetch_add(1, std::memory_order_relaxed);
+		metrics->bytes_out.fetch_add(frame_size, std::memory_order_relaxed);
+	}
+
 public:
-	ServerConnection(std::unique_ptr<Socket>& _socket) {
+	ServerConnection(std::unique_ptr<Socket>& _socket, ServerMetrics* _metrics,
+			TrafficCapture* _capture)
+			: metrics(_metrics), capture(_capture) {
 		socket = std::move(_socket);
 	}
 
@@ -69,6 +99,9 @@ public:
 		socket->OnData = [this](auto p1) { HandleData(p1); };
 		socket->OnOpen = [this]() { HandleOpen(); };
 		socket->OnClose = [this]() { HandleClose(); };
+		socket->OnDrop = [this]() {
+			metrics->send_queue_drops.fetch_add(1, std::memory_order_relaxed);
+		};
 		socket->Open();
 	}
 
@@ -77,10 +110,67 @@ public:
 	}
 
 	void Send(std::string_view data) override {
+		CountOut(Socket::HEAD_SIZE + data.size());
 		socket->Send(data); // send back to oneself
 	}
+
+	void SendFrame(const Socket::Frame& frame) {
+		CountOut(frame->size());
+		socket->Send(frame);
+	}
+
+	// refused while the client is behind, see Socket::LOW_WATERMARK
+	bool SendStateFrame(const Socket::Frame& frame) {
+		if (!socket->Send(frame, Socket::Priority::COALESCIBLE))
+			return false;
+		CountOut(frame->size());
+		return true;
+	}
+
+	void SetDrainHandler(std::function<void()> handler) {
+		socket->OnDrain = std::move(handler);
+	}
+
+	void SetCompression(bool enabled) {
+		socket->SetCompression(enabled);
+	}
 };
 
+static void CountPacketOut(ServerMetrics& metrics, const Packet& p, const std::string& data) {
+	metrics.packets_out.Record(Packet::GetPacketId(p.GetName()), data.size());
+}
+
+/**
+ * Joins the queued packets into text and binary bulks
+ *  A bulk is passed to send before it would exceed MAX_BULK_SIZE.
+ */
+static void FlushBulks(std::queue<std::unique_ptr<Packet>>& queue, bool text, bool binary,
+		ServerMetrics& metrics,
+		const std::function<void(const std::string&, const std::string&)>& send) {
+	std::string bulk;
+	std::string bulk_bin;
+	while (!queue.empty()) {
+		const auto& e = queue.front();
+		std::string data = text ? e->ToBytes() : "";
+		std::string data_bin = binary ? e->ToBinary() : "";
+		CountPacketOut(metrics, *e, text ? data : data_bin);
+		if (bulk.size() + data.size() > MAX_BULK_SIZE ||
+				bulk_bin.size() + data_bin.size() > MAX_BULK_SIZE) {
+			send(bulk, bulk_bin);
+			bulk.clear();
+			bulk_bin.clear();
+		}
+		if (text)
+			Connection::AppendBulk(bulk, data, false);
+		if (binary)
+			Connection::AppendBulk(bulk_bin, data_bin, true);
+		queue.pop();
+	}
+	if (!bulk.empty() || !bulk_bin.empty()) {
+		send(bulk, bulk_bin);
+	}
+}
+
 /**
  * Clients
  */
@@ -99,38 +189,207 @@ class ServerSideClient {
 
 	ServerMain* server;
 
+	// other clients may read the last state and the name from their threads
+	std::mutex m_last_mutex;
+
+	// negotiated protocol, read by the sending threads
+	std::atomic<bool> binary{false};
+
 	bool join_sent = false;
 	int id{0};
 	ServerConnection connection;
 
+	/**
+	 * Cluster mode, see GatewayPacket
+	 *  The relay is the connection of the gateway that carries the CV_GLOBAL
+	 *  chat of the other shards, it is not a player.
+	 */
+	bool relay = false;
+	bool handoff_in = false;
+	bool handoff_out = false;
+
 	int room_id{0};
 	int chat_crypt_key_hash{0};
 	std::string name{""};
 	LastState last;
 
+	/**
+	 * Tick batching (ServerTickRate > 0), guarded by m_last_mutex
+	 *  The state waits here for the next tick. Superseded facings, speeds,
+	 *  sprites and hidden flags are dropped. Moves are the steps of a path
+	 *  that the others replay, so all of them are kept.
+	 */
+	struct PendingState {
+		std::vector<MovePacket> moves;
+		std::optional<FacingPacket> facing;
+		std::optional<SpeedPacket> speed;
+		std::optional<SpritePacket> sprite;
+		std::optional<HiddenPacket> hidden;
+	};
+	PendingState pending;
+
+	/**
+	 * Held from taking the pending state until it is queued to the shards
+	 *  Otherwise a jump or a room change of the loop thread could be
+	 *  queued in between and overtake the moves taken by the tick.
+	 */
+	std::mutex m_send_order_mutex;
+
+	bool IsTickBatching() const {
+		return server->GetTickRate() > 0;
+	}
+
+	// position for the interest management, read by the sending threads
+	std::atomic<int> x{0};
+	std::atomic<int> y{0};
+
+	/**
+	 * Join snapshot, guarded by m_last_mutex
+	 *  The rarely changing part of the last state (name, sprite, flash,
+	 *  hidden, system and pictures) is encoded once per protocol and reused
+	 *  by every client that joins the room, until it changes. The movement
+	 *  changes with every step and is encoded per join.
+	 * The chunks are messages joined without a bulk prefix, each one fits
+	 *  into a bulk.
+	 */
+	struct Snapshot {
+		std::vector<std::string> chunks;
+		bool valid{false};
+	};
+	std::array<Snapshot, 2> snapshots; // text, binary
+
+	void InvalidateSnapshot() {
+		for (auto& snapshot : snapshots)
+			snapshot.valid = false;
+	}
+
+	// m_last_mutex must be held
+	const std::vector<std::string>& GetSnapshot(bool binary) {
+		Snapshot& snapshot = snapshots[binary];
+		if (snapshot.valid)
+			return snapshot.chunks;
+		snapshot.chunks.clear();
+		std::string chunk;
+		auto append = [&](const Packet& p) {
+			std::string data = binary ? p.ToBinary() : p.ToBytes();
+			size_t delim_size = binary || chunk.empty() ? 0 : Packet::MSG_DELIM.size();
+			if (!chunk.empty() && chunk.size() + delim_size + data.size() > MAX_BULK_SIZE) {
+				snapshot.chunks.push_back(std::move(chunk));
+				chunk.clear();
+				delim_size = 0;
+			}
+			if (delim_size > 0)
+				chunk += Packet::MSG_DELIM;
+			chunk += data;
+		};
+		if (name != "")
+			append(NamePacket(id, name));
+		if (last.sprite.index != -1)
+			append(last.sprite);
+		if (last.repeating_flash.IsAvailable())
+			append(last.repeating_flash);
+		if (last.hidden.hidden_bin == 1)
+			append(last.hidden);
+		if (last.system.name != "")
+			append(last.system);
+		for (const auto& it : last.pictures) {
+			append(it.second);
+		}
+		if (!chunk.empty())
+			snapshot.chunks.push_back(std::move(chunk));
+		snapshot.valid = true;
+		return snapshot.chunks;
+	}
+
 	void SendSelfRoomInfoAsync() {
-		server->ForEachClient([this](const ServerSideClient& other) {
-			if (other.id == id || other.room_id != room_id)
+		// keep the order, the room packet is still in the queue
+		FlushQueue(m_self_queue, CV_NULL, true);
+		const bool binary = connection.IsBinary();
+		std::string bulk;
+		auto append = [this, &bulk, binary](std::string_view data) {
+			if (bulk.size() + data.size() > MAX_BULK_SIZE) {
+				connection.Send(bulk);
+				bulk.clear();
+			}
+			Connection::AppendBulk(bulk, data, binary);
+		};
+		auto encode = [binary](const Packet& p) {
+			return binary ? p.ToBinary() : p.ToBytes();
+		};
+		server->ForEachClientInRoom(room_id, [this, &append, &encode, binary](ServerSideClient& other) {
+			if (other.id == id)
 				return;
-			SendSelfAsync(JoinPacket(other.id));
-			SendSelfAsync(other.last.move);
+			std::lock_guard lock(other.m_last_mutex);
+			append(encode(JoinPacket(other.id)));
+			append(encode(other.last.move));
 			if (other.last.facing.facing != 0)
-				SendSelfAsync(other.last.facing);
+				append(encode(other.last.facing));
 			if (other.last.speed.speed != 0)
-				SendSelfAsync(other.last.speed);
-			if (other.name != "")
-				SendSelfAsync(NamePacket(other.id, other.name));
-			if (other.last.sprite.index != -1)
-				SendSelfAsync(other.last.sprite);
-			if (other.last.repeating_flash.IsAvailable())
-				SendSelfAsync(other.last.repeating_flash);
-			if (other.last.hidden.hidden_bin == 1)
-				SendSelfAsync(other.last.hidden);
-			if (other.last.system.name != "")
-				SendSelfAsync(other.last.system);
-			for (const auto& it : other.last.pictures) {
-				SendSelfAsync(it.second);
+				append(encode(other.last.speed));
+			for (const auto& chunk : other.GetSnapshot(binary))
+				append(chunk);
+		});
+		if (!bulk.empty())
+			connection.Send(bulk);
+	}
+
+	/**
+	 * Interest management
+	 *  Movement is only relayed within the interest radius. When a move
+	 *  crosses the radius of another client, both sides get a snapshot
+	 *  of the state that was filtered out in the meantime. A snapshot
+	 *  goes through the shard of the client it shows, after the packets
+	 *  that client has queued before.
+	 *  move_queued: the move itself is relayed to the new neighbours,
+	 *  a teleport is not.
+	 */
+	void UpdatePosition(int to_x, int to_y, bool move_queued) {
+		int from_x = x;
+		int from_y = y;
+		server->UpdateClientPosition(this, to_x, to_y);
+		if (server->GetInterestRadius() == 0)
+			return;
+		std::lock_guard send_lock(m_send_order_mutex);
+		bool flushed = false;
+		auto flush = [this, &flushed]() {
+			if (flushed)
+				return;
+			flushed = true;
+			FlushQueue();
+			if (IsTickBatching())
+				SendPendingState();
+		};
+		// entered
+		server->ForEachClientNear(room_id, to_x, to_y, [&](ServerSideClient& other) {
+			if (other.id == id || server->IsInInterestRadius(from_x, from_y, other.x, other.y))
+				return;
+			flush();
+			std::queue<std::unique_ptr<Packet>> queue;
+			{
+				std::lock_guard lock(other.m_last_mutex);
+				SendPacketAsync(queue, other.last.move);
+				if (other.last.facing.facing != 0)
+					SendPacketAsync(queue, other.last.facing);
+				if (other.last.speed.speed != 0)
+					SendPacketAsync(queue, other.last.speed);
 			}
+			SendDirect(queue, other.id, *this);
+			if (!move_queued)
+				SendPacketAsync(queue, last.move);
+			if (last.facing.facing != 0)
+				SendPacketAsync(queue, last.facing);
+			if (last.speed.speed != 0)
+				SendPacketAsync(queue, last.speed);
+			SendDirect(queue, id, other);
+		});
+		// left: the last position outside of the radius
+		server->ForEachClientNear(room_id, from_x, from_y, [&](ServerSideClient& other) {
+			if (other.id == id || server->IsInInterestRadius(to_x, to_y, other.x, other.y))
+				return;
+			flush();
+			std::queue<std::unique_ptr<Packet>> queue;
+			SendPacketAsync(queue, last.move);
+			SendDirect(queue, id, other);
 		});
 	}
 
@@ -140,6 +399,21 @@ class ServerSideClient {
 		connection.RegisterHandler<HeartbeatPacket>([this](HeartbeatPacket& p) {
 			SendSelfAsync(p);
 		});
+		connection.RegisterHandler<ProtocolPacket>([this](ProtocolPacket& p) {
+			// the newest version that both sides know
+			int version = Packet::GetSupportedProtocol(
+				std::min(p.version, static_cast<int>(Packet::PROTOCOL_BINARY)));
+			connection.SetProtocol(version);
+			if (binary != connection.IsBinary())
+				server->UpdateClientProtocol(binary, connection.IsBinary());
+			binary = connection.IsBinary();
+			int compression = Packet::COMPRESSION_NONE;
+			if (p.compression == Packet::COMPRESSION_DEFLATE && !server->GetConfig().no_compression.Get())
+				compression = Packet::COMPRESSION_DEFLATE;
+			// the reply may already be compressed, the client inflates marked frames
+			connection.SetCompression(compression != Packet::COMPRESSION_NONE);
+			SendSelfAsync(ProtocolPacket(version, compression));
+		});
 
 		auto Leave = [this]() {
 			SendLocalAsync(LeavePacket(id));
@@ -150,19 +424,62 @@ class ServerSideClient {
 		});
 		connection.RegisterSystemHandler(SystemMessage::CLOSE, [this, Leave](Connection& _) {
 			if (join_sent) {
-				Leave();
-				SendGlobalChat(ChatPacket(id, 0, CV_GLOBAL, room_id, "", "*** id:"+
-					std::to_string(id) + (name == "" ? "" : " " + name) + " left the server."));
-				Output::Info("S: room_id={} name={} left the server", room_id, name);
+				{
+					// no moves after the leave
+					std::lock_guard send_lock(m_send_order_mutex);
+					{
+						std::lock_guard lock(m_last_mutex);
+						pending = PendingState();
+					}
+					Leave();
+				}
+				if (!handoff_out) {
+					SendGlobalChat(ChatPacket(id, 0, CV_GLOBAL, room_id, "", "*** id:"+
+						std::to_string(id) + (name == "" ? "" : " " + name) + " left the server."));
+				}
+				Output::Info("S: room_id={} name={} {}", room_id, name,
+					handoff_out ? "moved to another shard" : "left the server");
+				server->DeleteClient(id);
+			} else if (relay) {
+				Output::Info("S: id={} gateway relay closed", id);
 				server->DeleteClient(id);
 			}
 		});
 
+		connection.RegisterHandler<GatewayPacket>([this](GatewayPacket& p) {
+			// the players could otherwise hide their joins or inject global chat
+			if (!server->IsClusterShard() ||
+					!p.IsAuthorized(server->GetConfig().server_cluster_secret.Get())) {
+				Output::Warning("S: id={} refused a gateway packet", id);
+				return;
+			}
+			if (p.type == GatewayPacket::TYPE_RELAY) {
+				relay = true;
+				server->SetClientRelay(this);
+				Output::Info("S: id={} gateway relay opened", id);
+			} else if (p.type == GatewayPacket::TYPE_HANDOFF_IN) {
+				handoff_in = true;
+			} else if (p.type == GatewayPacket::TYPE_HANDOFF_OUT) {
+				// everything sent before has been handled, the gateway waits for the close
+				handoff_out = true;
+				connection.Close();
+			}
+		});
+
 		connection.RegisterHandler<RoomPacket>([this, Leave](RoomPacket& p) {
+			// the tick does not send the moves of the previous room to the new one
+			std::lock_guard send_lock(m_send_order_mutex);
 			// Some maps won't restore their actions, reset all here
-			last.repeating_flash.Discard();
-			last.pictures.clear();
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.repeating_flash.Discard();
+				last.pictures.clear();
+				InvalidateSnapshot();
+				// belongs to the previous room
+				pending = PendingState();
+			}
 			Leave();
+			server->UpdateClientRoom(this, room_id, p.room_id);
 			room_id = p.room_id;
 			SendSelfAsync(p);
 			SendSelfRoomInfoAsync();
@@ -176,11 +493,18 @@ class ServerSideClient {
 				SendLocalAsync(last.system);
 		});
 		connection.RegisterHandler<NamePacket>([this](NamePacket& p) {
-			name = std::move(p.name);
+			{
+				std::lock_guard lock(m_last_mutex);
+				name = std::move(p.name);
+				InvalidateSnapshot();
+			}
 			if (!join_sent) {
-				SendGlobalChat(ChatPacket(id, 0, CV_GLOBAL, room_id, "", "*** id:"+
-					std::to_string(id) + (name == "" ? "" : " " + name) + " joined the server."));
-				Output::Info("S: room_id={} name={} joined the server", room_id, name);
+				if (!handoff_in) {
+					SendGlobalChat(ChatPacket(id, 0, CV_GLOBAL, room_id, "", "*** id:"+
+						std::to_string(id) + (name == "" ? "" : " " + name) + " joined the server."));
+				}
+				Output::Info("S: room_id={} name={} {}", room_id, name,
+					handoff_in ? "came from another shard" : "joined the server");
 
 				SendSelfAsync(ConfigPacket(0, server->GetConfig().server_picture_names.Get()));
 				SendSelfAsync(ConfigPacket(1, server->GetConfig().server_picture_prefixes.Get()));
@@ -191,6 +515,12 @@ class ServerSideClient {
 
 		});
 		connection.RegisterHandler<ChatPacket>([this](ChatPacket& p) {
+			// already filled in by the shard of the sender
+			if (relay) {
+				if (p.visibility == CV_GLOBAL)
+					SendChat(p, 0, CV_GLOBAL, false);
+				return;
+			}
 			p.id = id;
 			p.type = 1; // 1 = chat
 			p.room_id = room_id;
@@ -207,6 +537,7 @@ class ServerSideClient {
 				// use "crypt_key_hash != 0" to distinguish whether to set or send
 				if (p.crypt_key_hash != 0) { // set
 					// the chat_crypt_key_hash is used for searching
+					server->UpdateClientChatCryptKeyHash(this, chat_crypt_key_hash, p.crypt_key_hash);
 					chat_crypt_key_hash = p.crypt_key_hash;
 					Output::Info("S: Chat: {} [CRYPT, {}]: Update chat_crypt_key_hash: {}",
 						p.name, p.room_id, chat_crypt_key_hash);
@@ -216,55 +547,104 @@ class ServerSideClient {
 			}
 		});
 		connection.RegisterHandler<TeleportPacket>([this](TeleportPacket& p) {
-			last.move.x = p.x;
-			last.move.y = p.y;
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.move.x = p.x;
+				last.move.y = p.y;
+			}
+			UpdatePosition(p.x, p.y, false);
 		});
 		connection.RegisterHandler<MovePacket>([this](MovePacket& p) {
 			p.id = id;
-			last.move = p;
-			SendLocalAsync(p);
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.move = p;
+				if (IsTickBatching())
+					pending.moves.push_back(p);
+			}
+			UpdatePosition(p.x, p.y, true);
+			if (!IsTickBatching())
+				SendNearbyAsync(p);
 		});
 		connection.RegisterHandler<JumpPacket>([this](JumpPacket& p) {
 			p.id = id;
-			SendLocalAsync(p);
+			SendLocalInOrder(p);
 		});
 		connection.RegisterHandler<FacingPacket>([this](FacingPacket& p) {
 			p.id = id;
-			last.facing = p;
-			SendLocalAsync(p);
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.facing = p;
+				if (IsTickBatching())
+					pending.facing = p;
+			}
+			if (!IsTickBatching())
+				SendNearbyAsync(p);
 		});
 		connection.RegisterHandler<SpeedPacket>([this](SpeedPacket& p) {
 			p.id = id;
-			last.speed = p;
-			SendLocalAsync(p);
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.speed = p;
+				if (IsTickBatching())
+					pending.speed = p;
+			}
+			if (!IsTickBatching())
+				SendNearbyAsync(p);
 		});
 		connection.RegisterHandler<SpritePacket>([this](SpritePacket& p) {
 			p.id = id;
-			last.sprite = p;
-			SendLocalAsync(p);
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.sprite = p;
+				InvalidateSnapshot();
+				if (IsTickBatching())
+					pending.sprite = p;
+			}
+			if (!IsTickBatching())
+				SendLocalAsync(p);
 		});
 		connection.RegisterHandler<FlashPacket>([this](FlashPacket& p) {
 			p.id = id;
-			SendLocalAsync(p);
+			SendLocalInOrder(p);
 		});
 		connection.RegisterHandler<RepeatingFlashPacket>([this](RepeatingFlashPacket& p) {
 			p.id = id;
-			last.repeating_flash = p;
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.repeating_flash = p;
+				InvalidateSnapshot();
+			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<RemoveRepeatingFlashPacket>([this](RemoveRepeatingFlashPacket& p) {
 			p.id = id;
-			last.repeating_flash.Discard();
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.repeating_flash.Discard();
+				InvalidateSnapshot();
+			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<HiddenPacket>([this](HiddenPacket& p) {
 			p.id = id;
-			last.hidden = p;
-			SendLocalAsync(p);
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.hidden = p;
+				InvalidateSnapshot();
+				if (IsTickBatching())
+					pending.hidden = p;
+			}
+			if (!IsTickBatching())
+				SendLocalAsync(p);
 		});
 		connection.RegisterHandler<SystemPacket>([this](SystemPacket& p) {
 			p.id = id;
-			last.system = p;
+			{
+				std::lock_guard lock(m_last_mutex);
+				last.system = p;
+				InvalidateSnapshot();
+			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<SEPacket>([this](SEPacket& p) {
@@ -273,23 +653,36 @@ class ServerSideClient {
 		});
 		connection.RegisterHandler<ShowPicturePacket>([this](ShowPicturePacket& p) {
 			p.id = id;
-			if (last.pictures.size() < 200)
-				last.pictures[p.pic_id] = p;
+			{
+				std::lock_guard lock(m_last_mutex);
+				if (last.pictures.size() < 200) {
+					last.pictures[p.pic_id] = p;
+					InvalidateSnapshot();
+				}
+			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<MovePicturePacket>([this](MovePicturePacket& p) {
 			p.id = id;
-			const auto& it = last.pictures.find(p.pic_id);
-			if(it != last.pictures.end()) {
-				PicturePacket& pic = it->second;
-				pic.params = p.params;
-				pic = p;
+			{
+				std::lock_guard lock(m_last_mutex);
+				const auto& it = last.pictures.find(p.pic_id);
+				if(it != last.pictures.end()) {
+					PicturePacket& pic = it->second;
+					pic.params = p.params;
+					pic = p;
+					InvalidateSnapshot();
+				}
 			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<ErasePicturePacket>([this](ErasePicturePacket& p) {
 			p.id = id;
-			last.pictures.erase(p.pic_id);
+			{
+				std::lock_guard lock(m_last_mutex);
+				if (last.pictures.erase(p.pic_id))
+					InvalidateSnapshot();
+			}
 			SendLocalAsync(p);
 		});
 		connection.RegisterHandler<ShowPlayerBattleAnimPacket>([this](ShowPlayerBattleAnimPacket& p) {
@@ -309,17 +702,27 @@ class ServerSideClient {
 
 	template<typename T>
 	void SendLocalChat(const T& p) {
-		server->SendTo(id, 0, CV_LOCAL, p.ToBytes(), true);
+		SendChat(p, 0, CV_LOCAL);
 	}
 
 	template<typename T>
 	void SendGlobalChat(const T& p) {
-		server->SendTo(id, 0, CV_GLOBAL, p.ToBytes(), true);
+		SendChat(p, 0, CV_GLOBAL);
 	}
 
 	template<typename T>
 	void SendCryptChat(const T& p) {
-		server->SendTo(id, 0, CV_CRYPT, p.ToBytes(), true);
+		SendChat(p, chat_crypt_key_hash, CV_CRYPT);
+	}
+
+	// encoded for the protocols in use, see ServerMain::IsProtocolUsed
+	void SendChat(const Packet& p, int to_id, VisibilityType visibility, bool return_flag = true) {
+		std::string data = server->IsProtocolUsed(false) ? p.ToBytes() : "";
+		std::string data_bin;
+		if (server->IsProtocolUsed(true))
+			Connection::AppendBulk(data_bin, p.ToBinary(), true);
+		CountPacketOut(server->GetMetrics(), p, data.empty() ? data_bin : data);
+		server->SendTo(id, to_id, visibility, data, data_bin, return_flag);
 	}
 
 	/**
@@ -328,6 +731,7 @@ class ServerSideClient {
 
 	std::queue<std::unique_ptr<Packet>> m_self_queue;
 	std::queue<std::unique_ptr<Packet>> m_local_queue;
+	std::queue<std::unique_ptr<Packet>> m_nearby_queue;
 	std::queue<std::unique_ptr<Packet>> m_global_queue;
 
 	template<typename T>
@@ -348,58 +752,161 @@ class ServerSideClient {
 		SendPacketAsync(m_local_queue, p);
 	}
 
+	// high frequency updates, to the whole room if the interest management is disabled
+	template<typename T>
+	void SendNearbyAsync(const T& p) {
+		SendPacketAsync(m_nearby_queue, p);
+	}
+
 	template<typename T>
 	void SendGlobalAsync(const T& p) {
 		SendPacketAsync(m_global_queue, p);
 	}
 
-	void FlushQueueSend(const std::string& bulk,
-			const VisibilityType& visibility, bool to_self) {
+	void FlushQueueSend(const std::string& bulk, const std::string& bulk_bin,
+			VisibilityType visibility, bool to_self, bool coalescible) {
 		if (to_self) {
-			connection.Send(bulk);
+			connection.Send(connection.IsBinary() ? bulk_bin : bulk);
 		} else {
+			if (visibility == Messages::CV_NEARBY && server->GetInterestRadius() == 0)
+				visibility = Messages::CV_LOCAL;
 			int to_id = 0;
-			if (visibility == Messages::CV_LOCAL) {
+			if (visibility == Messages::CV_LOCAL || visibility == Messages::CV_NEARBY) {
 				to_id = room_id;
 			}
-			server->SendTo(id, to_id, visibility, bulk);
+			server->SendTo(id, to_id, visibility, bulk, bulk_bin, false, coalescible);
 		}
 	}
 
+	// to one client, through the shard of from_id
+	void SendDirect(std::queue<std::unique_ptr<Packet>>& queue, int from_id, ServerSideClient& to) {
+		const bool binary = to.IsBinary();
+		FlushBulks(queue, !binary, binary, server->GetMetrics(),
+				[&](const std::string& bulk, const std::string& bulk_bin) {
+			server->SendTo(from_id, to.id, CV_DIRECT, bulk, bulk_bin);
+		});
+	}
+
 	void FlushQueue(std::queue<std::unique_ptr<Packet>>& queue,
-			const VisibilityType& visibility, bool to_self = false) {
-		std::string bulk;
-		while (!queue.empty()) {
-			const auto& e = queue.front();
-			std::string data = std::move(e->ToBytes());
-			if (bulk.size() + data.size() > MAX_BULK_SIZE) {
-				FlushQueueSend(bulk, visibility, to_self);
-				bulk.clear();
-			}
-			if (!bulk.empty())
-				bulk += Packet::MSG_DELIM;
-			bulk += data;
-			queue.pop();
-		}
-		if (!bulk.empty()) {
-			FlushQueueSend(bulk, visibility, to_self);
+			const VisibilityType& visibility, bool to_self = false, bool coalescible = false) {
+		// the others get the protocols in use, oneself only needs one
+		bool text = to_self ? !connection.IsBinary() : server->IsProtocolUsed(false);
+		bool binary = to_self ? connection.IsBinary() : server->IsProtocolUsed(true);
+		FlushBulks(queue, text, binary, server->GetMetrics(),
+				[&](const std::string& bulk, const std::string& bulk_bin) {
+			FlushQueueSend(bulk, bulk_bin, visibility, to_self, coalescible);
+		});
+	}
+
+	/**
+	 * Sends a packet that is not batched by the tick (jumps, flashes)
+	 *  With tick batching, the queued packets and the pending state are
+	 *  sent right away, followed by p. The moves before p arrive first and
+	 *  the moves after it cannot overtake it in the next tick. Everything
+	 *  goes through the shard of this client, which keeps the order.
+	 */
+	template<typename T>
+	void SendLocalInOrder(const T& p) {
+		if (!IsTickBatching()) {
+			SendLocalAsync(p);
+			return;
 		}
+		std::lock_guard lock(m_send_order_mutex);
+		FlushQueue();
+		SendPendingState();
+		SendLocalAsync(p);
+		FlushQueue(m_local_queue, CV_LOCAL);
+	}
+
+	// m_send_order_mutex must be held
+	void SendPendingState() {
+		std::queue<std::unique_ptr<Packet>> local_queue;
+		std::queue<std::unique_ptr<Packet>> nearby_queue;
+		if (server->GetInterestRadius() > 0)
+			TakePendingState(local_queue, nearby_queue);
+		else
+			TakePendingState(local_queue, local_queue);
+		FlushQueue(nearby_queue, CV_NEARBY, false, true);
+		FlushQueue(local_queue, CV_LOCAL, false, true);
+	}
+
+	/**
+	 * Moves the pending state into the queues
+	 *  nearby_queue gets the updates that are limited by the interest radius,
+	 *  it can be the same as local_queue.
+	 */
+	void TakePendingState(std::queue<std::unique_ptr<Packet>>& local_queue,
+			std::queue<std::unique_ptr<Packet>>& nearby_queue) {
+		std::lock_guard lock(m_last_mutex);
+		if (pending.sprite)
+			SendPacketAsync(local_queue, *pending.sprite);
+		if (pending.hidden)
+			SendPacketAsync(local_queue, *pending.hidden);
+		if (pending.speed)
+			SendPacketAsync(nearby_queue, *pending.speed);
+		for (const auto& move : pending.moves)
+			SendPacketAsync(nearby_queue, move);
+		if (pending.facing)
+			SendPacketAsync(nearby_queue, *pending.facing);
+		pending = PendingState();
 	}
 
 	void FlushQueue() {
 		FlushQueue(m_global_queue, CV_GLOBAL);
 		FlushQueue(m_local_queue, CV_LOCAL);
+		// only movement, facing and speed
+		FlushQueue(m_nearby_queue, CV_NEARBY, false, true);
 		FlushQueue(m_self_queue, CV_NULL, true);
 	}
 
+	/**
+	 * Coalescing for slow clients
+	 *  While the socket refuses state frames, only the senders are noted.
+	 *  When it has caught up, the latest state of these senders is sent
+	 *  instead of every step in between.
+	 */
+	std::mutex m_stale_mutex;
+	std::set<int> stale_ids;
+
+	void HandleDrain() {
+		std::set<int> ids;
+		{
+			std::lock_guard lock(m_stale_mutex);
+			std::swap(ids, stale_ids);
+		}
+		if (ids.empty())
+			return;
+		// after the frames of the others that are still in their shard queues
+		server->ForEachClientInRoom(room_id, [this, &ids](ServerSideClient& other) {
+			if (other.id == id || ids.count(other.id) == 0)
+				return;
+			std::queue<std::unique_ptr<Packet>> queue;
+			{
+				std::lock_guard lock(other.m_last_mutex);
+				SendPacketAsync(queue, other.last.move);
+				if (other.last.facing.facing != 0)
+					SendPacketAsync(queue, other.last.facing);
+				if (other.last.speed.speed != 0)
+					SendPacketAsync(queue, other.last.speed);
+				if (other.last.sprite.index != -1)
+					SendPacketAsync(queue, other.last.sprite);
+				if (other.last.hidden.hidden_bin == 1)
+					SendPacketAsync(queue, other.last.hidden);
+			}
+			SendDirect(queue, other.id, *this);
+		});
+	}
+
 public:
 	ServerSideClient(ServerMain* _server, int _id, std::unique_ptr<Socket> _socket)
-			: server(_server), id(_id), connection(ServerConnection(_socket)) {
+			: server(_server), id(_id),
+			connection(ServerConnection(_socket, &_server->GetMetrics(), &_server->GetCapture())) {
 		InitConnection();
 	}
 
 	void Open() {
 		connection.SetReadTimeout(server->GetConfig().no_heartbeats.Get() ? 0 : 6000);
+		connection.SetDrainHandler([this]() { HandleDrain(); });
 		connection.Open();
 	}
 
@@ -411,6 +918,43 @@ public:
 		connection.Send(data);
 	}
 
+	void Send(const Socket::Frame& frame) {
+		connection.SendFrame(frame);
+	}
+
+	void SendState(const Socket::Frame& frame, int from_id) {
+		if (connection.SendStateFrame(frame))
+			return;
+		server->GetMetrics().coalesced_frames.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard lock(m_stale_mutex);
+		stale_ids.insert(from_id);
+	}
+
+	/**
+	 * Sends the pending state as one bulk, called by the tick thread
+	 *  It goes to the others like the packets of this client,
+	 *  oneself does not get it back.
+	 * The tick holds the server mutex, which a room change needs while it
+	 *  holds m_send_order_mutex. A busy client is left for the next tick,
+	 *  a jump sends the pending state by itself.
+	 */
+	void FlushPendingState() {
+		std::unique_lock lock(m_send_order_mutex, std::try_to_lock);
+		if (lock.owns_lock())
+			SendPendingState();
+	}
+
+	// encodes with the negotiated protocol, can be called from other threads
+	void SendPacket(const Packet& p) {
+		std::string data;
+		Connection::AppendBulk(data, binary ? p.ToBinary() : p.ToBytes(), binary);
+		connection.Send(data);
+	}
+
+	bool IsBinary() const {
+		return binary;
+	}
+
 	const int& GetId() {
 		return id;
 	}
@@ -422,6 +966,20 @@ public:
 	const int& GetChatCryptKeyHash() {
 		return chat_crypt_key_hash;
 	}
+
+	int GetX() const {
+		return x;
+	}
+
+	int GetY() const {
+		return y;
+	}
+
+	// see ServerMain::UpdateClientPosition
+	void SetPosition(int _x, int _y) {
+		x = _x;
+		y = _y;
+	}
 };
 
 /**
@@ -432,119 +990,492 @@ struct ServerMain::DataToSend {
 	int from_id;
 	int to_id;
 	VisibilityType visibility;
-	std::string data;
+	// encoded once per protocol, shared by all the recipients
+	Socket::Frame frame;
+	Socket::Frame frame_bin;
 	bool return_flag;
+	// superseded by the next state of the sender, see ServerSideClient::SendState
+	bool coalescible;
+	std::chrono::steady_clock::time_point queued_at = std::chrono::steady_clock::now();
 };
 
 void ServerMain::ForEachClient(const std::function<void(ServerSideClient&)>& callback) {
 	if (!running) return;
-	std::lock_guard lock(m_mutex);
+	std::shared_lock lock(m_mutex);
 	for (const auto& it : clients) {
 		callback(*it.second);
 	}
 }
 
+void ServerMain::ForEachClientInRoom(const int& room_id,
+		const std::function<void(ServerSideClient&)>& callback) {
+	if (!running) return;
+	std::shared_lock lock(m_mutex);
+	const auto& it = room_clients.find(room_id);
+	if (it == room_clients.end())
+		return;
+	for (const auto& client : it->second) {
+		callback(*client);
+	}
+}
+
+/**
+ * Moves a client from one bucket of a fan-out index to another
+ *  Empty buckets are erased so that the indexes do not grow with every
+ *  room or key that has ever been used.
+ */
+template<typename K>
+static void MoveIndexEntry(std::map<K, std::set<ServerSideClient*>>& index,
+		ServerSideClient* client, const K& from_key, const K& to_key) {
+	const auto& it = index.find(from_key);
+	if (it != index.end()) {
+		it->second.erase(client);
+		if (it->second.empty())
+			index.erase(it);
+	}
+	index[to_key].insert(client);
+}
+
+template<typename K>
+static void EraseIndexEntry(std::map<K, std::set<ServerSideClient*>>& index,
+		ServerSideClient* client, const K& key) {
+	const auto& it = index.find(key);
+	if (it == index.end())
+		return;
+	it->second.erase(client);
+	if (it->second.empty())
+		index.erase(it);
+}
+
 void ServerMain::DeleteClient(const int& id) {
 	std::lock_guard lock(m_mutex);
-	clients.erase(id);
+	const auto& it = clients.find(id);
+	if (it == clients.end())
+		return;
+	ServerSideClient* client = it->second.get();
+	EraseIndexEntry(room_clients, client, client->GetRoomId());
+	EraseIndexEntry(crypt_clients, client, client->GetChatCryptKeyHash());
+	if (interest_radius > 0) {
+		EraseIndexEntry(interest_grid, client, GetInterestCell(
+			client->GetRoomId(), client->GetX(), client->GetY()));
+	}
+	protocol_clients[client->IsBinary()].fetch_sub(1, std::memory_order_relaxed);
+	clients.erase(it);
+}
+
+void ServerMain::UpdateClientRoom(ServerSideClient* client,
+		const int& from_room_id, const int& to_room_id) {
+	std::lock_guard lock(m_mutex);
+	MoveIndexEntry(room_clients, client, from_room_id, to_room_id);
+	if (interest_radius > 0) {
+		MoveIndexEntry(interest_grid, client,
+			GetInterestCell(from_room_id, client->GetX(), client->GetY()),
+			GetInterestCell(to_room_id, client->GetX(), client->GetY()));
+	}
+}
+
+void ServerMain::SetClientRelay(ServerSideClient* client) {
+	std::lock_guard lock(m_mutex);
+	// only reached by CV_GLOBAL
+	EraseIndexEntry(room_clients, client, client->GetRoomId());
+	EraseIndexEntry(crypt_clients, client, client->GetChatCryptKeyHash());
+	if (interest_radius > 0) {
+		EraseIndexEntry(interest_grid, client, GetInterestCell(
+			client->GetRoomId(), client->GetX(), client->GetY()));
+	}
+}
+
+void ServerMain::UpdateClientProtocol(const bool& from_binary, const bool& to_binary) {
+	protocol_clients[to_binary].fetch_add(1, std::memory_order_relaxed);
+	protocol_clients[from_binary].fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool ServerMain::IsProtocolUsed(const bool& binary) const {
+	return protocol_clients[binary].load(std::memory_order_relaxed) > 0;
+}
+
+void ServerMain::UpdateClientChatCryptKeyHash(ServerSideClient* client,
+		const int& from_hash, const int& to_hash) {
+	std::lock_guard lock(m_mutex);
+	MoveIndexEntry(crypt_clients, client, from_hash, to_hash);
+}
+
+ServerMain::InterestCell ServerMain::GetInterestCell(const int& room_id,
+		const int& x, const int& y) const {
+	// round towards negative infinity
+	auto cell = [this](int v) {
+		return v >= 0 ? v / interest_radius : (v + 1) / interest_radius - 1;
+	};
+	return { room_id, cell(x), cell(y) };
+}
+
+bool ServerMain::IsInInterestRadius(const int& x1, const int& y1,
+		const int& x2, const int& y2) const {
+	return std::abs(x1 - x2) <= interest_radius && std::abs(y1 - y2) <= interest_radius;
+}
+
+void ServerMain::ForEachClientNearUnlocked(const int& room_id, const int& x, const int& y,
+		const std::function<void(ServerSideClient&)>& callback) {
+	auto [_, cell_x, cell_y] = GetInterestCell(room_id, x, y);
+	for (int cy = cell_y - 1; cy <= cell_y + 1; ++cy) {
+		for (int cx = cell_x - 1; cx <= cell_x + 1; ++cx) {
+			const auto& it = interest_grid.find({ room_id, cx, cy });
+			if (it == interest_grid.end())
+				continue;
+			for (const auto& client : it->second) {
+				if (IsInInterestRadius(x, y, client->GetX(), client->GetY()))
+					callback(*client);
+			}
+		}
+	}
+}
+
+void ServerMain::ForEachClientNear(const int& room_id, const int& x, const int& y,
+		const std::function<void(ServerSideClient&)>& callback) {
+	if (!running || interest_radius == 0) return;
+	std::shared_lock lock(m_mutex);
+	ForEachClientNearUnlocked(room_id, x, y, callback);
+}
+
+void ServerMain::UpdateClientPosition(ServerSideClient* client,
+		const int& to_x, const int& to_y) {
+	if (interest_radius == 0) {
+		client->SetPosition(to_x, to_y);
+		return;
+	}
+	InterestCell from_cell = GetInterestCell(client->GetRoomId(), client->GetX(), client->GetY());
+	InterestCell to_cell = GetInterestCell(client->GetRoomId(), to_x, to_y);
+	// most moves stay inside of the cell, the grid does not change
+	if (from_cell == to_cell) {
+		client->SetPosition(to_x, to_y);
+		return;
+	}
+	// the readers of the grid never see the position of another cell
+	std::lock_guard lock(m_mutex);
+	MoveIndexEntry(interest_grid, client, from_cell, to_cell);
+	client->SetPosition(to_x, to_y);
+}
+
+ServerMain::DispatchShard& ServerMain::GetShard(const int& from_id) {
+	// by the sender, the local and global packets of a client cannot overtake each other
+	return *shards[static_cast<unsigned int>(from_id) % shards.size()];
 }
 
 void ServerMain::SendTo(const int& from_id, const int& to_id,
 		const VisibilityType& visibility, const std::string& data,
-		const bool& return_flag) {
+		const std::string& data_bin, const bool& return_flag, const bool& coalescible) {
 	if (!running) return;
-	auto data_to_send = new DataToSend{ from_id, to_id, visibility, data,
-			return_flag };
-	{
-		std::lock_guard lock(m_mutex);
-		m_data_to_send_queue.emplace(data_to_send);
-		m_data_to_send_queue_cv.notify_one();
+	// a protocol without clients is not encoded
+	auto data_to_send = new DataToSend{ from_id, to_id, visibility,
+			data.empty() ? nullptr : Socket::BuildFrame(data),
+			data_bin.empty() ? nullptr : Socket::BuildFrame(data_bin), return_flag, coalescible };
+	GetShard(from_id).Push(data_to_send);
+}
+
+void ServerMain::DispatchShard::Push(DataToSend* data_to_send) {
+	data_to_send_queue.Push(std::unique_ptr<DataToSend>(data_to_send));
+	// checked after the push, the sending thread sets it before checking the queue
+	if (sleeping) {
+		std::lock_guard lock(mutex);
+		data_to_send_queue_cv.notify_one();
 	}
 }
 
-void ServerMain::Start(bool wait_thread) {
-	if (running) return;
-	running = true;
+std::unique_ptr<ServerMain::DataToSend> ServerMain::DispatchShard::Pop() {
+	std::unique_ptr<DataToSend> data_to_send;
+	if (data_to_send_queue.Pop(data_to_send))
+		return data_to_send;
+	std::unique_lock lock(mutex);
+	sleeping = true;
+	data_to_send_queue_cv.wait(lock, [this, &data_to_send] {
+		return data_to_send_queue.Pop(data_to_send); });
+	sleeping = false;
+	return data_to_send;
+}
 
-	std::thread([this]() {
-		while (running) {
-			std::unique_lock<std::mutex> lock(m_mutex);
-			m_data_to_send_queue_cv.wait(lock, [this] {
-					return !m_data_to_send_queue.empty(); });
-			auto& data_to_send = m_data_to_send_queue.front();
-			// stop the thread
-			if (data_to_send->from_id == 0 &&
-					data_to_send->visibility == Messages::CV_NULL) {
-				m_data_to_send_queue.pop();
-				break;
+void ServerMain::DispatchLoop(std::shared_ptr<DispatchShard> shard) {
+	while (true) {
+		std::unique_ptr<DataToSend> data_to_send = shard->Pop();
+		// stop the thread
+		if (data_to_send->from_id == 0 &&
+				data_to_send->visibility == Messages::CV_NULL) {
+			break;
+		}
+		std::shared_lock lock(m_mutex);
+		// check if the client is online
+		ServerSideClient* from_client = nullptr;
+		const auto& from_client_it = clients.find(data_to_send->from_id);
+		if (from_client_it != clients.end()) {
+			from_client = from_client_it->second.get();
+		}
+		auto SendToClient = [&data_to_send](ServerSideClient* to_client) {
+			// exclude self
+			if (!data_to_send->return_flag &&
+					data_to_send->from_id == to_client->GetId())
+				return;
+			const auto& frame = to_client->IsBinary() ?
+				data_to_send->frame_bin : data_to_send->frame;
+			// it has switched the protocol since the frame was encoded
+			if (!frame)
+				return;
+			if (data_to_send->coalescible)
+				to_client->SendState(frame, data_to_send->from_id);
+			else
+				to_client->Send(frame);
+		};
+		// send to local and crypt: to_id is the room_id or the chat_crypt_key_hash
+		//  so only the clients in that bucket of the index are entered
+		if ((data_to_send->visibility == Messages::CV_LOCAL ||
+				data_to_send->visibility == Messages::CV_CRYPT) && from_client) {
+			auto& index = data_to_send->visibility == Messages::CV_LOCAL ?
+				room_clients : crypt_clients;
+			const auto& index_it = index.find(data_to_send->to_id);
+			if (index_it != index.end()) {
+				for (const auto& to_client : index_it->second) {
+					SendToClient(to_client);
+				}
 			}
-			// check if the client is online
-			ServerSideClient* from_client = nullptr;
-			const auto& from_client_it = clients.find(data_to_send->from_id);
-			if (from_client_it != clients.end()) {
-				from_client = from_client_it->second.get();
+		// send to nearby: only the clients around the sender in the room
+		} else if (data_to_send->visibility == Messages::CV_NEARBY && from_client) {
+			ForEachClientNearUnlocked(data_to_send->to_id,
+					from_client->GetX(), from_client->GetY(),
+					[&SendToClient](ServerSideClient& to_client) {
+				SendToClient(&to_client);
+			});
+		// send to global
+		} else if (data_to_send->visibility == Messages::CV_GLOBAL) {
+			// enter on every client
+			for (const auto& it : clients) {
+				SendToClient(it.second.get());
 			}
-			// send to global, local and crypt
-			if (data_to_send->visibility == Messages::CV_LOCAL ||
-				data_to_send->visibility == Messages::CV_CRYPT ||
-					data_to_send->visibility == Messages::CV_GLOBAL) {
-				// enter on every client
-				for (const auto& it : clients) {
-					auto& to_client = it.second;
-					// exclude self
-					if (!data_to_send->return_flag &&
-							data_to_send->from_id == to_client->GetId())
-						continue;
-					// send to local
-					if (data_to_send->visibility == Messages::CV_LOCAL &&
-							from_client && data_to_send->to_id == to_client->GetRoomId()) {
-						to_client->Send(data_to_send->data);
-					// send to crypt
-					} else if (data_to_send->visibility == Messages::CV_CRYPT &&
-							from_client && from_client->GetChatCryptKeyHash() == to_client->GetChatCryptKeyHash()) {
-						to_client->Send(data_to_send->data);
-					// send to global
-					} else if (data_to_send->visibility == Messages::CV_GLOBAL) {
-						to_client->Send(data_to_send->data);
-					}
-				}
+		// send to one client: to_id is its id
+		} else if (data_to_send->visibility == Messages::CV_DIRECT) {
+			const auto& to_client_it = clients.find(data_to_send->to_id);
+			if (to_client_it != clients.end())
+				SendToClient(to_client_it->second.get());
+		}
+		metrics.fanout_latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - data_to_send->queued_at).count());
+	}
+}
+
+void ServerMain::Tick() {
+	std::shared_lock lock(m_mutex);
+	for (const auto& it : clients) {
+		it.second->FlushPendingState();
+	}
+}
+
+void ServerMain::TickLoop() {
+	const auto interval = std::chrono::microseconds(1000000 / tick_rate);
+	auto next_tick = std::chrono::steady_clock::now();
+	while (running) {
+		next_tick += interval;
+		{
+			std::unique_lock lock(stop_mutex);
+			if (stop_cv.wait_until(lock, next_tick, [this]() { return !running; }))
+				break;
+		}
+		Tick();
+	}
+}
+
+std::string ServerMain::RenderMetrics() {
+	std::string out;
+	metrics.Write(out);
+	std::shared_lock lock(m_mutex);
+	ServerMetrics::WriteHelp(out, "epmp_connections", "Connected clients", "gauge");
+	ServerMetrics::WriteValue(out, "epmp_connections", "", clients.size());
+	ServerMetrics::WriteHelp(out, "epmp_room_clients", "Clients by room", "gauge");
+	for (const auto& [room_id, room] : room_clients) {
+		ServerMetrics::WriteValue(out, "epmp_room_clients",
+			"room=\"" + std::to_string(room_id) + "\"", room.size());
+	}
+	ServerMetrics::WriteHelp(out, "epmp_dispatch_queue_depth",
+		"Frames waiting for a sending thread", "gauge");
+	for (size_t i = 0; i < shards.size(); ++i) {
+		ServerMetrics::WriteValue(out, "epmp_dispatch_queue_depth",
+			"shard=\"" + std::to_string(i) + "\"", shards[i]->data_to_send_queue.Size());
+	}
+	return out;
+}
+
+void ServerMain::MetricsFileLoop() {
+	const std::string path = cfg.server_metrics_file.Get();
+	const std::string tmp_path = path + ".tmp";
+	auto next_write = std::chrono::steady_clock::now();
+	while (running) {
+		next_write += std::chrono::seconds(METRICS_FILE_INTERVAL_S);
+		{
+			std::unique_lock lock(stop_mutex);
+			if (stop_cv.wait_until(lock, next_write, [this]() { return !running; }))
+				break;
+		}
+		// readers never see a partial file
+		{
+			std::ofstream ofs(tmp_path, std::ios::trunc);
+			ofs << RenderMetrics();
+			if (!ofs) {
+				Output::Warning("S: Writing the metrics to {} failed", tmp_path);
+				continue;
 			}
-			m_data_to_send_queue.pop();
 		}
-	}).detach();
+		if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+			Output::Warning("S: Renaming the metrics file to {} failed", path);
+	}
+}
+
+void ServerMain::Start(bool wait_thread) {
+	if (running) return;
+	running = true;
+	stop_requested = false;
+
+	size_t threads = cfg.server_threads.Get();
+	if (threads > 1 && !ServerListener::IsReusePortSupported()) {
+		Output::Warning("S: ServerThreads is not supported on this platform, using 1 thread");
+		threads = 1;
+	}
+
+	interest_radius = cfg.server_interest_radius.Get();
+	interest_grid.clear();
+
+	tick_rate = cfg.server_tick_rate.Get();
+
+	if (cfg.server_capture_file.Get() != "") {
+		if (capture.Open(cfg.server_capture_file.Get()))
+			Output::Info("S: Capturing the received frames to {}", cfg.server_capture_file.Get());
+		else
+			Output::Warning("S: Opening the capture file {} failed", cfg.server_capture_file.Get());
+	}
+
+	{
+		std::lock_guard lock(m_mutex);
+		shards.clear();
+		for (size_t i = 0; i < threads; ++i) {
+			auto shard = std::make_shared<DispatchShard>();
+			shards.push_back(shard);
+			dispatch_threads.emplace_back([this, shard]() {
+				DispatchLoop(shard);
+			});
+		}
+	}
+
+	// the tick sends to the shards, the metrics read them
+	if (tick_rate > 0)
+		tick_thread = std::thread([this]() { TickLoop(); });
+	if (cfg.server_metrics_file.Get() != "")
+		metrics_file_thread = std::thread([this]() { MetricsFileLoop(); });
 
 	auto CreateServerSideClient = [this](std::unique_ptr<Socket> socket) {
+		std::unique_lock lock(m_mutex);
 		if (clients.size() >= cfg.server_max_users.Get()) {
+			lock.unlock();
+			metrics.connections_rejected.fetch_add(1, std::memory_order_relaxed);
 			std::string_view data = "\uFFFD1";
 			socket->Send(data);
 			socket->Close();
 		} else {
+			metrics.connections_total.fetch_add(1, std::memory_order_relaxed);
 			auto& client = clients[client_id];
-			client.reset(new ServerSideClient(this, client_id++, std::move(socket)));
+			client.reset(new ServerSideClient(this, client_id, std::move(socket)));
+			client_id += client_id_step;
+			// new clients start in room 0 without chat_crypt_key_hash, using text
+			protocol_clients[false].fetch_add(1, std::memory_order_relaxed);
+			room_clients[client->GetRoomId()].insert(client.get());
+			crypt_clients[client->GetChatCryptKeyHash()].insert(client.get());
+			if (interest_radius > 0) {
+				interest_grid[GetInterestCell(client->GetRoomId(),
+					client->GetX(), client->GetY())].insert(client.get());
+			}
 			client->Open();
 		}
 	};
 
+	const bool metrics_enabled = cfg.server_metrics_address.Get() != "" ||
+		cfg.server_metrics_file.Get() != "";
+	auto OnLoopLag = [this](uint64_t lag_us) {
+		metrics.loop_lag.Record(lag_us);
+	};
+
+	if (cfg.server_metrics_address.Get() != "") {
+		std::string metrics_host;
+		uint16_t metrics_port{ 6501 };
+		Connection::ParseAddress(cfg.server_metrics_address.Get(), metrics_host, metrics_port);
+		metrics_endpoint.Start(metrics_host, metrics_port, [this]() { return RenderMetrics(); });
+	}
+
 	if (cfg.server_bind_address_2.Get() != "") {
 		server_listener_2.reset(new ServerListener(addr_host_2, addr_port_2));
+		if (metrics_enabled)
+			server_listener_2->OnLoopLag = OnLoopLag;
 		server_listener_2->OnInfo = [](std::string_view m) { Output::Info("S: {}", m); };
 		server_listener_2->OnWarning = [](std::string_view m) { Output::Warning("S: {}", m); };
 		server_listener_2->OnConnection = CreateServerSideClient;
 		server_listener_2->Start();
 	}
 
-	server_listener.reset(new ServerListener(addr_host, addr_port));
-	server_listener->OnInfo = [](std::string_view m) { Output::Info("S: {}", m); };
-	server_listener->OnWarning = [](std::string_view m) { Output::Warning("S: {}", m); };
-	server_listener->OnConnection = CreateServerSideClient;
-	server_listener->Start(wait_thread);
+	// one loop per thread, connections are spread by SO_REUSEPORT
+	server_listeners.clear();
+	for (size_t i = 0; i < threads; ++i) {
+		auto& server_listener = server_listeners.emplace_back(
+			new ServerListener(addr_host, addr_port));
+		server_listener->SetReusePort(threads > 1);
+		if (metrics_enabled)
+			server_listener->OnLoopLag = OnLoopLag;
+		server_listener->OnInfo = [](std::string_view m) { Output::Info("S: {}", m); };
+		server_listener->OnWarning = [](std::string_view m) { Output::Warning("S: {}", m); };
+		server_listener->OnConnection = CreateServerSideClient;
+	}
+	// the signal handlers cannot stop the server, the loop of the calling thread does
+	if (wait_thread) {
+		server_listeners.back()->OnTimer = [this](uv_loop_t* loop) {
+			if (stop_requested.exchange(false))
+				Stop();
+		};
+	}
+	// only the last one can block the calling thread
+	for (size_t i = 0; i < server_listeners.size(); ++i) {
+		server_listeners[i]->Start(wait_thread && i == server_listeners.size() - 1);
+	}
+}
+
+ServerMain::~ServerMain() {
+	StopThreads();
+}
+
+// a server thread that stops the server cannot wait for itself
+static void JoinThread(std::thread& thread) {
+	if (!thread.joinable())
+		return;
+	if (thread.get_id() == std::this_thread::get_id())
+		thread.detach();
+	else
+		thread.join();
+}
+
+void ServerMain::StopThreads() {
+	{
+		std::lock_guard lock(stop_mutex);
+		running = false;
+	}
+	stop_cv.notify_all();
+	JoinThread(tick_thread);
+	JoinThread(metrics_file_thread);
+	// nothing is queued anymore, SendTo checks running
+	for (const auto& shard : shards) {
+		shard->Push(new DataToSend{ 0, 0, Messages::CV_NULL, nullptr, nullptr });
+	}
+	for (auto& thread : dispatch_threads) {
+		JoinThread(thread);
+	}
+	dispatch_threads.clear();
 }
 
 void ServerMain::Stop() {
 	if (!running) return;
 	Output::Debug("Server: Stopping");
+	StopThreads();
 	std::lock_guard lock(m_mutex);
-	running = false;
 	for (const auto& it : clients) {
 		it.second->Send("\uFFFD0");
 		// the client will be removed from HandleClose
@@ -552,10 +1483,11 @@ void ServerMain::Stop() {
 	}
 	if (server_listener_2)
 		server_listener_2->Stop();
-	server_listener->Stop();
-	// stop sending loop
-	m_data_to_send_queue.emplace(new DataToSend{ 0, 0, Messages::CV_NULL, "" });
-	m_data_to_send_queue_cv.notify_one();
+	metrics_endpoint.Stop();
+	capture.Close();
+	for (const auto& server_listener : server_listeners) {
+		server_listener->Stop();
+	}
 	Output::Info("S: Stopped");
 }
 
@@ -564,6 +1496,25 @@ void ServerMain::SetConfig(const Game_ConfigMultiplayer& _cfg) {
 	Connection::ParseAddress(cfg.server_bind_address.Get(), addr_host, addr_port);
 	if (cfg.server_bind_address_2.Get() != "")
 		Connection::ParseAddress(cfg.server_bind_address_2.Get(), addr_host_2, addr_port_2);
+
+	// shard i of n: ids i + 10, i + 10 + n ... are unique in the cluster
+	cluster_shard = false;
+	client_id = 10;
+	client_id_step = 1;
+	if (cfg.server_cluster_shard.Get() != "") {
+		int index = -1, count = 0;
+		if (std::sscanf(cfg.server_cluster_shard.Get().c_str(), "%d/%d", &index, &count) == 2 &&
+				count > 0 && index >= 0 && index < count) {
+			cluster_shard = true;
+			client_id = 10 + index;
+			client_id_step = count;
+			if (cfg.server_cluster_secret.Get().empty())
+				Output::Warning("S: ServerClusterSecret is not set, the gateway is refused");
+		} else {
+			Output::Warning("S: Invalid ServerClusterShard: {}, expected index/count",
+				cfg.server_cluster_shard.Get());
+		}
+	}
 }
 
 Game_ConfigMultiplayer ServerMain::GetConfig() const {
@@ -582,11 +1533,21 @@ int main(int argc, char *argv[])
 	Game_ConfigMultiplayer cfg;
 	std::string config_path{""};
 
-	const char* short_opts = "a:A:nc:";
+	const char* short_opts = "a:A:t:r:T:m:M:s:S:k:w:nzc:";
 	const option long_opts[] = {
 		{"bind-address", required_argument, nullptr, 'a'},
 		{"bind-address-2", required_argument, nullptr, 'A'},
+		{"threads", required_argument, nullptr, 't'},
+		{"interest-radius", required_argument, nullptr, 'r'},
+		{"tick-rate", required_argument, nullptr, 'T'},
+		{"metrics-address", required_argument, nullptr, 'm'},
+		{"metrics-file", required_argument, nullptr, 'M'},
+		{"cluster-shard", required_argument, nullptr, 's'},
+		{"cluster-shards", required_argument, nullptr, 'S'},
+		{"cluster-secret", required_argument, nullptr, 'k'},
+		{"capture-file", required_argument, nullptr, 'w'},
 		{"no-heartbeats", no_argument, nullptr, 'n'},
+		{"no-compression", no_argument, nullptr, 'z'},
 		{"config-path", required_argument, nullptr, 'c'},
 		{nullptr, no_argument, nullptr, 0}
 	};
@@ -597,8 +1558,28 @@ int main(int argc, char *argv[])
 			cfg.server_bind_address.Set(std::string(optarg));
 		else if (opt == 'A')
 			cfg.server_bind_address_2.Set(std::string(optarg));
+		else if (opt == 't')
+			cfg.server_threads.Set(std::atoi(optarg));
+		else if (opt == 'r')
+			cfg.server_interest_radius.Set(std::atoi(optarg));
+		else if (opt == 'T')
+			cfg.server_tick_rate.Set(std::atoi(optarg));
+		else if (opt == 'm')
+			cfg.server_metrics_address.Set(std::string(optarg));
+		else if (opt == 'M')
+			cfg.server_metrics_file.Set(std::string(optarg));
+		else if (opt == 's')
+			cfg.server_cluster_shard.Set(std::string(optarg));
+		else if (opt == 'S')
+			cfg.server_cluster_shards.Set(std::string(optarg));
+		else if (opt == 'k')
+			cfg.server_cluster_secret.Set(std::string(optarg));
+		else if (opt == 'w')
+			cfg.server_capture_file.Set(std::string(optarg));
 		else if (opt == 'n')
 			cfg.no_heartbeats.Set(true);
+		else if (opt == 'z')
+			cfg.no_compression.Set(true);
 		else if (opt == 'c')
 			config_path = optarg;
 		else
@@ -614,16 +1595,36 @@ int main(int argc, char *argv[])
 		cfg.server_bind_address.FromIni(ini);
 		cfg.server_bind_address_2.FromIni(ini);
 		cfg.server_max_users.FromIni(ini);
+		cfg.server_threads.FromIni(ini);
+		cfg.server_interest_radius.FromIni(ini);
+		cfg.server_tick_rate.FromIni(ini);
+		cfg.server_metrics_address.FromIni(ini);
+		cfg.server_metrics_file.FromIni(ini);
+		cfg.server_cluster_shard.FromIni(ini);
+		cfg.server_cluster_shards.FromIni(ini);
+		cfg.server_cluster_secret.FromIni(ini);
+		cfg.server_capture_file.FromIni(ini);
 		cfg.server_picture_names.FromIni(ini);
 		cfg.server_picture_prefixes.FromIni(ini);
 		cfg.server_virtual_3d_maps.FromIni(ini);
 	}
 
+	// gateway of a cluster, the shards are servers with ServerClusterShard
+	if (cfg.server_cluster_shards.Get() != "") {
+		Gateway().SetConfig(cfg);
+		auto signal_handler = [](int signal) {
+			Gateway().RequestStop();
+		};
+		std::signal(SIGINT, signal_handler);
+		std::signal(SIGTERM, signal_handler);
+		Gateway().Start(true);
+		return EXIT_SUCCESS;
+	}
+
 	Server().SetConfig(cfg);
 
 	auto signal_handler = [](int signal) {
-		Server().Stop();
-		Output::Debug("Server: signal={}", signal);
+		Server().RequestStop();
 	};
 	std::signal(SIGINT, signal_handler);
 	std::signal(SIGTERM, signal_handler);
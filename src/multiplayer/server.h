@@ -19,12 +19,22 @@
 #ifndef EP_SERVER_H
 #define EP_SERVER_H
 
+#include <array>
 #include <memory>
 #include <map>
+#include <set>
+#include <tuple>
+#include <vector>
 #include <queue>
 #include <condition_variable>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <thread>
 #include "messages.h"
+#include "mpsc_queue.h"
+#include "server_metrics.h"
+#include "traffic_capture.h"
 #include "../game_config.h"
 
 class ServerListener;
@@ -33,11 +43,54 @@ class ServerSideClient;
 class ServerMain {
 	struct DataToSend;
 
-	bool running = false;
+	/**
+	 * Each shard has its own queue and sending thread
+	 *  Packets are assigned to a shard by their sender, so the packets of a
+	 *  client arrive in the order it sent them, whatever their visibility.
+	 *  The packets of different senders are not ordered between them.
+	 * The queue is lock-free, the mutex is only taken to wake up
+	 *  the sending thread when it is sleeping.
+	 */
+	struct DispatchShard {
+		MpscQueue<std::unique_ptr<DataToSend>> data_to_send_queue;
+		std::atomic<bool> sleeping{ false };
+		std::condition_variable data_to_send_queue_cv;
+		std::mutex mutex;
+
+		void Push(DataToSend* data_to_send);
+		std::unique_ptr<DataToSend> Pop();
+	};
+
+	std::atomic<bool> running{ false };
+	// set by RequestStop, checked by the loop of the calling thread of Start
+	std::atomic<bool> stop_requested{ false };
 	int client_id = 10;
+	int client_id_step = 1;
+	// ServerClusterShard, the clients are connected through a ClusterGateway
+	bool cluster_shard = false;
 	std::map<int, std::unique_ptr<ServerSideClient>> clients;
 
-	std::unique_ptr<ServerListener> server_listener;
+	// fan-out indexes: room_id -> clients, chat_crypt_key_hash -> clients
+	std::map<int, std::set<ServerSideClient*>> room_clients;
+	std::map<int, std::set<ServerSideClient*>> crypt_clients;
+
+	// clients by protocol (text, binary), only the protocols in use are encoded
+	std::array<std::atomic<int>, 2> protocol_clients{};
+
+	/**
+	 * Interest management (ServerInterestRadius > 0)
+	 *  (room_id, cell_x, cell_y) -> clients, a cell is radius tiles wide,
+	 *  so the 3x3 cells around a position cover the whole radius.
+	 */
+	using InterestCell = std::tuple<int, int, int>;
+	std::map<InterestCell, std::set<ServerSideClient*>> interest_grid;
+	int interest_radius{0};
+
+	InterestCell GetInterestCell(const int& room_id, const int& x, const int& y) const;
+	void ForEachClientNearUnlocked(const int& room_id, const int& x, const int& y,
+		const std::function<void(ServerSideClient&)>& callback);
+
+	std::vector<std::unique_ptr<ServerListener>> server_listeners;
 	std::unique_ptr<ServerListener> server_listener_2;
 
 	std::string addr_host;
@@ -45,25 +98,96 @@ class ServerMain {
 	uint16_t addr_port{ 6500 };
 	uint16_t addr_port_2{ 6500 };
 
-	std::queue<std::unique_ptr<DataToSend>> m_data_to_send_queue;
-	std::condition_variable m_data_to_send_queue_cv;
+	std::vector<std::shared_ptr<DispatchShard>> shards;
+	std::vector<std::thread> dispatch_threads;
 
-	std::mutex m_mutex;
+	// guards clients and the fan-out indexes
+	std::shared_mutex m_mutex;
 
 	Game_ConfigMultiplayer cfg;
 
+	DispatchShard& GetShard(const int& from_id);
+	void DispatchLoop(std::shared_ptr<DispatchShard> shard);
+
+	/**
+	 * Tick batching (ServerTickRate > 0)
+	 *  The state updates of a client are sent as one bulk per tick.
+	 */
+	int tick_rate{0};
+	std::thread tick_thread;
+	void TickLoop();
+	void Tick();
+
+	// wakes up the loops of the server threads when it is stopped
+	std::mutex stop_mutex;
+	std::condition_variable stop_cv;
+	// stops and joins the tick, metrics and dispatch threads, they take m_mutex
+	void StopThreads();
+
+	/**
+	 * Metrics, see RenderMetrics
+	 *  Served on ServerMetricsAddress and written to ServerMetricsFile
+	 *  every METRICS_FILE_INTERVAL.
+	 */
+	constexpr static int METRICS_FILE_INTERVAL_S = 10;
+	ServerMetrics metrics;
+	MetricsEndpoint metrics_endpoint;
+	std::thread metrics_file_thread;
+	void MetricsFileLoop();
+
+	// received frames, recorded while ServerCaptureFile is set
+	TrafficCapture capture;
+
 public:
+	~ServerMain();
+
 	void Start(bool wait_thread = false);
 	void Stop();
 
+	/**
+	 * For the signal handlers, only sets a flag
+	 *  With Start(true), the waiting thread calls Stop with the next timer
+	 *  tick of its loop, see ServerListener::OnTimer.
+	 */
+	void RequestStop() { stop_requested = true; }
+
 	void SetConfig(const Game_ConfigMultiplayer& _cfg);
 	Game_ConfigMultiplayer GetConfig() const;
 
 	void ForEachClient(const std::function<void(ServerSideClient&)>& callback);
+	void ForEachClientInRoom(const int& room_id,
+		const std::function<void(ServerSideClient&)>& callback);
 	void DeleteClient(const int& id);
+	void UpdateClientRoom(ServerSideClient* client,
+		const int& from_room_id, const int& to_room_id);
+	void UpdateClientChatCryptKeyHash(ServerSideClient* client,
+		const int& from_hash, const int& to_hash);
+	void UpdateClientProtocol(const bool& from_binary, const bool& to_binary);
+	bool IsProtocolUsed(const bool& binary) const;
+
+	bool IsClusterShard() const { return cluster_shard; }
+	// removes the relay connection of a gateway from the room and crypt indexes
+	void SetClientRelay(ServerSideClient* client);
+
+	ServerMetrics& GetMetrics() { return metrics; }
+	TrafficCapture& GetCapture() { return capture; }
+	// counters and the current gauges in the Prometheus text format
+	std::string RenderMetrics();
+
+	// 0 if the state updates are sent with every received frame
+	int GetTickRate() const { return tick_rate; }
+
+	// 0 if the interest management is disabled
+	int GetInterestRadius() const { return interest_radius; }
+	bool IsInInterestRadius(const int& x1, const int& y1, const int& x2, const int& y2) const;
+	void ForEachClientNear(const int& room_id, const int& x, const int& y,
+		const std::function<void(ServerSideClient&)>& callback);
+	// moves the client in the interest grid together with its position
+	void UpdateClientPosition(ServerSideClient* client, const int& to_x, const int& to_y);
 	void SendTo(const int& from_client_id, const int& to_client_id,
 		const Messages::VisibilityType& visibility, const std::string& data,
-		const bool& return_flag = false);
+		const std::string& data_bin, const bool& return_flag = false,
+		const bool& coalescible = false);
 };
 
 ServerMain& Server();
@@ -0,0 +1,174 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "server_metrics.h"
+#include "socket.h"
+#include "packet.h"
+#include "../output.h"
+#include <algorithm>
+
+using Multiplayer::Packet;
+
+/**
+ * ServerMetrics
+ */
+
+void ServerMetrics::WriteValue(std::string& out, std::string_view name, std::string_view labels,
+		uint64_t value) {
+	out += name;
+	if (!labels.empty()) {
+		out += '{';
+		out += labels;
+		out += '}';
+	}
+	out += ' ';
+	out += std::to_string(value);
+	out += '\n';
+}
+
+void ServerMetrics::WriteHelp(std::string& out, std::string_view name, std::string_view help,
+		std::string_view type) {
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void ServerMetrics::Histogram::Record(uint64_t us) {
+	size_t bucket = 0;
+	while (bucket < BUCKETS - 1 && us > (uint64_t(1) << bucket))
+		++bucket;
+	buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(us, std::memory_order_relaxed);
+}
+
+void ServerMetrics::Histogram::Write(std::string& out, std::string_view name,
+		std::string_view help) const {
+	WriteHelp(out, name, help, "histogram");
+	std::string bucket_name = std::string(name) + "_bucket";
+	uint64_t count = 0;
+	for (size_t i = 0; i < BUCKETS; ++i) {
+		count += buckets[i].load(std::memory_order_relaxed);
+		std::string le = i < BUCKETS - 1 ? std::to_string(uint64_t(1) << i) : "+Inf";
+		WriteValue(out, bucket_name, "le=\"" + le + "\"", count);
+	}
+	WriteValue(out, std::string(name) + "_sum", "", sum.load(std::memory_order_relaxed));
+	WriteValue(out, std::string(name) + "_count", "", count);
+}
+
+void ServerMetrics::PacketCounters::Write(std::string& out, std::string_view name,
+		std::string_view help) const {
+	std::string packets_name = std::string(name) + "_packets_total";
+	std::string bytes_name = std::string(name) + "_bytes_total";
+	WriteHelp(out, packets_name, help, "counter");
+	for (size_t id = 0; id < packets.size(); ++id) {
+		uint64_t value = packets[id].load(std::memory_order_relaxed);
+		if (value == 0)
+			continue;
+		std::string_view type = id == 0 ? "unknown" : Packet::GetPacketName(id);
+		WriteValue(out, packets_name, "type=\"" + std::string(type) + "\"", value);
+	}
+	WriteHelp(out, bytes_name, help, "counter");
+	for (size_t id = 0; id < bytes.size(); ++id) {
+		uint64_t value = bytes[id].load(std::memory_order_relaxed);
+		if (packets[id].load(std::memory_order_relaxed) == 0)
+			continue;
+		std::string_view type = id == 0 ? "unknown" : Packet::GetPacketName(id);
+		WriteValue(out, bytes_name, "type=\"" + std::string(type) + "\"", value);
+	}
+}
+
+void ServerMetrics::Write(std::string& out) const {
+	auto counter = [&out](std::string_view name, std::string_view help,
+			const std::atomic<uint64_t>& value) {
+		WriteHelp(out, name, help, "counter");
+		WriteValue(out, name, "", value.load(std::memory_order_relaxed));
+	};
+	counter("epmp_connections_total", "Accepted connections", connections_total);
+	counter("epmp_connections_rejected_total", "Connections rejected by ServerMaxUsers",
+		connections_rejected);
+	counter("epmp_send_queue_drops_total",
+		"Frames dropped because a send queue was full, the connection is closed",
+		send_queue_drops);
+	counter("epmp_coalesced_frames_total",
+		"State frames not sent to slow clients, the latest state follows later", coalesced_frames);
+	counter("epmp_frames_in_total", "Received frames", frames_in);
+	counter("epmp_bytes_in_total", "Received bytes, without the frame headers", bytes_in);
+	counter("epmp_frames_out_total", "Frames queued on the sockets", frames_out);
+	counter("epmp_bytes_out_total", "Bytes queued on the sockets, with the frame headers",
+		bytes_out);
+	packets_in.Write(out, "epmp_in", "Received messages by packet type");
+	packets_out.Write(out, "epmp_out",
+		"Messages encoded for sending by packet type, once for all the recipients");
+	fanout_latency.Write(out, "epmp_fanout_latency_us",
+		"Time from queueing a frame until it is queued on every recipient");
+	loop_lag.Write(out, "epmp_loop_lag_us", "Delay of a periodic timer on the event loops");
+}
+
+/**
+ * MetricsEndpoint
+ */
+
+MetricsEndpoint::MetricsEndpoint() {}
+
+MetricsEndpoint::~MetricsEndpoint() {}
+
+void MetricsEndpoint::Start(std::string_view host, uint16_t port,
+		std::function<std::string()> _render) {
+	render = std::move(_render);
+	listener.reset(new ServerListener(host, port));
+	listener->OnInfo = [](std::string_view m) { Output::Info("S: Metrics: {}", m); };
+	listener->OnWarning = [](std::string_view m) { Output::Warning("S: Metrics: {}", m); };
+	listener->OnConnection = [this](std::unique_ptr<Socket> socket) {
+		HandleConnection(std::move(socket));
+	};
+	listener->Start();
+}
+
+void MetricsEndpoint::Stop() {
+	if (listener)
+		listener->Stop();
+}
+
+void MetricsEndpoint::HandleConnection(std::unique_ptr<Socket> socket) {
+	// the close callbacks of these have finished in a previous iteration
+	clients.erase(std::remove_if(clients.begin(), clients.end(),
+		[](const auto& client) { return client->closed.load(); }), clients.end());
+
+	auto& client = clients.emplace_back(new Client());
+	Client* c = client.get();
+	c->socket = std::move(socket);
+	c->socket->SetReadTimeout(5000);
+	c->socket->OnInfo = [](std::string_view m) {};
+	c->socket->OnWarning = [](std::string_view m) { Output::Debug("S: Metrics: {}", m); };
+	c->socket->OnOpen = []() {};
+	c->socket->OnClose = [c]() { c->closed = true; };
+	c->socket->OnData = [](std::string_view data) {};
+	// any request gets the metrics, the request itself is not parsed
+	c->socket->OnRawData = [this, c](const char* data, const size_t size) {
+		if (c->answered)
+			return;
+		c->answered = true;
+		std::string body = render();
+		std::string response = "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\n"
+			"Connection: close\r\n\r\n";
+		response += body;
+		c->socket->SendRaw(response.data(), response.size());
+	};
+	c->socket->Open();
+}
@@ -0,0 +1,126 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_SERVER_METRICS_H
+#define EP_MULTIPLAYER_SERVER_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ServerListener;
+class Socket;
+
+/**
+ * Counters of the server, updated from any thread
+ *  Written in the Prometheus text format, the gauges (connections,
+ *  rooms, queues) are added by ServerMain::RenderMetrics.
+ */
+class ServerMetrics {
+public:
+	/**
+	 * Microseconds in power of two buckets: 1, 2, 4 ... 2^(BUCKETS-2), +Inf
+	 */
+	class Histogram {
+	public:
+		constexpr static size_t BUCKETS = 26;
+
+		void Record(uint64_t us);
+		void Write(std::string& out, std::string_view name, std::string_view help) const;
+
+	private:
+		std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+		std::atomic<uint64_t> sum{ 0 };
+	};
+
+	// messages and their bytes by packet id, 0 is an unknown packet
+	class PacketCounters {
+	public:
+		void Record(uint8_t id, size_t size) {
+			packets[id].fetch_add(1, std::memory_order_relaxed);
+			bytes[id].fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void Write(std::string& out, std::string_view name, std::string_view help) const;
+
+	private:
+		std::array<std::atomic<uint64_t>, 256> packets{};
+		std::array<std::atomic<uint64_t>, 256> bytes{};
+	};
+
+	std::atomic<uint64_t> connections_total{ 0 };
+	std::atomic<uint64_t> connections_rejected{ 0 };
+	// frames dropped by Socket::Send because the send queue was full
+	std::atomic<uint64_t> send_queue_drops{ 0 };
+	// state frames refused by slow clients, replaced by their latest state later
+	std::atomic<uint64_t> coalesced_frames{ 0 };
+	std::atomic<uint64_t> frames_in{ 0 };
+	std::atomic<uint64_t> bytes_in{ 0 };
+	std::atomic<uint64_t> frames_out{ 0 };
+	std::atomic<uint64_t> bytes_out{ 0 };
+
+	PacketCounters packets_in;
+	PacketCounters packets_out;
+
+	// from SendTo until the frame has been queued on every recipient
+	Histogram fanout_latency;
+	// delay of a timer on the event loops
+	Histogram loop_lag;
+
+	void Write(std::string& out) const;
+
+	static void WriteValue(std::string& out, std::string_view name, std::string_view labels,
+		uint64_t value);
+	static void WriteHelp(std::string& out, std::string_view name, std::string_view help,
+		std::string_view type);
+};
+
+/**
+ * Read-only HTTP endpoint for the metrics
+ *  Every request is answered with render() and the connection is closed
+ *  by the client, or by the read timeout.
+ */
+class MetricsEndpoint {
+public:
+	MetricsEndpoint();
+	~MetricsEndpoint();
+
+	void Start(std::string_view host, uint16_t port, std::function<std::string()> _render);
+	void Stop();
+
+private:
+	struct Client {
+		std::unique_ptr<Socket> socket;
+		bool answered = false;
+		std::atomic<bool> closed{ false };
+	};
+
+	std::function<std::string()> render;
+	std::unique_ptr<ServerListener> listener;
+	// loop thread only
+	std::vector<std::unique_ptr<Client>> clients;
+
+	void HandleConnection(std::unique_ptr<Socket> socket);
+};
+
+#endif
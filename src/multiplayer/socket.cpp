@@ -18,6 +18,8 @@
 
 #include <thread>
 #include <vector>
+#include <algorithm>
+#include <cerrno>
 #include "socket.h"
 #include "connection.h"
 #include "socks5.h"
@@ -98,81 +100,217 @@ void Socket::InitStream(uv_loop_t* loop) {
 	uv_async_init(loop, &async, [](uv_async_t *handle) {
 		auto async_data = static_cast<AsyncData*>(handle->data);
 		auto socket = async_data->socket;
-		std::lock_guard lock(socket->m_call_mutex);
-		while (!socket->m_request_queue.empty()) {
-			switch (socket->m_request_queue.front()) {
-			case AsyncCall::SEND:
-				if (!socket->is_sending &&
-						!socket->m_send_queue.empty()) {
-					socket->is_sending = true;
-					socket->InternalSend();
+		{
+			std::lock_guard lock(socket->m_call_mutex);
+			while (!socket->m_request_queue.empty()) {
+				switch (socket->m_request_queue.front()) {
+				case AsyncCall::OPEN:
+					socket->InternalOpen();
+					break;
+				case AsyncCall::CLOSE:
+					socket->InternalClose();
+					break;
 				}
-				break;
-			case AsyncCall::OPEN:
-				socket->InternalOpen();
-				break;
-			case AsyncCall::CLOSE:
-				socket->InternalClose();
-				break;
+				socket->m_request_queue.pop();
 			}
-			socket->m_request_queue.pop();
 		}
+		// cleared before draining, the frames pushed later request again
+		if (socket->send_requested.exchange(false) && !socket->is_sending &&
+				socket->is_initialized) {
+			socket->InternalSend();
+		}
+		socket->CheckDrain();
 	});
 	uv_tcp_init(loop, &stream);
 	read_timeout_req.data = this;
 	uv_timer_init(loop, &read_timeout_req);
+	send_requested = false;
+	queued_bytes = 0;
+	sending_bytes = 0;
+	congested = false;
+	compress = false;
+	deflater.reset();
+	inflater.reset();
 	is_initialized = true;
 }
 
-void Socket::SendRaw(const char* raw_buf, const size_t raw_size) {
-	std::lock_guard lock(m_call_mutex);
+Socket::Frame Socket::BuildFrame(std::string_view data) {
+	const uint16_t data_size = data.size();
+	const size_t final_size = HEAD_SIZE+data_size;
+	auto buf = std::make_shared<std::vector<char>>(final_size);
+	std::memcpy(buf->data(), &data_size, HEAD_SIZE);
+	std::memcpy(buf->data()+HEAD_SIZE, data.data(), data_size);
+	return buf;
+}
 
-	if (!is_initialized || m_send_queue.size() > 100)
-		return;
+void Socket::InternalOnData(const char* buf, const ssize_t num_bytes) {
+	std::string_view data(reinterpret_cast<const char*>(buf), num_bytes);
+	if (FrameCompression::IsCompressed(data)) {
+		if (!inflater)
+			inflater.reset(new FrameCompression::Inflater());
+		// the rest of the stream cannot be decompressed either
+		if (!inflater->Decompress(data, inflate_buf)) {
+			if (!uv_is_closing(reinterpret_cast<uv_handle_t*>(&stream))) {
+				OnWarning("Decompression failed");
+				InternalClose();
+			}
+			return;
+		}
+		data = inflate_buf;
+	}
+	OnData(data);
+}
 
-	auto buf = new std::vector<char>(raw_size);
-	std::memcpy(buf->data(), raw_buf, raw_size);
-	m_send_queue.emplace(buf);
+/**
+ * Replaces a frame with its compressed copy
+ *  Raw frames (SendRaw) are only sent before the compression is negotiated.
+ *  If the compression fails, the frames are sent uncompressed from now on,
+ *  the other side can still read them.
+ */
+Socket::Frame Socket::CompressFrame(const Frame& frame) {
+	std::string_view data(frame->data() + HEAD_SIZE, frame->size() - HEAD_SIZE);
+	if (data.empty() || data.size() > FrameCompression::MAX_INPUT_SIZE)
+		return frame;
+	if (!deflater)
+		deflater.reset(new FrameCompression::Deflater());
+	if (!deflater->Compress(data, compress_buf)) {
+		OnWarning("Compression failed, sending uncompressed");
+		compress = false;
+		return frame;
+	}
+	return BuildFrame(compress_buf);
+}
 
-	m_request_queue.push(AsyncCall::SEND);
-	uv_async_send(&async);
+void Socket::SendRaw(const char* raw_buf, const size_t raw_size) {
+	Send(std::make_shared<const std::vector<char>>(raw_buf, raw_buf+raw_size));
 }
 
 void Socket::Send(std::string_view data) {
-	std::lock_guard lock(m_call_mutex);
+	Send(BuildFrame(data));
+}
 
-	if (!is_initialized || m_send_queue.size() > 100)
-		return;
+bool Socket::Send(const Frame& frame, Priority priority) {
+	if (!is_initialized)
+		return false;
+
+	size_t queued = queued_bytes.load(std::memory_order_relaxed);
+	if (priority == Priority::COALESCIBLE && queued > LOW_WATERMARK) {
+		// the loop thread checks it after the wakeup
+		congested = true;
+		RequestSend();
+		return false;
+	}
+	if (queued > HIGH_WATERMARK) {
+		if (OnDrop)
+			OnDrop();
+		if (OnWarning)
+			OnWarning("The send queue is full, closing the connection");
+		Close();
+		return false;
+	}
 
-	const uint16_t data_size = data.size();
-	const uint16_t final_size = HEAD_SIZE+data_size;
-	auto buf = new std::vector<char>(final_size);
-	std::memcpy(buf->data(), &data_size, HEAD_SIZE);
-	std::memcpy(buf->data()+HEAD_SIZE, data.data(), data_size);
-	m_send_queue.emplace(buf);
+	queued_bytes.fetch_add(frame->size(), std::memory_order_relaxed);
+	m_send_queue.Push(frame);
+	RequestSend();
+	return true;
+}
 
-	m_request_queue.push(AsyncCall::SEND);
-	uv_async_send(&async);
+void Socket::RequestSend() {
+	if (!send_requested.exchange(true)) {
+		// the async handle must not be closed in the meantime
+		std::lock_guard lock(m_call_mutex);
+		if (is_initialized)
+			uv_async_send(&async);
+	}
+}
+
+// loop thread only
+void Socket::ReleaseQueued(size_t bytes) {
+	queued_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+	CheckDrain();
+}
+
+// loop thread only
+void Socket::CheckDrain() {
+	if (!congested || queued_bytes.load(std::memory_order_relaxed) > LOW_WATERMARK)
+		return;
+	congested = false;
+	if (OnDrain && is_initialized)
+		OnDrain();
 }
 
+/**
+ * Must be called on the loop thread with no write in progress
+ *  The queued frames are coalesced into one vectored write. When the
+ *  kernel accepts all of them right away (uv_try_write), no write request
+ *  and no extra loop iteration are needed.
+ */
 void Socket::InternalSend() {
-	const auto& vec_buf = m_send_queue.front();
-	uv_buf_t buf = uv_buf_init(vec_buf->data(), vec_buf->size());
-	uv_write(&send_req, reinterpret_cast<uv_stream_t*>(&stream), &buf, 1,
-			[](uv_write_t* req, int err) {
-		auto socket = static_cast<Socket*>(req->data);
-		if (err) {
-			socket->OnWarning(std::string("Writing to the stream failed: ").append(uv_strerror(err)));
+	auto uv_stream = reinterpret_cast<uv_stream_t*>(&stream);
+	std::vector<uv_buf_t> bufs;
+	bufs.reserve(std::min(m_send_queue.Size(), WRITE_BUFS_MAX));
+	Frame frame;
+	while (m_send_queue.Pop(frame)) {
+		m_sending.clear();
+		bufs.clear();
+		size_t bytes = 0;
+		sending_bytes = 0;
+		// the batch ends with the frame that reaches WRITE_SIZE_MAX
+		do {
+			sending_bytes += frame->size();
+			if (compress)
+				frame = CompressFrame(frame);
+			// uv_write does not modify the buffer, the frame stays immutable
+			bufs.push_back(uv_buf_init(const_cast<char*>(frame->data()), frame->size()));
+			bytes += frame->size();
+			m_sending.push_back(std::move(frame));
+		} while (bufs.size() < WRITE_BUFS_MAX && bytes < WRITE_SIZE_MAX &&
+			m_send_queue.Pop(frame));
+
+		int written = uv_try_write(uv_stream, bufs.data(), bufs.size());
+		if (written == static_cast<int>(bytes)) {
+			ReleaseQueued(sending_bytes);
+			continue;
 		}
-		if (socket->is_sending) {
-			socket->m_send_queue.pop();
-			if (socket->m_send_queue.empty()) {
+
+		// skip what has been written, leave the rest to uv_write
+		// (UV_EAGAIN and the other errors write everything again)
+		auto it = bufs.begin();
+		if (written > 0) {
+			size_t remaining = written;
+			while (remaining >= it->len) {
+				remaining -= it->len;
+				++it;
+			}
+			it->base += remaining;
+			it->len -= remaining;
+		}
+
+		is_sending = true;
+		int err = uv_write(&send_req, uv_stream, &*it, std::distance(it, bufs.end()),
+				[](uv_write_t* req, int err) {
+			auto socket = static_cast<Socket*>(req->data);
+			if (err) {
+				socket->OnWarning(std::string("Writing to the stream failed: ").append(uv_strerror(err)));
+			}
+			if (socket->is_sending) {
 				socket->is_sending = false;
-			} else {
-				socket->InternalSend();
+				socket->m_sending.clear();
+				socket->ReleaseQueued(socket->sending_bytes);
+				if (!socket->m_send_queue.Empty()) {
+					socket->InternalSend();
+				}
 			}
+		});
+		if (err) {
+			OnWarning(std::string("Writing to the stream failed: ").append(uv_strerror(err)));
+			is_sending = false;
+			m_sending.clear();
+			ReleaseQueued(sending_bytes);
 		}
-	});
+		return;
+	}
+	m_sending.clear();
 }
 
 void Socket::StreamRead::Handle(char *buf, ssize_t buf_used) {
@@ -307,10 +445,17 @@ void Socket::InternalClose() {
 	uv_close(reinterpret_cast<uv_handle_t*>(&stream), [](uv_handle_t* handle) {
 		auto socket = static_cast<Socket*>(handle->data);
 		uv_close(reinterpret_cast<uv_handle_t*>(&socket->read_timeout_req), nullptr);
-		uv_close(reinterpret_cast<uv_handle_t*>(&socket->async), nullptr);
-		socket->is_initialized = false;
-		socket->m_send_queue = decltype(m_send_queue){};
+		{
+			std::lock_guard lock(socket->m_call_mutex);
+			socket->is_initialized = false;
+			uv_close(reinterpret_cast<uv_handle_t*>(&socket->async), nullptr);
+		}
+		Frame frame;
+		while (socket->m_send_queue.Pop(frame)) {}
+		socket->m_sending.clear();
 		socket->is_sending = false;
+		socket->queued_bytes = 0;
+		socket->congested = false;
 		socket->OnClose();
 	});
 }
@@ -458,6 +603,37 @@ void ConnectorSocket::Disconnect() {
 	Close();
 }
 
+/**
+ * LinkSocket
+ */
+
+void LinkSocket::Connect(uv_loop_t* loop, std::string_view host, const uint16_t port) {
+	InitStream(loop);
+	struct sockaddr_storage addr;
+	int err = Resolve(std::string(host), port, loop, &addr);
+	if (err < 0) {
+		OnWarning(std::string("Address Resolve failed: ").append(uv_strerror(err)));
+		Close();
+		return;
+	}
+	connect_req.data = this;
+	err = uv_tcp_connect(&connect_req, GetStream(), reinterpret_cast<struct sockaddr*>(&addr),
+			[](uv_connect_t *connect_req, int status) {
+		auto socket = static_cast<LinkSocket*>(connect_req->data);
+		if (status < 0) {
+			if (status != UV_ECANCELED)
+				socket->OnWarning(std::string("Connection failed: ").append(uv_strerror(status)));
+			socket->Close();
+			return;
+		}
+		socket->Open();
+	});
+	if (err) {
+		OnWarning(std::string("Connection failed: ").append(uv_strerror(err)));
+		Close();
+	}
+}
+
 /**
  * ServerListener
  */
@@ -488,12 +664,39 @@ void ServerListener::Start(bool wait_thread) {
 
 		uv_tcp_t listener;
 		listener.data = this;
+		bool listener_initialized = false;
+
+		if (OnLoopLag) {
+			lag_timer.data = this;
+			uv_timer_init(&loop, &lag_timer);
+			lag_expected_ns = uv_hrtime() + LAG_PROBE_INTERVAL_MS * 1000000;
+			uv_timer_start(&lag_timer, [](uv_timer_t* handle) {
+				auto server_listener = static_cast<ServerListener*>(handle->data);
+				uint64_t now = uv_hrtime();
+				uint64_t lag = now > server_listener->lag_expected_ns ?
+					now - server_listener->lag_expected_ns : 0;
+				server_listener->lag_expected_ns = now + LAG_PROBE_INTERVAL_MS * 1000000;
+				server_listener->OnLoopLag(lag / 1000);
+			}, LAG_PROBE_INTERVAL_MS, LAG_PROBE_INTERVAL_MS);
+		}
 
-		uv_tcp_init(&loop, &listener);
+		if (OnTimer) {
+			timer.data = this;
+			uv_timer_init(&loop, &timer);
+			uv_timer_start(&timer, [](uv_timer_t* handle) {
+				auto server_listener = static_cast<ServerListener*>(handle->data);
+				server_listener->OnTimer(handle->loop);
+			}, 0, TIMER_INTERVAL_MS);
+		}
 
-		auto Cleanup = [this, &listener]() {
+		auto Cleanup = [this, &listener, &listener_initialized]() {
 			uv_close(reinterpret_cast<uv_handle_t*>(&async), nullptr);
-			uv_close(reinterpret_cast<uv_handle_t*>(&listener), nullptr);
+			if (OnLoopLag)
+				uv_close(reinterpret_cast<uv_handle_t*>(&lag_timer), nullptr);
+			if (OnTimer)
+				uv_close(reinterpret_cast<uv_handle_t*>(&timer), nullptr);
+			if (listener_initialized)
+				uv_close(reinterpret_cast<uv_handle_t*>(&listener), nullptr);
 			uv_run(&loop, UV_RUN_DEFAULT);
 			int err = uv_loop_close(&loop);
 			if (err) {
@@ -510,6 +713,30 @@ void ServerListener::Start(bool wait_thread) {
 			return;
 		}
 
+		// the socket must exist before bind to set SO_REUSEPORT
+		err = uv_tcp_init_ex(&loop, &listener, addr.ss_family);
+		if (err) {
+			OnWarning(std::string("Listener initialization failed: ").append(uv_strerror(err)));
+			Cleanup();
+			return;
+		}
+		listener_initialized = true;
+
+		if (reuse_port) {
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+			uv_os_fd_t fd;
+			int on = 1;
+			err = uv_fileno(reinterpret_cast<uv_handle_t*>(&listener), &fd);
+			if (!err && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+				err = -errno;
+			if (err) {
+				OnWarning(std::string("Setting SO_REUSEPORT failed: ").append(uv_strerror(err)));
+				Cleanup();
+				return;
+			}
+#endif
+		}
+
 		err = uv_tcp_bind(&listener, reinterpret_cast<struct sockaddr*>(&addr), 0);
 		if (err) {
 			OnWarning(std::string("Binding failed: ").append(uv_strerror(err)));
@@ -556,3 +783,11 @@ void ServerListener::Stop() {
 	async_data.stop_flag = true;
 	uv_async_send(&async);
 }
+
+bool ServerListener::IsReusePortSupported() {
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+	return true;
+#else
+	return false;
+#endif
+}
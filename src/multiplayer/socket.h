@@ -23,9 +23,13 @@
 #include <string>
 #include <cstring>
 #include <memory>
+#include <vector>
 #include <queue>
 #include <mutex>
+#include <atomic>
 #include "uv.h"
+#include "mpsc_queue.h"
+#include "compression.h"
 
 /**
  * Socket
@@ -35,11 +39,38 @@ class Socket {
 public:
 	constexpr static size_t BUFFER_SIZE = 4096;
 	constexpr static size_t HEAD_SIZE = sizeof(uint16_t);
+	// limits of the frames coalesced into a single write
+	constexpr static size_t WRITE_BUFS_MAX = 64;
+	constexpr static size_t WRITE_SIZE_MAX = 64 * 1024;
+
+	/**
+	 * Limits of the send queue in bytes
+	 *  Above LOW_WATERMARK coalescible frames are refused: the sender keeps
+	 *  track of what it could not send and gets OnDrain once the queue is
+	 *  below LOW_WATERMARK again, to send the latest state instead.
+	 *  Above HIGH_WATERMARK the peer cannot even keep up with the reliable
+	 *  frames, the frame is dropped and the connection is closed.
+	 */
+	constexpr static size_t LOW_WATERMARK = 64 * 1024;
+	constexpr static size_t HIGH_WATERMARK = 512 * 1024;
+
+	enum class Priority {
+		RELIABLE,
+		// state that is superseded by the next update of the same sender
+		COALESCIBLE,
+	};
+
+	/**
+	 * Header + data, immutable once built
+	 *  The same frame can be queued on many sockets, it is released
+	 *  after the last write callback has fired.
+	 */
+	using Frame = std::shared_ptr<const std::vector<char>>;
+	static Frame BuildFrame(std::string_view data);
 
 	Socket();
 
 	enum class AsyncCall {
-		SEND,
 		OPEN,
 		CLOSE,
 	};
@@ -48,6 +79,10 @@ public:
 	std::function<void()> OnClose;
 	std::function<void(const char*, const size_t)> OnRawData;
 	std::function<void(std::string_view data)> OnData;
+	// a frame was dropped because the send queue was full, called by the sending thread
+	std::function<void()> OnDrop;
+	// the send queue is below LOW_WATERMARK after refusing frames, called on the loop thread
+	std::function<void()> OnDrain;
 
 	void InitStream(uv_loop_t* loop);
 
@@ -61,18 +96,30 @@ public:
 
 	void SendRaw(const char*, const size_t);
 	void Send(std::string_view data);
+	/**
+	 * Queues a frame, thread-safe
+	 *  @return false if the frame was refused or dropped
+	 */
+	bool Send(const Frame& frame, Priority priority = Priority::RELIABLE);
 	void Open();
 	void Close();
 
+	/**
+	 * Compresses the frames that are written from now on
+	 *  Received frames are decompressed whenever they are marked,
+	 *  see FrameCompression. Reset by InitStream.
+	 */
+	void SetCompression(bool enabled) {
+		compress = enabled;
+	}
+
 	std::function<void(std::string_view data)> OnInfo;
 	std::function<void(std::string_view data)> OnWarning;
 
 private:
-	void InternalOnData(const char* buf, const ssize_t num_bytes) {
-		std::string_view data(reinterpret_cast<const char*>(buf), num_bytes);
-		OnData(data);
-	}
+	void InternalOnData(const char* buf, const ssize_t num_bytes);
 
+	// guards the open and close requests, sending does not need it
 	std::mutex m_call_mutex;
 	std::queue<AsyncCall> m_request_queue;
 
@@ -87,11 +134,42 @@ private:
 
 	uint64_t read_timeout_ms = 0;
 
-	// use queue: buffers must remain valid while sending
-	std::queue<std::unique_ptr<std::vector<char>>> m_send_queue;
+	/**
+	 * Any thread pushes, the loop thread writes
+	 *  Only the first frame after a wakeup signals the loop (send_requested),
+	 *  the others are picked up by the same write.
+	 */
+	MpscQueue<Frame> m_send_queue;
+	std::atomic<bool> send_requested{ false };
+	// frames of the write in progress, loop thread only
+	std::vector<Frame> m_sending;
 	bool is_sending = false;
 
-	bool is_initialized = false;
+	// queued and not yet written, as they were queued (before the compression)
+	std::atomic<size_t> queued_bytes{ 0 };
+	// bytes of m_sending, loop thread only
+	size_t sending_bytes = 0;
+	// a coalescible frame was refused, OnDrain is due
+	std::atomic<bool> congested{ false };
+
+	void RequestSend();
+	void ReleaseQueued(size_t bytes);
+	void CheckDrain();
+
+	std::atomic<bool> is_initialized{ false };
+
+	/**
+	 * Stream compression, loop thread only except the flag
+	 *  The frames are compressed when they are written, so the shared
+	 *  frames stay uncompressed and the stream keeps the order of the writes.
+	 */
+	std::atomic<bool> compress{ false };
+	std::unique_ptr<FrameCompression::Deflater> deflater;
+	std::unique_ptr<FrameCompression::Inflater> inflater;
+	std::string compress_buf;
+	std::string inflate_buf;
+
+	Frame CompressFrame(const Frame& frame);
 
 	void InternalOpen();
 	void InternalClose();
@@ -149,6 +227,21 @@ public:
 	void Disconnect();
 };
 
+/**
+ * LinkSocket
+ *  Outgoing connection on the loop of the caller, instead of a thread of
+ *  its own like ConnectorSocket. Connect must be called on the loop thread,
+ *  the address is resolved synchronously (meant for IP addresses).
+ *  OnOpen is called once connected, a failed connection only calls OnClose.
+ */
+
+class LinkSocket : public Socket {
+	uv_connect_t connect_req;
+
+public:
+	void Connect(uv_loop_t* loop, std::string_view host, const uint16_t port);
+};
+
 /**
  * ServerListener
  */
@@ -164,17 +257,50 @@ class ServerListener {
 	std::string addr_host;
 	uint16_t addr_port;
 
+	bool reuse_port = false;
 	bool is_running = false;
 
+	// loop lag probe, loop thread only
+	constexpr static uint64_t LAG_PROBE_INTERVAL_MS = 100;
+	uv_timer_t lag_timer;
+	uint64_t lag_expected_ns = 0;
+
+	uv_timer_t timer;
+
 public:
 	ServerListener(std::string_view _host, const uint16_t _port)
 		: addr_host(_host), addr_port(_port) {}
 
+	/**
+	 * Multiple listeners (one loop each) can bind to the same address,
+	 *  the kernel balances the incoming connections between them.
+	 * Must call before Start
+	 */
+	void SetReusePort(bool _reuse_port) {
+		reuse_port = _reuse_port;
+	}
+
+	static bool IsReusePortSupported();
+
 	void Start(bool wait_thread = false);
 	void Stop();
 
 	std::function<void(std::unique_ptr<Socket>)> OnConnection;
 
+	/**
+	 * Called on the loop thread with how late a periodic timer fired
+	 *  Must set before Start, the probe is only started if set.
+	 */
+	std::function<void(uint64_t lag_us)> OnLoopLag;
+
+	/**
+	 * Called on the loop thread when the loop starts, then every TIMER_INTERVAL_MS
+	 *  For the work that has to run on the loop, e.g. outgoing connections.
+	 *  Must set before Start.
+	 */
+	constexpr static uint64_t TIMER_INTERVAL_MS = 1000;
+	std::function<void(uv_loop_t* loop)> OnTimer;
+
 	std::function<void(std::string_view data)> OnInfo;
 	std::function<void(std::string_view data)> OnWarning;
 };
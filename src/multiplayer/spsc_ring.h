@@ -0,0 +1,110 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_SPSC_RING_H
+#define EP_MULTIPLAYER_SPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+/**
+ * Lock-free single-producer single-consumer ring of frames
+ *  The producer copies each frame behind a 4-byte size, the consumer
+ *  reads them in place and releases the space after each frame.
+ *  A frame never wraps around: the rest of the buffer is skipped
+ *  with a padding mark instead.
+ */
+class SpscFrameRing {
+	constexpr static uint32_t PADDING = UINT32_MAX;
+	constexpr static size_t HEAD_SIZE = sizeof(uint32_t);
+
+	std::unique_ptr<char[]> buffer;
+	size_t capacity;
+
+	// total bytes written and read, the positions are taken modulo capacity
+	std::atomic<uint64_t> head{ 0 };
+	std::atomic<uint64_t> tail{ 0 };
+
+public:
+	SpscFrameRing(size_t _capacity)
+		: buffer(new char[_capacity]), capacity(_capacity) {}
+
+	SpscFrameRing(const SpscFrameRing&) = delete;
+	SpscFrameRing& operator=(const SpscFrameRing&) = delete;
+
+	/**
+	 * Producer only
+	 *  @return false if there is not enough free space, nothing is written
+	 */
+	bool TryPush(std::string_view frame) {
+		const size_t need = HEAD_SIZE + frame.size();
+		uint64_t h = head.load(std::memory_order_relaxed);
+		const uint64_t free_space = capacity - (h - tail.load(std::memory_order_acquire));
+		size_t pos = h % capacity;
+		const size_t contiguous = capacity - pos;
+		// skip the end of the buffer
+		const size_t skip = contiguous < need ? contiguous : 0;
+		if (skip + need > free_space)
+			return false;
+		if (skip > 0) {
+			if (skip >= HEAD_SIZE)
+				std::memcpy(buffer.get() + pos, &PADDING, HEAD_SIZE);
+			h += skip;
+			pos = 0;
+		}
+		const uint32_t size = frame.size();
+		std::memcpy(buffer.get() + pos, &size, HEAD_SIZE);
+		std::memcpy(buffer.get() + pos + HEAD_SIZE, frame.data(), frame.size());
+		head.store(h + need, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Consumer only
+	 *  Calls f for every frame pushed before the call. The view is valid
+	 *  until f returns.
+	 */
+	template<typename F>
+	void Drain(F&& f) {
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		const uint64_t h = head.load(std::memory_order_acquire);
+		while (t < h) {
+			const size_t pos = t % capacity;
+			const size_t contiguous = capacity - pos;
+			uint32_t size = PADDING;
+			if (contiguous >= HEAD_SIZE)
+				std::memcpy(&size, buffer.get() + pos, HEAD_SIZE);
+			if (size == PADDING) {
+				t += contiguous;
+			} else {
+				f(std::string_view(buffer.get() + pos + HEAD_SIZE, size));
+				t += HEAD_SIZE + size;
+			}
+			tail.store(t, std::memory_order_release);
+		}
+	}
+
+	bool Empty() const {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+};
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_SYNC_TABLES_H
+#define EP_MULTIPLAYER_SYNC_TABLES_H
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Set of switch, variable, event or animation ids
+ *  The ids of a game are small, they are kept in a bitset. Larger ids
+ *  (e.g. the special variables 10000+) fall back to a hash set, so that
+ *  the server cannot make the bitset grow without bound.
+ */
+class SyncIdSet {
+public:
+	constexpr static int DENSE_LIMIT = 1 << 16;
+
+	void Add(int id) {
+		if (id >= 0 && id < DENSE_LIMIT) {
+			if (static_cast<size_t>(id) >= dense.size())
+				dense.resize(id + 1);
+			dense[id] = true;
+		} else {
+			sparse.insert(id);
+		}
+	}
+
+	bool Contains(int id) const {
+		if (id >= 0 && id < DENSE_LIMIT)
+			return static_cast<size_t>(id) < dense.size() && dense[id];
+		return !sparse.empty() && sparse.count(id) > 0;
+	}
+
+	void Clear() {
+		dense.clear();
+		sparse.clear();
+	}
+
+private:
+	std::vector<bool> dense;
+	std::unordered_set<int> sparse;
+};
+
+/**
+ * Trie of the picture name prefixes
+ *  A name is matched in one pass over its characters, whatever the number
+ *  of prefixes. The characters of the name are lowercased while matching,
+ *  the prefixes are stored as they are.
+ */
+class SyncPrefixTrie {
+public:
+	SyncPrefixTrie() : nodes(1) {}
+
+	void Add(std::string_view prefix) {
+		uint32_t node = 0;
+		for (unsigned char c : prefix) {
+			uint32_t next = Find(node, c);
+			if (next == 0) {
+				next = nodes.size();
+				nodes[node].children.emplace_back(c, next);
+				nodes.emplace_back();
+			}
+			node = next;
+		}
+		if (!nodes[node].terminal)
+			++size;
+		nodes[node].terminal = true;
+	}
+
+	bool MatchesLower(std::string_view name) const {
+		uint32_t node = 0;
+		if (nodes[node].terminal)
+			return true;
+		for (unsigned char c : name) {
+			node = Find(node, static_cast<unsigned char>(std::tolower(c)));
+			if (node == 0)
+				return false;
+			if (nodes[node].terminal)
+				return true;
+		}
+		return false;
+	}
+
+	size_t Size() const {
+		return size;
+	}
+
+	void Clear() {
+		nodes.assign(1, Node());
+		size = 0;
+	}
+
+private:
+	struct Node {
+		// few children per node, a vector is faster than a map here
+		std::vector<std::pair<unsigned char, uint32_t>> children;
+		bool terminal = false;
+	};
+
+	// 0 if not found, the root is never a child
+	uint32_t Find(uint32_t node, unsigned char c) const {
+		for (const auto& child : nodes[node].children) {
+			if (child.first == c)
+				return child.second;
+		}
+		return 0;
+	}
+
+	std::vector<Node> nodes;
+	size_t size = 0;
+};
+
+#endif
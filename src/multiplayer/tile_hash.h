@@ -0,0 +1,69 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_TILE_HASH_H
+#define EP_MULTIPLAYER_TILE_HASH_H
+
+#include <cstdint>
+#include <unordered_map>
+
+/**
+ * Spatial hash of the remote players: {type, x, y} => number of players
+ *  Several players can stand on the same tile, each one is removed
+ *  from the tile it was added to.
+ */
+class TileHash {
+public:
+	void Add(int type, int x, int y) {
+		++counts[Key(type, x, y)];
+	}
+
+	void Remove(int type, int x, int y) {
+		auto it = counts.find(Key(type, x, y));
+		if (it == counts.end())
+			return;
+		if (--it->second == 0)
+			counts.erase(it);
+	}
+
+	void Move(int type, int from_x, int from_y, int to_x, int to_y) {
+		if (from_x == to_x && from_y == to_y)
+			return;
+		Remove(type, from_x, from_y);
+		Add(type, to_x, to_y);
+	}
+
+	bool Contains(int type, int x, int y) const {
+		return counts.find(Key(type, x, y)) != counts.end();
+	}
+
+	void Clear() {
+		counts.clear();
+	}
+
+private:
+	static uint64_t Key(int type, int x, int y) {
+		return static_cast<uint64_t>(static_cast<uint8_t>(type)) << 32 |
+			static_cast<uint64_t>(static_cast<uint16_t>(x)) << 16 |
+			static_cast<uint16_t>(y);
+	}
+
+	std::unordered_map<uint64_t, int> counts;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "traffic_capture.h"
+#include <iterator>
+
+namespace {
+	void AppendVarint(std::string& out, uint64_t value) {
+		while (value >= 0x80) {
+			out += static_cast<char>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += static_cast<char>(value);
+	}
+
+	bool ReadVarint(std::string_view data, size_t& pos, uint64_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (pos >= data.size())
+				return false;
+			uint8_t byte = data[pos++];
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+}
+
+TrafficCapture::~TrafficCapture() {
+	Close();
+}
+
+bool TrafficCapture::Open(const std::string& path) {
+	std::lock_guard lock(m_mutex);
+	if (is_open)
+		return true;
+	file.open(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write(MAGIC.data(), MAGIC.size());
+	last_time = std::chrono::steady_clock::now();
+	connection_count = 0;
+	is_open = true;
+	return true;
+}
+
+void TrafficCapture::Close() {
+	std::lock_guard lock(m_mutex);
+	if (!is_open)
+		return;
+	is_open = false;
+	file.close();
+}
+
+uint32_t TrafficCapture::RecordOpen() {
+	if (!IsOpen())
+		return 0;
+	std::lock_guard lock(m_mutex);
+	if (!is_open)
+		return 0;
+	uint32_t connection = ++connection_count;
+	Write(Kind::OPEN, connection, "");
+	return connection;
+}
+
+void TrafficCapture::RecordData(uint32_t connection, std::string_view data) {
+	if (connection == 0 || !IsOpen())
+		return;
+	std::lock_guard lock(m_mutex);
+	if (is_open)
+		Write(Kind::DATA, connection, data);
+}
+
+void TrafficCapture::RecordClose(uint32_t connection) {
+	if (connection == 0 || !IsOpen())
+		return;
+	std::lock_guard lock(m_mutex);
+	if (!is_open)
+		return;
+	Write(Kind::CLOSE, connection, "");
+	// keep the file readable up to here if the server is killed
+	file.flush();
+}
+
+void TrafficCapture::Write(Kind kind, uint32_t connection, std::string_view data) {
+	// taken under the lock, so the deltas are never negative
+	auto now = std::chrono::steady_clock::now();
+	uint64_t delta_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		now - last_time).count();
+	last_time = now;
+
+	buf.clear();
+	buf += static_cast<char>(kind);
+	AppendVarint(buf, connection);
+	AppendVarint(buf, delta_us);
+	if (kind == Kind::DATA) {
+		AppendVarint(buf, data.size());
+		buf += data;
+	}
+	file.write(buf.data(), buf.size());
+}
+
+bool TrafficCapture::Read(const std::string& path, std::vector<Record>& records,
+		std::string& error) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		error = "Cannot open " + path;
+		return false;
+	}
+	std::string content{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+	std::string_view data = content;
+	if (data.substr(0, MAGIC.size()) != MAGIC) {
+		error = path + " is not a capture";
+		return false;
+	}
+
+	records.clear();
+	size_t pos = MAGIC.size();
+	uint64_t time_us = 0;
+	while (pos < data.size()) {
+		Record record;
+		uint8_t kind = data[pos++];
+		if (kind > static_cast<uint8_t>(Kind::CLOSE)) {
+			error = "Unknown record at offset " + std::to_string(pos - 1);
+			return false;
+		}
+		record.kind = static_cast<Kind>(kind);
+		uint64_t connection, delta_us, size = 0;
+		if (!ReadVarint(data, pos, connection) || !ReadVarint(data, pos, delta_us))
+			break;
+		if (record.kind == Kind::DATA) {
+			if (!ReadVarint(data, pos, size) || size > data.size() - pos)
+				break;
+			record.data = data.substr(pos, size);
+			pos += size;
+		}
+		time_us += delta_us;
+		record.connection = connection;
+		record.time_us = time_us;
+		records.push_back(std::move(record));
+	}
+	return true;
+}
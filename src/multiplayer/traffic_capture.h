@@ -0,0 +1,98 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef EP_MULTIPLAYER_TRAFFIC_CAPTURE_H
+#define EP_MULTIPLAYER_TRAFFIC_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Recording of the frames received by the server (ServerCaptureFile)
+ *  The frames are recorded as the clients sent them, after the
+ *  decompression, so that a capture can be replayed with or without
+ *  compression (see easyrpg-player-replay).
+ *
+ * File format:
+ *  MAGIC, then records until the end of the file:
+ *   kind (1 byte), connection (varint), microseconds since the previous
+ *   record (varint), and for DATA the size (varint) and the frame.
+ *  Connections are numbered from 1 in the order they were opened.
+ */
+class TrafficCapture {
+public:
+	constexpr static std::string_view MAGIC{ "EPMPCAP1" };
+
+	enum class Kind : uint8_t {
+		OPEN = 0,
+		DATA = 1,
+		CLOSE = 2,
+	};
+
+	struct Record {
+		Kind kind;
+		uint32_t connection;
+		// since the start of the capture
+		uint64_t time_us;
+		std::string data;
+	};
+
+	~TrafficCapture();
+
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const {
+		return is_open.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Thread-safe, do nothing if the capture is not open
+	 *  @return the connection number for RecordData and RecordClose
+	 */
+	uint32_t RecordOpen();
+	void RecordData(uint32_t connection, std::string_view data);
+	void RecordClose(uint32_t connection);
+
+	/**
+	 * Reads a whole capture
+	 *  A record cut off at the end (e.g. the server was killed) is ignored.
+	 *  @return false if the file cannot be read or is not a capture
+	 */
+	static bool Read(const std::string& path, std::vector<Record>& records, std::string& error);
+
+private:
+	std::atomic<bool> is_open{ false };
+
+	std::mutex m_mutex;
+	std::ofstream file;
+	std::chrono::steady_clock::time_point last_time;
+	uint32_t connection_count = 0;
+	std::string buf;
+
+	// m_mutex must be held
+	void Write(Kind kind, uint32_t connection, std::string_view data);
+};
+
+#endif
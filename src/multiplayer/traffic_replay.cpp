@@ -0,0 +1,269 @@
+/*
+ * EPMP
+ * See: docs/LICENSE-EPMP.txt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <getopt.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "connection.h"
+#include "socket.h"
+#include "traffic_capture.h"
+#include "../output.h"
+
+/**
+ * easyrpg-player-replay, replays a capture of ServerCaptureFile
+ *  Every captured connection becomes a synthetic client that connects,
+ *  sends its frames and disconnects at the recorded times, divided by the
+ *  speed. All the clients share one loop, the frames of the server are
+ *  counted and discarded.
+ *  The frames are sent uncompressed, the server decompresses only the
+ *  marked frames, and the compressed frames of the server are inflated
+ *  as usual, so captures replay the same with or without compression.
+ */
+
+namespace {
+	struct ReplayClient {
+		LinkSocket socket;
+		bool open = false;
+		bool closed = false;
+		// sent before the connection was established
+		std::vector<std::string> pending;
+	};
+
+	struct Stats {
+		uint64_t connections = 0;
+		uint64_t failed = 0;
+		uint64_t frames_out = 0;
+		uint64_t bytes_out = 0;
+		uint64_t frames_in = 0;
+		uint64_t bytes_in = 0;
+		// how late the records were sent compared to the scaled capture
+		uint64_t max_late_us = 0;
+	};
+
+	class Replay {
+	public:
+		// time to receive the last frames of the server before closing
+		constexpr static uint64_t DRAIN_MS = 1000;
+
+		std::vector<TrafficCapture::Record> records;
+		std::string host;
+		uint16_t port{ 6500 };
+		double speed = 1.0;
+
+		int Run() {
+			int err = uv_loop_init(&loop);
+			if (err < 0) {
+				Output::Warning("Replay: Loop initialization failed: {}", uv_strerror(err));
+				return EXIT_FAILURE;
+			}
+			timer.data = this;
+			uv_timer_init(&loop, &timer);
+			uv_update_time(&loop);
+			start_ms = uv_now(&loop);
+			Schedule();
+			uv_run(&loop, UV_RUN_DEFAULT);
+			uv_loop_close(&loop);
+
+			double elapsed_s = (end_ms - start_ms) / 1000.0;
+			Output::Info("Replay: {} records in {:.2f} s, {} connections ({} failed)",
+				records.size(), elapsed_s, stats.connections, stats.failed);
+			Output::Info("Replay: sent {} frames / {} bytes, received {} frames / {} bytes",
+				stats.frames_out, stats.bytes_out, stats.frames_in, stats.bytes_in);
+			Output::Info("Replay: at most {:.1f} ms behind the capture", stats.max_late_us / 1000.0);
+			return EXIT_SUCCESS;
+		}
+
+	private:
+		uv_loop_t loop;
+		uv_timer_t timer;
+		uint64_t start_ms = 0;
+		uint64_t end_ms = 0;
+		size_t next = 0;
+		bool draining = false;
+
+		std::map<uint32_t, std::unique_ptr<ReplayClient>> clients;
+		Stats stats;
+
+		uint64_t ScaledTimeMs(const TrafficCapture::Record& record) const {
+			return static_cast<uint64_t>(record.time_us / speed / 1000.0);
+		}
+
+		void Schedule() {
+			uint64_t timeout = 0;
+			if (next < records.size()) {
+				uint64_t due_ms = start_ms + ScaledTimeMs(records[next]);
+				uint64_t now_ms = uv_now(&loop);
+				timeout = due_ms > now_ms ? due_ms - now_ms : 0;
+			} else {
+				draining = true;
+				timeout = DRAIN_MS;
+			}
+			uv_timer_start(&timer, [](uv_timer_t* handle) {
+				static_cast<Replay*>(handle->data)->HandleTimer();
+			}, timeout, 0);
+		}
+
+		void HandleTimer() {
+			if (draining) {
+				Finish();
+				return;
+			}
+			uint64_t now_ms = uv_now(&loop);
+			while (next < records.size()) {
+				const auto& record = records[next];
+				uint64_t due_ms = start_ms + ScaledTimeMs(record);
+				if (due_ms > now_ms)
+					break;
+				stats.max_late_us = std::max(stats.max_late_us, (now_ms - due_ms) * 1000);
+				Play(record);
+				++next;
+			}
+			Schedule();
+		}
+
+		void Play(const TrafficCapture::Record& record) {
+			if (record.kind == TrafficCapture::Kind::OPEN) {
+				Connect(record.connection);
+				return;
+			}
+			const auto& it = clients.find(record.connection);
+			// not captured from the start, or closed by the server
+			if (it == clients.end() || it->second->closed)
+				return;
+			ReplayClient& client = *it->second;
+			if (record.kind == TrafficCapture::Kind::DATA) {
+				if (client.open) {
+					Send(client, record.data);
+				} else {
+					client.pending.push_back(record.data);
+				}
+			} else {
+				client.socket.Close();
+			}
+		}
+
+		void Connect(uint32_t connection) {
+			auto& client_ptr = clients[connection];
+			if (client_ptr)
+				return;
+			client_ptr.reset(new ReplayClient());
+			ReplayClient* client = client_ptr.get();
+			++stats.connections;
+			auto& socket = client->socket;
+			socket.OnInfo = [](std::string_view m) {};
+			socket.OnWarning = [connection](std::string_view m) {
+				Output::Debug("Replay: #{}: {}", connection, m);
+			};
+			socket.OnOpen = [this, client]() {
+				client->open = true;
+				for (const auto& data : client->pending)
+					Send(*client, data);
+				client->pending.clear();
+			};
+			socket.OnClose = [this, client]() {
+				if (!client->open)
+					++stats.failed;
+				client->open = false;
+				client->closed = true;
+			};
+			socket.OnData = [this](std::string_view data) {
+				++stats.frames_in;
+				stats.bytes_in += data.size();
+			};
+			socket.Connect(&loop, host, port);
+		}
+
+		void Send(ReplayClient& client, std::string_view data) {
+			++stats.frames_out;
+			stats.bytes_out += data.size();
+			client.socket.Send(data);
+		}
+
+		// the loop returns once all the sockets are closed
+		void Finish() {
+			end_ms = uv_now(&loop);
+			for (const auto& it : clients) {
+				if (!it.second->closed)
+					it.second->socket.Close();
+			}
+			uv_close(reinterpret_cast<uv_handle_t*>(&timer), nullptr);
+		}
+	};
+
+	void PrintUsage() {
+		Output::Info("Usage: easyrpg-player-replay [--address host:port] [--speed X] "
+			"[--clients N] capture-file");
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	Replay replay;
+	std::string address{ "127.0.0.1:6500" };
+	size_t max_clients = 0;
+
+	const char* short_opts = "a:s:n:h";
+	const option long_opts[] = {
+		{"address", required_argument, nullptr, 'a'},
+		{"speed", required_argument, nullptr, 's'},
+		{"clients", required_argument, nullptr, 'n'},
+		{"help", no_argument, nullptr, 'h'},
+		{nullptr, no_argument, nullptr, 0}
+	};
+
+	while (true) {
+		const auto opt = getopt_long(argc, argv, short_opts, long_opts, nullptr);
+		if (opt == 'a')
+			address = optarg;
+		else if (opt == 's')
+			replay.speed = std::atof(optarg);
+		else if (opt == 'n')
+			max_clients = std::atoi(optarg);
+		else if (opt == 'h') {
+			PrintUsage();
+			return EXIT_SUCCESS;
+		} else
+			break;
+	}
+
+	if (optind >= argc || replay.speed <= 0) {
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	std::string error;
+	if (!TrafficCapture::Read(argv[optind], replay.records, error)) {
+		Output::Warning("Replay: {}", error);
+		return EXIT_FAILURE;
+	}
+
+	// the connections are numbered in the order they were opened
+	if (max_clients > 0) {
+		auto& records = replay.records;
+		records.erase(std::remove_if(records.begin(), records.end(),
+			[max_clients](const auto& record) { return record.connection > max_clients; }),
+			records.end());
+	}
+
+	Multiplayer::Connection::ParseAddress(address, replay.host, replay.port);
+	return replay.Run();
+}
@@ -19,6 +19,7 @@
 #include "plane.h"
 #include "player.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "main_data.h"
 #include "game_map.h"
 #include "drawable_mgr.h"
@@ -30,9 +31,12 @@ Plane::Plane() : Drawable(0)
 }
 
 void Plane::Draw(Bitmap& dst) {
-	if (!bitmap) return;
+	Plane::PrepareBand();
+	Plane::DrawBand(dst);
+}
 
-	if (needs_refresh) {
+bool Plane::PrepareBand() {
+	if (bitmap && needs_refresh) {
 		needs_refresh = false;
 
 		if (!tone_bitmap ||
@@ -44,6 +48,12 @@ void Plane::Draw(Bitmap& dst) {
 		tone_bitmap->ToneBlit(0, 0, *bitmap, bitmap->GetRect(), tone_effect, Opacity::Opaque());
 	}
 
+	return true;
+}
+
+void Plane::DrawBand(Bitmap& dst) const {
+	if (!bitmap) return;
+
 	BitmapRef source = tone_effect == Tone() ? bitmap : tone_bitmap;
 
 	Rect dst_rect = dst.GetRect();
@@ -90,3 +100,20 @@ void Plane::Draw(Bitmap& dst) {
 	dst.TiledBlit(src_x, src_y, source->GetRect(), *source, dst_rect, 255);
 }
 
+bool Plane::GetDamage(Rect& rect, DamageHash& hash) {
+	if (!bitmap) {
+		return true;
+	}
+
+	rect = Rect(0, 0, Player::screen_width, Player::screen_height);
+
+	hash.Add(bitmap).Add(tone_effect).Add(ox).Add(oy).Add(GetRenderOx()).Add(GetRenderOy())
+		.Add(Main_Data::game_screen->GetShakeOffsetX())
+		.Add(Main_Data::game_screen->GetShakeOffsetY())
+		.Add(Game_Map::LoopHorizontal());
+	if (!Game_Map::LoopHorizontal()) {
+		hash.Add(Game_Map::GetDisplayX() / TILE_SIZE).Add(Game_Map::GetTilesX());
+	}
+
+	return true;
+}
@@ -33,6 +33,12 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	bool PrepareBand() override;
+
+	void DrawBand(Bitmap& dst) const override;
+
 	BitmapRef const& GetBitmap() const;
 	void SetBitmap(BitmapRef const& bitmap);
 	int GetOx() const;
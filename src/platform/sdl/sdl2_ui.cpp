@@ -214,6 +214,7 @@ bool Sdl2Ui::vChangeDisplaySurfaceResolution(int new_width, int new_height) {
 	}
 
 	sdl_texture_game = new_sdl_texture_game;
+	display_outdated = true;
 
 	BitmapRef new_main_surface = Bitmap::Create(new_width, new_height, Color(0, 0, 0, 255));
 
@@ -411,6 +412,7 @@ bool Sdl2Ui::RefreshDisplayMode() {
 			Output::Debug("SDL_CreateTexture failed : {}", SDL_GetError());
 			return false;
 		}
+		display_outdated = true;
 
 		renderer_sg.Dismiss();
 		window_sg.Dismiss();
@@ -543,8 +545,25 @@ void Sdl2Ui::ToggleVsync() {
 }
 
 void Sdl2Ui::UpdateDisplay() {
-	// SDL_UpdateTexture was found to be faster than SDL_LockTexture / SDL_UnlockTexture.
-	SDL_UpdateTexture(sdl_texture_game, nullptr, main_surface->pixels(), main_surface->pitch());
+	Rect damage = TakeDisplayDamage();
+	if (display_outdated || window.size_changed) {
+		damage = main_surface->GetRect();
+	}
+
+	if (damage.IsEmpty() && !IsFrameRateSynchronized()) {
+		// Nothing changed and the frame rate is not paced by vsync, the last frame stays on screen
+		return;
+	}
+	display_outdated = false;
+
+	if (!damage.IsEmpty()) {
+		// SDL_UpdateTexture was found to be faster than SDL_LockTexture / SDL_UnlockTexture.
+		// Only the changed part is uploaded, the texture formats are all 32 bit.
+		SDL_Rect damage_rect = { damage.x, damage.y, damage.width, damage.height };
+		auto* pixels = static_cast<uint8_t*>(main_surface->pixels())
+			+ damage.y * main_surface->pitch() + damage.x * sizeof(uint32_t);
+		SDL_UpdateTexture(sdl_texture_game, &damage_rect, pixels, main_surface->pitch());
+	}
 
 	if (window.size_changed && window.width > 0 && window.height > 0) {
 		// Based on SDL2 function UpdateLogicalSize
@@ -690,6 +709,11 @@ void Sdl2Ui::ProcessEvent(SDL_Event &evnt) {
 			Player::exit_flag = true;
 			return;
 
+		case SDL_RENDER_TARGETS_RESET:
+		case SDL_RENDER_DEVICE_RESET:
+			display_outdated = true;
+			return;
+
 		case SDL_KEYDOWN:
 			ProcessKeyDownEvent(evnt);
 			return;
@@ -742,6 +766,9 @@ void Sdl2Ui::ProcessEvent(SDL_Event &evnt) {
 
 void Sdl2Ui::ProcessWindowEvent(SDL_Event &evnt) {
 	int state = evnt.window.event;
+	// The window contents can be lost, the next frame must be uploaded and presented completely
+	display_outdated = true;
+
 #if PAUSE_GAME_WHEN_FOCUS_LOST
 	if (!Player::IsMultiplayerActive() && state == SDL_WINDOWEVENT_FOCUS_LOST) {
 
@@ -149,6 +149,9 @@ private:
 
 	uint32_t texture_format = SDL_PIXELFORMAT_UNKNOWN;
 
+	/** The game texture or the window must be refreshed completely by the next UpdateDisplay */
+	bool display_outdated = true;
+
 	std::unique_ptr<AudioInterface> audio_;
 
 	int old_focused_fps_limit = -1;
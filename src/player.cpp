@@ -209,6 +209,8 @@ void Player::Init(std::vector<std::string> args) {
 	if(! DisplayUi) {
 		DisplayUi = BaseUi::CreateUi(Player::screen_width, Player::screen_height, cfg);
 	}
+	Graphics::SetRenderThreads(cfg.video.render_threads.Get());
+	Cache::SetLimit(static_cast<size_t>(cfg.video.image_cache_size.Get()) * 1024 * 1024);
 
 	Input::Init(cfg.input, replay_input_path, record_input_path);
 	Input::AddRecordingData(Input::RecordingData::CommandLine, command_line);
@@ -219,8 +221,7 @@ void Player::Init(std::vector<std::string> args) {
 void Player::Run() {
 	if (server_flag) {
 		auto signal_handler = [](int signal) {
-			Server().Stop();
-			Output::Debug("Server: signal={}", signal);
+			Server().RequestStop();
 		};
 		std::signal(SIGINT, signal_handler);
 		std::signal(SIGTERM, signal_handler);
@@ -1488,6 +1489,9 @@ Video options:
                        original   - 320x240 (4:3). Recommended
                        widescreen - 416x240 (16:9)
                        ultrawide  - 560x240 (21:9)
+ --image-cache-size N Keep up to N MiB of images loaded. The default is 10.
+ --render-threads N   Draw the screen on N threads. Helps on slow computers
+                      and with higher resolutions. The default is 1.
  --scaling S          How the video output is scaled.
                       Options:
                        nearest  - Scale to screen size. Fast, but causes scaling
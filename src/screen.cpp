@@ -19,8 +19,10 @@
 #include <string>
 #include "bitmap.h"
 #include "color.h"
+#include "damage_tracker.h"
 #include "game_screen.h"
 #include "main_data.h"
+#include "player.h"
 #include "screen.h"
 #include "drawable_mgr.h"
 
@@ -59,3 +61,13 @@ void Screen::Draw(Bitmap& dst) {
 		}
 	}
 }
+
+bool Screen::GetDamage(Rect& rect, DamageHash& hash) {
+	auto flash_color = Main_Data::game_screen->GetFlashColor();
+	if (flash_color.alpha > 0 || viewport != Rect()) {
+		rect = Rect(0, 0, Player::screen_width, Player::screen_height);
+		hash.Add(flash_color).Add(viewport);
+	}
+
+	return true;
+}
@@ -38,6 +38,8 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 	Rect GetViewport() const;
 	void SetViewport(const Rect& rect);
 
@@ -16,12 +16,14 @@
  */
 
 // Headers
+#include <cmath>
 #include <string>
 #include "sprite.h"
 #include "player.h"
 #include "util_macro.h"
 #include "bitmap.h"
 #include "cache.h"
+#include "damage_tracker.h"
 #include "drawable_mgr.h"
 
 // Constructor
@@ -32,39 +34,81 @@ Sprite::Sprite(Drawable::Flags flags) : Drawable(0, flags)
 
 // Draw
 void Sprite::Draw(Bitmap& dst) {
-	if (GetWidth() <= 0 || GetHeight() <= 0) return;
-
-	BlitScreen(dst);
+	Sprite::PrepareBand();
+	Sprite::DrawBand(dst);
+	draw_bitmap.reset();
 }
 
-void Sprite::BlitScreen(Bitmap& dst) {
-	if (!bitmap || (opacity_top_effect <= 0 && opacity_bottom_effect <= 0))
-		return;
+bool Sprite::PrepareBand() {
+	draw_bitmap.reset();
+
+	if (GetWidth() <= 0 || GetHeight() <= 0 || !bitmap || (opacity_top_effect <= 0 && opacity_bottom_effect <= 0)) {
+		return true;
+	}
 
-	BitmapRef draw_bitmap = Refresh(src_rect_effect);
+	draw_bitmap = Refresh(src_rect_effect);
 	if (!draw_bitmap) {
-		return;
+		return true;
 	}
 
 	bitmap_changed = false;
 
-	Rect rect = src_rect_effect.GetSubRect(src_rect);
+	draw_rect = src_rect_effect.GetSubRect(src_rect);
 	if (draw_bitmap == bitmap_effects) {
 		// When a "sprite rect" (src_rect_effect) is used bitmap_effects
 		// only has the size of this subrect instead of the whole bitmap
-		rect.x %= bitmap_effects->GetWidth();
-		rect.y %= bitmap_effects->GetHeight();
+		draw_rect.x %= bitmap_effects->GetWidth();
+		draw_rect.y %= bitmap_effects->GetHeight();
 
 		if (flipx_effect) {
-			rect.x = bitmap_effects->GetWidth() - rect.x - rect.width;
+			draw_rect.x = bitmap_effects->GetWidth() - draw_rect.x - draw_rect.width;
 		}
 
 		if (flipy_effect) {
-			rect.y = bitmap_effects->GetHeight() - rect.y - rect.height;
+			draw_rect.y = bitmap_effects->GetHeight() - draw_rect.y - draw_rect.height;
 		}
 	}
 
-	BlitScreenIntern(dst, *draw_bitmap, rect);
+	return true;
+}
+
+void Sprite::DrawBand(Bitmap& dst) const {
+	if (draw_bitmap) {
+		BlitScreenIntern(dst, *draw_bitmap, draw_rect);
+	}
+}
+
+bool Sprite::GetDamage(Rect& rect, DamageHash& hash) {
+	if (GetWidth() <= 0 || GetHeight() <= 0 || !bitmap || (opacity_top_effect <= 0 && opacity_bottom_effect <= 0)) {
+		// Nothing is drawn
+		return true;
+	}
+
+	const int render_ox = ox - GetRenderOx();
+	const int render_oy = oy - GetRenderOy();
+
+	hash.Add(bitmap).Add(src_rect).Add(src_rect_effect)
+		.Add(x).Add(y).Add(render_ox).Add(render_oy)
+		.Add(opacity_top_effect).Add(opacity_bottom_effect).Add(bush_effect)
+		.Add(tone_effect).Add(flash_effect).Add(flipx_effect).Add(flipy_effect)
+		.Add(zoom_x_effect).Add(zoom_y_effect).Add(angle_effect).Add(blend_type_effect)
+		.Add(waver_effect_depth).Add(waver_effect_phase);
+
+	// Same geometry as Bitmap::EffectsBlit
+	if (angle_effect != 0.0 || waver_effect_depth != 0) {
+		// Not worth computing, rotated and wavy sprites are rare
+		rect = Rect(0, 0, Player::screen_width, Player::screen_height);
+	} else if (zoom_x_effect != 1.0 || zoom_y_effect != 1.0) {
+		rect = Rect(
+			x - static_cast<int>(std::floor(render_ox * zoom_x_effect)),
+			y - static_cast<int>(std::floor(render_oy * zoom_y_effect)),
+			static_cast<int>(std::floor(GetWidth() * zoom_x_effect)),
+			static_cast<int>(std::floor(GetHeight() * zoom_y_effect)));
+	} else {
+		rect = Rect(x - render_ox, y - render_oy, GetWidth(), GetHeight());
+	}
+
+	return true;
 }
 
 void Sprite::BlitScreenIntern(Bitmap& dst, Bitmap const& draw_bitmap, Rect const& src_rect) const
@@ -34,6 +34,13 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	/** Subclasses which override Draw must override this as well */
+	bool PrepareBand() override;
+
+	void DrawBand(Bitmap& dst) const override;
+
 	virtual int GetWidth() const;
 	virtual int GetHeight() const;
 
@@ -138,7 +145,10 @@ private:
 	bool current_flip_y = false;
 	bool bitmap_changed = true;
 
-	void BlitScreen(Bitmap& dst);
+	// result of PrepareBand
+	BitmapRef draw_bitmap;
+	Rect draw_rect;
+
 	void BlitScreenIntern(Bitmap& dst, Bitmap const& draw_bitmap,
 							Rect const& src_rect) const;
 	BitmapRef Refresh(Rect& rect);
@@ -32,6 +32,14 @@ Sprite_Battler::Sprite_Battler(Game_Battler* battler, int index) :
 Sprite_Battler::~Sprite_Battler() {
 }
 
+bool Sprite_Battler::GetDamage(Rect&, DamageHash&) {
+	return false;
+}
+
+bool Sprite_Battler::PrepareBand() {
+	return false;
+}
+
 void Sprite_Battler::ResetZ() {
 	static_assert(Game_Battler::Type_Ally < Game_Battler::Type_Enemy, "Game_Battler enums re-ordered! Fix Z order logic here!");
 
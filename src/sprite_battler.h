@@ -44,6 +44,12 @@ public:
 
 	void SetBattler(Game_Battler* new_battler);
 
+	/** Not tracked, the battler state is applied in Draw */
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	/** Drawn on the main thread, the battler state is applied in Draw */
+	bool PrepareBand() override;
+
 	/**
 	 * Recompute the Z value for the sprite from it's Y coordinate.
 	 */
@@ -60,8 +60,7 @@ void Sprite_Picture::OnPictureShow() {
 
 
 void Sprite_Picture::Draw(Bitmap& dst) {
-	const auto& pic = Main_Data::game_pictures->GetPicture(pic_id);
-	const auto& data = pic.data;
+	const auto& data = Main_Data::game_pictures->GetPicture(pic_id).data;
 
 	auto& bitmap = GetBitmap();
 
@@ -75,10 +74,63 @@ void Sprite_Picture::Draw(Bitmap& dst) {
 		window.window->Draw(*bitmap.get());
 	}
 
+	if (!UpdateFromPicture()) {
+		return;
+	}
+
+	Sprite::Draw(dst);
+}
+
+bool Sprite_Picture::GetDamage(Rect& rect, DamageHash& hash) {
+	const auto& data = Main_Data::game_pictures->GetPicture(pic_id).data;
+
+	if (!GetBitmap()) {
+		return true;
+	}
+
+	if (data.easyrpg_type == lcf::rpg::SavePicture::EasyRpgType_window) {
+		// The window is painted on the picture in every Draw
+		return false;
+	}
+
+	if (!UpdateFromPicture()) {
+		return true;
+	}
+
+	return Sprite::GetDamage(rect, hash);
+}
+
+bool Sprite_Picture::PrepareBand() {
+	const auto& data = Main_Data::game_pictures->GetPicture(pic_id).data;
+
+	if (data.easyrpg_type == lcf::rpg::SavePicture::EasyRpgType_window) {
+		// The window is painted on the picture in Draw
+		return false;
+	}
+
+	band_shown = GetBitmap() && UpdateFromPicture();
+	if (band_shown) {
+		Sprite::PrepareBand();
+	}
+	return true;
+}
+
+void Sprite_Picture::DrawBand(Bitmap& dst) const {
+	if (band_shown) {
+		Sprite::DrawBand(dst);
+	}
+}
+
+bool Sprite_Picture::UpdateFromPicture() {
+	const auto& pic = Main_Data::game_pictures->GetPicture(pic_id);
+	const auto& data = pic.data;
+
+	auto& bitmap = GetBitmap();
+
 	const bool is_battle = Game_Battle::IsBattleRunning();
 
 	if (is_battle ? !pic.IsOnBattle() : !pic.IsOnMap()) {
-		return;
+		return false;
 	}
 
 	// RPG Maker 2k3 1.12: Spritesheets
@@ -159,7 +211,7 @@ void Sprite_Picture::Draw(Bitmap& dst) {
 	SetFlipY((data.easyrpg_flip & lcf::rpg::SavePicture::EasyRpgFlip_y) == lcf::rpg::SavePicture::EasyRpgFlip_y);
 	SetBlendType(data.easyrpg_blend_mode);
 
-	Sprite::Draw(dst);
+	return true;
 }
 
 int Sprite_Picture::GetFrameWidth() const {
@@ -36,6 +36,12 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	bool PrepareBand() override;
+
+	void DrawBand(Bitmap& dst) const override;
+
 	void OnPictureShow();
 
 	/** @return Width of a single spritesheet frame or the entire width if the picture has no spritesheet */
@@ -45,6 +51,15 @@ public:
 	int GetFrameHeight() const;
 
 private:
+	/**
+	 * Applies the state of the picture to the sprite.
+	 *
+	 * @return false when the picture is not shown in the current scene
+	 */
+	bool UpdateFromPicture();
+
+	/** Result of PrepareBand */
+	bool band_shown = false;
 	int last_spritesheet_frame = -1;
 	const int pic_id = 0;
 	const bool feature_spritesheet = false;
@@ -19,6 +19,7 @@
 #include "sprite_timer.h"
 #include "cache.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "game_message.h"
 #include "game_party.h"
 #include "game_system.h"
@@ -87,6 +88,45 @@ void Sprite_Timer::Draw(Bitmap& dst) {
 	digits[3].x = 32 + 8 * secs_10;
 	digits[4].x = 32 + 8 * secs_1;
 
+	UpdatePosition();
+
+	GetBitmap()->Clear();
+	for (int i = 0; i < 5; ++i) {
+		if (i == 2 && !IsColonVisible()) {
+			continue;
+		}
+		GetBitmap()->Blit(i * 8, 0, *system, digits[i], Opacity());
+	}
+
+	Sprite::Draw(dst);
+}
+
+bool Sprite_Timer::GetDamage(Rect& rect, DamageHash& hash) {
+	if (!Main_Data::game_party->GetTimerVisible(which, Game_Battle::IsBattleRunning())) {
+		return true;
+	}
+
+	BitmapRef system = Cache::System();
+	if (!system) {
+		return true;
+	}
+
+	UpdatePosition();
+
+	// The sprite bitmap is redrawn in every Draw, hash what is drawn on it instead
+	rect = Rect(GetX(), GetY(), GetWidth(), GetHeight());
+	hash.Add(rect).Add(system)
+		.Add(Main_Data::game_party->GetTimerSeconds(which))
+		.Add(IsColonVisible());
+
+	return true;
+}
+
+bool Sprite_Timer::PrepareBand() {
+	return false;
+}
+
+void Sprite_Timer::UpdatePosition() {
 	if (Game_Battle::IsBattleRunning()) {
 		SetY((Player::screen_height / 3 * 2) - 20);
 	}
@@ -96,18 +136,10 @@ void Sprite_Timer::Draw(Bitmap& dst) {
 	else {
 		SetY(Player::menu_offset_y + 4);
 	}
+}
 
-	GetBitmap()->Clear();
-	for (int i = 0; i < 5; ++i) {
-		if (i == 2) { // :
-			int frames =  Main_Data::game_party->GetTimerFrames(which);
-			if (frames % DEFAULT_FPS < DEFAULT_FPS / 2) {
-				continue;
-			}
-		}
-		GetBitmap()->Blit(i * 8, 0, *system, digits[i], Opacity());
-	}
-
-	Sprite::Draw(dst);
+bool Sprite_Timer::IsColonVisible() const {
+	int frames = Main_Data::game_party->GetTimerFrames(which);
+	return frames % DEFAULT_FPS >= DEFAULT_FPS / 2;
 }
 
@@ -38,6 +38,16 @@ public:
 protected:
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	bool PrepareBand() override;
+
+	/** Moves the timer out of the way of the message box */
+	void UpdatePosition();
+
+	/** @return whether the colon between minutes and seconds blinks on */
+	bool IsColonVisible() const;
+
 	int which = 0;
 
 	Rect digits[5];
@@ -142,3 +142,11 @@ void Sprite_Weapon::Draw(Bitmap& dst) {
 
 	Sprite::Draw(dst);
 }
+
+bool Sprite_Weapon::GetDamage(Rect&, DamageHash&) {
+	return false;
+}
+
+bool Sprite_Weapon::PrepareBand() {
+	return false;
+}
@@ -54,6 +54,12 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	/** Not tracked, the battler state is applied in Draw */
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
+	/** Drawn on the main thread, the battler state is applied in Draw */
+	bool PrepareBand() override;
+
 protected:
 	void CreateSprite();
 	void OnBattleWeaponReady(FileRequestResult* result, int32_t weapon_index);
@@ -17,6 +17,7 @@
 
 #include "statustext_overlay.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "font.h"
 #include "drawable_mgr.h"
 #include "player.h"
@@ -74,3 +75,16 @@ void StatusTextOverlay::Draw(Bitmap& dst) {
 			Player::screen_height * 0.725, *statustext_bitmap, statustext_rect, 255);
 	}
 }
+
+bool StatusTextOverlay::GetDamage(Rect& rect, DamageHash& hash) {
+	if (!show) {
+		return true;
+	}
+
+	Rect size = Text::GetSize(*Font::DefaultBitmapFont(), text);
+	rect = Rect(Player::screen_width / 2 - ((size.width + 1) / 2),
+		Player::screen_height * 0.725, size.width + 1, size.height - 1);
+	hash.Add(text);
+
+	return true;
+}
@@ -16,6 +16,7 @@
  */
 
 // Headers
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 #include "tilemap_layer.h"
@@ -25,6 +26,7 @@
 #include "main_data.h"
 #include "bitmap.h"
 #include "compiler.h"
+#include "damage_tracker.h"
 #include "game_map.h"
 #include "game_system.h"
 #include "drawable_mgr.h"
@@ -231,18 +233,8 @@ void TilemapLayer::Draw(Bitmap& dst, uint8_t z_order, int render_ox, int render_
 		return rem >= 0 ? rem : m + rem;
 	};
 
-	// FIXME: When Game_Map singleton is made an object we can remove this null check
-	const auto frames = Main_Data::game_system ? Main_Data::game_system->GetFrameCounter() : 0;
-	auto animation_step_c = (frames / 6) % 4;
-	auto animation_step_ab = frames / animation_speed;
-	if (animation_type) {
-		animation_step_ab %= 3;
-	} else {
-		animation_step_ab %= 4;
-		if (animation_step_ab == 3) {
-			animation_step_ab = 1;
-		}
-	}
+	int animation_step_ab, animation_step_c;
+	GetAnimationSteps(animation_step_ab, animation_step_c);
 
 	const int div_ox = div_rounding_down(ox - render_ox, TILE_SIZE);
 	const int div_oy = div_rounding_down(oy - render_oy, TILE_SIZE);
@@ -250,6 +242,13 @@ void TilemapLayer::Draw(Bitmap& dst, uint8_t z_order, int render_ox, int render_
 	const int mod_ox = mod(ox - render_ox, TILE_SIZE);
 	const int mod_oy = mod(oy - render_oy, TILE_SIZE);
 
+	DrawChunks(dst, z_order, div_ox, div_oy, mod_ox, mod_oy, tiles_x, tiles_y, loop_h, loop_v);
+
+	// Only the lower layer has animated tiles
+	if (layer != 0) {
+		return;
+	}
+
 	for (int y = 0; y < tiles_y; y++) {
 		for (int x = 0; x < tiles_x; x++) {
 
@@ -273,90 +272,272 @@ void TilemapLayer::Draw(Bitmap& dst, uint8_t z_order, int render_ox, int render_
 			// Get the tile data
 			TileData &tile = GetDataCache(map_x, map_y);
 
-			// Draw the sublayer if its z is being draw now
-			if (z_order == tile.z) {
-				if (layer == 0) {
-					// If lower layer
-					bool allow_fast_blit = (tile.z == TileBelow);
-
-					if (tile.ID >= BLOCK_E && tile.ID < BLOCK_E + BLOCK_E_TILES) {
-						int id = substitutions[tile.ID - BLOCK_E];
-						// If Block E
-
-						int row, col;
-
-						// Get the tile coordinates from chipset
-						if (id < 96) {
-							// If from first column of the block
-							col = 12 + id % 6;
-							row = id / 6;
-						} else {
-							// If from second column of the block
-							col = 18 + (id - 96) % 6;
-							row = (id - 96) / 6;
-						}
+			// Draw the sublayer if its z is being draw now, the static tiles are in the chunks
+			if (z_order != tile.z || tile.ID >= BLOCK_D) {
+				continue;
+			}
 
-						auto tone_hash = MakeETileHash(id);
-						DrawTile(dst, *chipset, *chipset_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
-					} else if (tile.ID >= BLOCK_C && tile.ID < BLOCK_D) {
-						// If Block C
+			bool allow_fast_blit = (tile.z == TileBelow);
 
-						// Get the tile coordinates from chipset
-						int col = 3 + (tile.ID - BLOCK_C) / 50;
-						int row = 4 + animation_step_c;
+			if (tile.ID >= BLOCK_C) {
+				// If Block C
 
-						auto tone_hash = MakeCTileHash(tile.ID, animation_step_c);
-						DrawTile(dst, *chipset, *chipset_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
-					} else if (tile.ID < BLOCK_C) {
-						// If Blocks A1, A2, B
+				// Get the tile coordinates from chipset
+				int col = 3 + (tile.ID - BLOCK_C) / 50;
+				int row = 4 + animation_step_c;
 
-						// Draw the tile from autotile cache
-						TileXY pos = GetCachedAutotileAB(tile.ID, animation_step_ab);
+				auto tone_hash = MakeCTileHash(tile.ID, animation_step_c);
+				DrawTile(dst, *chipset, *chipset_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
+			} else {
+				// If Blocks A1, A2, B
 
-						int col = pos.x;
-						int row = pos.y;
+				// Draw the tile from autotile cache
+				TileXY pos = GetCachedAutotileAB(tile.ID, animation_step_ab);
 
-						// Create tone changed tile
-						auto tone_hash = MakeAbTileHash(tile.ID,  animation_step_ab);
-						DrawTile(dst, *autotiles_ab_screen, *autotiles_ab_screen_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
-					} else {
-						// If blocks D1-D12
+				int col = pos.x;
+				int row = pos.y;
 
-						// Draw the tile from autotile cache
-						TileXY pos = GetCachedAutotileD(tile.ID);
+				// Create tone changed tile
+				auto tone_hash = MakeAbTileHash(tile.ID,  animation_step_ab);
+				DrawTile(dst, *autotiles_ab_screen, *autotiles_ab_screen_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
+			}
+		}
+	}
+}
 
-						int col = pos.x;
-						int row = pos.y;
+void TilemapLayer::GetAnimationSteps(int& step_ab, int& step_c) const {
+	// FIXME: When Game_Map singleton is made an object we can remove this null check
+	const auto frames = Main_Data::game_system ? Main_Data::game_system->GetFrameCounter() : 0;
+	step_c = (frames / 6) % 4;
+	step_ab = frames / animation_speed;
+	if (animation_type) {
+		step_ab %= 3;
+	} else {
+		step_ab %= 4;
+		if (step_ab == 3) {
+			step_ab = 1;
+		}
+	}
+}
 
-						auto tone_hash = MakeDTileHash(tile.ID);
-						DrawTile(dst, *autotiles_d_screen, *autotiles_d_screen_effect, map_draw_x, map_draw_y, row, col, tone_hash, allow_fast_blit);
-					}
-				} else {
-					// If upper layer
-
-					// Check that block F is being drawn
-					if (tile.ID >= BLOCK_F && tile.ID < BLOCK_F + BLOCK_F_TILES) {
-						int id = substitutions[tile.ID - BLOCK_F];
-						int row, col;
-
-						// Get the tile coordinates from chipset
-						if (id < 48) {
-							// If from first column of the block
-							col = 18 + id % 6;
-							row = 8 + id / 6;
-						} else {
-							// If from second column of the block
-							col = 24 + (id - 48) % 6;
-							row = (id - 48) / 6;
-						}
+void TilemapLayer::AddDamageState(DamageHash& hash, int render_ox, int render_oy) const {
+	hash.Add(chipset).Add(revision).Add(fast_blit)
+		.Add(ox - render_ox).Add(oy - render_oy).Add(width).Add(height)
+		.Add(Game_Map::LoopHorizontal()).Add(Game_Map::LoopVertical());
+
+	// Only the lower layer has animated tiles
+	if (layer == 0 && (has_animated_ab || has_animated_c)) {
+		int animation_step_ab, animation_step_c;
+		GetAnimationSteps(animation_step_ab, animation_step_c);
+		hash.Add(has_animated_ab ? animation_step_ab : 0).Add(has_animated_c ? animation_step_c : 0);
+	}
+}
+
+bool TilemapLayer::IsStaticTile(const TileData& tile) const {
+	if (layer == 0) {
+		// Blocks D and E, A, B and C are animated
+		return tile.ID >= BLOCK_D && tile.ID < BLOCK_E + BLOCK_E_TILES;
+	}
+	return tile.ID >= BLOCK_F && tile.ID < BLOCK_F + BLOCK_F_TILES;
+}
+
+ImageOpacity TilemapLayer::DrawStaticTile(Bitmap& dst, const TileData& tile, int x, int y) {
+	Bitmap* tileset = chipset.get();
+	Bitmap* tone_tileset = chipset_effect.get();
+	int row, col;
+	uint32_t tone_hash;
+	bool allow_fast_blit = true;
+
+	if (layer == 0) {
+		// If lower layer
+		allow_fast_blit = (tile.z == TileBelow);
+
+		if (tile.ID >= BLOCK_E) {
+			int id = substitutions[tile.ID - BLOCK_E];
+			// If Block E
+
+			// Get the tile coordinates from chipset
+			if (id < 96) {
+				// If from first column of the block
+				col = 12 + id % 6;
+				row = id / 6;
+			} else {
+				// If from second column of the block
+				col = 18 + (id - 96) % 6;
+				row = (id - 96) / 6;
+			}
+
+			tone_hash = MakeETileHash(id);
+		} else {
+			// If blocks D1-D12
+
+			// Draw the tile from autotile cache
+			TileXY pos = GetCachedAutotileD(tile.ID);
+
+			col = pos.x;
+			row = pos.y;
+
+			tileset = autotiles_d_screen.get();
+			tone_tileset = autotiles_d_screen_effect.get();
+			tone_hash = MakeDTileHash(tile.ID);
+		}
+	} else {
+		// If upper layer, block F
+		int id = substitutions[tile.ID - BLOCK_F];
+
+		// Get the tile coordinates from chipset
+		if (id < 48) {
+			// If from first column of the block
+			col = 18 + id % 6;
+			row = 8 + id / 6;
+		} else {
+			// If from second column of the block
+			col = 24 + (id - 48) % 6;
+			row = (id - 48) / 6;
+		}
+
+		tone_hash = MakeFTileHash(id);
+	}
+
+	auto op = tileset->GetTileOpacity(col, row);
+	if (op != ImageOpacity::Transparent) {
+		DrawTileImpl(dst, *tileset, *tone_tileset, x, y, row, col, tone_hash, op, allow_fast_blit);
+	}
+	return op;
+}
+
+TilemapLayer::Chunk& TilemapLayer::GetChunk(int chunk_x, int chunk_y, uint8_t z_order) {
+	for (auto& chunk : chunks) {
+		if (chunk.x == chunk_x && chunk.y == chunk_y && chunk.z == z_order) {
+			chunk.last_draw = draw_count;
+			return chunk;
+		}
+	}
+
+	Chunk& chunk = chunks.emplace_back();
+	chunk.x = chunk_x;
+	chunk.y = chunk_y;
+	chunk.z = z_order;
+	chunk.last_draw = draw_count;
+	BuildChunk(chunk);
+	return chunk;
+}
+
+void TilemapLayer::BuildChunk(Chunk& chunk) {
+	const int first_x = chunk.x * CHUNK_TILES;
+	const int first_y = chunk.y * CHUNK_TILES;
+	const int tiles_x = std::min(CHUNK_TILES, width - first_x);
+	const int tiles_y = std::min(CHUNK_TILES, height - first_y);
+
+	chunk.empty = true;
+	chunk.opaque = true;
+	chunk.bitmap.reset();
+
+	for (int y = 0; y < tiles_y; y++) {
+		for (int x = 0; x < tiles_x; x++) {
+			const TileData& tile = GetDataCache(first_x + x, first_y + y);
+			if (tile.z != chunk.z || !IsStaticTile(tile)) {
+				chunk.opaque = false;
+				continue;
+			}
+
+			if (!chunk.bitmap) {
+				chunk.bitmap = Bitmap::Create(tiles_x * TILE_SIZE, tiles_y * TILE_SIZE, true);
+				chunk.bitmap->Clear();
+			}
+			auto op = DrawStaticTile(*chunk.bitmap, tile, x * TILE_SIZE, y * TILE_SIZE);
+			if (op != ImageOpacity::Transparent) {
+				chunk.empty = false;
+			}
+			if (op != ImageOpacity::Opaque) {
+				chunk.opaque = false;
+			}
+		}
+	}
+
+	if (chunk.empty) {
+		chunk.bitmap.reset();
+	}
+}
+
+void TilemapLayer::GetChunkSpans(std::vector<ChunkSpan>& spans, int first, int count, int size, bool loop) {
+	spans.clear();
+	for (int i = 0; i < count; i++) {
+		int map = first + i;
+		if (loop) {
+			map %= size;
+			if (map < 0) map += size;
+		}
+		if (map < 0 || map >= size) {
+			continue;
+		}
 
-						auto tone_hash = MakeFTileHash(id);
-						DrawTile(dst, *chipset, *chipset_effect, map_draw_x, map_draw_y, row, col, tone_hash);
+		if (!spans.empty()) {
+			auto& span = spans.back();
+			if (span.tile + span.count == i && span.map + span.count == map && map % CHUNK_TILES != 0) {
+				++span.count;
+				continue;
+			}
+		}
+		spans.push_back({ i, map, 1 });
+	}
+}
+
+void TilemapLayer::DrawChunks(Bitmap& dst, uint8_t z_order, int div_ox, int div_oy, int mod_ox, int mod_oy,
+		int tiles_x, int tiles_y, bool loop_h, bool loop_v) {
+	++draw_count;
+
+	GetChunkSpans(chunk_spans_x, div_ox, tiles_x, width, loop_h);
+	GetChunkSpans(chunk_spans_y, div_oy, tiles_y, height, loop_v);
+
+	// The tone is changing, the chunks would be built again every frame
+	const bool direct = draw_count - tone_change_draw <= 2;
+
+	for (const auto& span_y : chunk_spans_y) {
+		for (const auto& span_x : chunk_spans_x) {
+			if (direct) {
+				for (int y = 0; y < span_y.count; y++) {
+					for (int x = 0; x < span_x.count; x++) {
+						const TileData& tile = GetDataCache(span_x.map + x, span_y.map + y);
+						if (tile.z == z_order && IsStaticTile(tile)) {
+							DrawStaticTile(dst, tile, (span_x.tile + x) * TILE_SIZE - mod_ox,
+								(span_y.tile + y) * TILE_SIZE - mod_oy);
+						}
 					}
 				}
+				continue;
+			}
+
+			const Chunk& chunk = GetChunk(span_x.map / CHUNK_TILES, span_y.map / CHUNK_TILES, z_order);
+			if (chunk.empty) {
+				continue;
+			}
+
+			auto rect = Rect{
+				(span_x.map % CHUNK_TILES) * TILE_SIZE, (span_y.map % CHUNK_TILES) * TILE_SIZE,
+				span_x.count * TILE_SIZE, span_y.count * TILE_SIZE };
+			int x = span_x.tile * TILE_SIZE - mod_ox;
+			int y = span_y.tile * TILE_SIZE - mod_oy;
+
+			// Tiles drawn with fast blit are copied into the chunk, the transparent
+			// pixels of the chipset keep what is below instead of erasing it
+			if (chunk.opaque) {
+				dst.BlitFast(x, y, *chunk.bitmap, rect, 255);
+			} else {
+				dst.Blit(x, y, *chunk.bitmap, rect, 255);
 			}
 		}
 	}
+
+	// Drop the chunks that scrolled out of view a while ago
+	chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [this](const Chunk& chunk) {
+		return draw_count - chunk.last_draw > CHUNK_KEEP_DRAWS;
+	}), chunks.end());
+}
+
+void TilemapLayer::InvalidateChunks() {
+	chunks.clear();
+	++revision;
 }
 
 TilemapLayer::TileXY TilemapLayer::GetCachedAutotileAB(short ID, short animID) {
@@ -374,6 +555,8 @@ TilemapLayer::TileXY TilemapLayer::GetCachedAutotileD(short ID) {
 
 void TilemapLayer::CreateTileCache(const std::vector<short>& nmap_data) {
 	data_cache_vec.resize(width * height);
+	has_animated_ab = false;
+	has_animated_c = false;
 	for (int x = 0; x < width; x++) {
 		for (int y = 0; y < height; y++) {
 			TileData tile;
@@ -381,6 +564,11 @@ void TilemapLayer::CreateTileCache(const std::vector<short>& nmap_data) {
 			// Get the tile ID
 			tile.ID = nmap_data[x + y * width];
 
+			if (layer == 0) {
+				has_animated_ab |= tile.ID < BLOCK_C;
+				has_animated_c |= tile.ID >= BLOCK_C && tile.ID < BLOCK_D;
+			}
+
 			tile.z = TileBelow;
 
 			// Calculate the tile Z
@@ -612,6 +800,7 @@ void TilemapLayer::SetChipset(BitmapRef const& nchipset) {
 	chipset = nchipset;
 	chipset_effect = Bitmap::Create(chipset->width(), chipset->height());
 	chipset_tone_tiles.clear();
+	InvalidateChunks();
 
 	if (autotiles_ab_next != 0 && autotiles_d_screen != nullptr && layer == 0) {
 		autotiles_ab_screen = GenerateAutotiles(autotiles_ab_next, autotiles_ab_map);
@@ -659,6 +848,7 @@ void TilemapLayer::SetMapData(std::vector<short> nmap_data) {
 	}
 
 	map_data = std::move(nmap_data);
+	InvalidateChunks();
 }
 
 void TilemapLayer::SetPassable(std::vector<unsigned char> npassable) {
@@ -666,6 +856,7 @@ void TilemapLayer::SetPassable(std::vector<unsigned char> npassable) {
 
 	// Recalculate z values of all tiles
 	CreateTileCache(map_data);
+	InvalidateChunks();
 }
 
 void TilemapLayer::OnSubstitute() {
@@ -673,6 +864,7 @@ void TilemapLayer::OnSubstitute() {
 
 	// Recalculate z values of all tiles
 	CreateTileCache(map_data);
+	InvalidateChunks();
 }
 
 TilemapSubLayer::TilemapSubLayer(TilemapLayer* tilemap, Drawable::Z_t z) :
@@ -691,6 +883,17 @@ void TilemapSubLayer::Draw(Bitmap& dst) {
 	tilemap->Draw(dst, internal_z, GetRenderOx(), GetRenderOy());
 }
 
+bool TilemapSubLayer::GetDamage(Rect& rect, DamageHash& hash) {
+	if (!tilemap->GetChipset()) {
+		return true;
+	}
+
+	rect = Rect(0, 0, Player::screen_width, Player::screen_height);
+	tilemap->AddDamageState(hash, GetRenderOx(), GetRenderOy());
+
+	return true;
+}
+
 void TilemapLayer::SetTone(Tone tone) {
 	if (tone == this->tone) {
 		return;
@@ -708,4 +911,6 @@ void TilemapLayer::SetTone(Tone tone) {
 		chipset_effect->Clear();
 	}
 	chipset_tone_tiles.clear();
+	InvalidateChunks();
+	tone_change_draw = draw_count;
 }
@@ -41,6 +41,8 @@ public:
 
 	void Draw(Bitmap& dst) override;
 
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 private:
 	TilemapLayer* tilemap = nullptr;
 
@@ -62,6 +64,15 @@ public:
 
 	void Draw(Bitmap& dst, uint8_t z_order, int render_ox, int render_oy);
 
+	/**
+	 * Adds the state which affects Draw to the hash, see Drawable::GetDamage.
+	 *
+	 * @param hash damage hash
+	 * @param render_ox x offset for the rendering
+	 * @param render_oy y offset for the rendering
+	 */
+	void AddDamageState(DamageHash& hash, int render_ox, int render_oy) const;
+
 	BitmapRef const& GetChipset() const;
 	void SetChipset(BitmapRef const& nchipset);
 	const std::vector<short>& GetMapData() const;
@@ -113,8 +124,14 @@ private:
 	int animation_type = 0;
 	int layer = 0;
 	bool fast_blit = false;
+	// the map has tiles of the animated blocks A, B and C
+	bool has_animated_ab = false;
+	bool has_animated_c = false;
+	// changed by every change of the tiles or the tone, for the damage tracking
+	uint32_t revision = 0;
 
 	void CreateTileCache(const std::vector<short>& nmap_data);
+	void GetAnimationSteps(int& step_ab, int& step_c) const;
 	void GenerateAutotileAB(short ID, short animID);
 	void GenerateAutotileD(short ID);
 	void DrawTile(Bitmap& dst, Bitmap& tile, Bitmap& tone_tile, int x, int y, int row, int col, uint32_t tone_hash, bool allow_fast_blit = true);
@@ -161,6 +178,55 @@ private:
 	TilemapSubLayer upper_layer;
 
 	Tone tone;
+
+	/**
+	 * Static tile chunks
+	 *  The tiles that never animate (blocks D, E and F) are drawn once into
+	 *  a bitmap per chunk of CHUNK_TILES x CHUNK_TILES tiles and z-order,
+	 *  Draw blits the visible parts of the chunks and draws the animated
+	 *  tiles (blocks A, B and C) on top. The chunks are built when they
+	 *  become visible, dropped when they were not drawn for
+	 *  CHUNK_KEEP_DRAWS calls of Draw and all invalidated by any change of
+	 *  the chipset, the tiles, the passability or the tone.
+	 *  During tone transitions the static tiles are drawn one by one.
+	 */
+	static constexpr int CHUNK_TILES = 16;
+	static constexpr uint32_t CHUNK_KEEP_DRAWS = 120;
+
+	struct Chunk {
+		int x;
+		int y;
+		uint8_t z;
+		BitmapRef bitmap;
+		// no static tile of this z-order in the chunk
+		bool empty;
+		// every tile of the chunk is static and opaque
+		bool opaque;
+		uint32_t last_draw;
+	};
+
+	// consecutive tiles of one axis that are in the same chunk
+	struct ChunkSpan {
+		int tile;
+		int map;
+		int count;
+	};
+
+	std::vector<Chunk> chunks;
+	std::vector<ChunkSpan> chunk_spans_x;
+	std::vector<ChunkSpan> chunk_spans_y;
+	uint32_t draw_count = 0;
+	// draw_count of the last tone change, the chunks are not used while it changes
+	uint32_t tone_change_draw = 0;
+
+	static void GetChunkSpans(std::vector<ChunkSpan>& spans, int first, int count, int size, bool loop);
+	bool IsStaticTile(const TileData& tile) const;
+	ImageOpacity DrawStaticTile(Bitmap& dst, const TileData& tile, int x, int y);
+	Chunk& GetChunk(int chunk_x, int chunk_y, uint8_t z_order);
+	void BuildChunk(Chunk& chunk);
+	void DrawChunks(Bitmap& dst, uint8_t z_order, int div_ox, int div_oy, int mod_ox, int mod_oy,
+		int tiles_x, int tiles_y, bool loop_h, bool loop_v);
+	void InvalidateChunks();
 };
 
 inline BitmapRef const& TilemapLayer::GetChipset() const {
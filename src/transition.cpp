@@ -174,6 +174,10 @@ void Transition::SetAttributesTransitions() {
 	}
 }
 
+bool Transition::GetDamage(Rect&, DamageHash&) {
+	return !IsActive();
+}
+
 void Transition::Draw(Bitmap& dst) {
 	if (!IsActive())
 		return;
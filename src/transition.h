@@ -108,6 +108,10 @@ public:
 	void PrependFlashes(int r, int g, int b, int power, int duration, int iterations);
 
 	void Draw(Bitmap& dst) override;
+
+	/** Only tracked while inactive */
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 	void Update();
 
 	bool IsActive() const;
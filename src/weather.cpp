@@ -62,6 +62,10 @@ void Weather::Draw(Bitmap& dst) {
 	}
 }
 
+bool Weather::GetDamage(Rect&, DamageHash&) {
+	return Main_Data::game_screen->GetWeatherType() == Game_Screen::Weather_None;
+}
+
 static constexpr int num_strength = 3;
 static constexpr int num_rain_or_snow_particles[] = { 20, 60, 100 };
 static constexpr auto rain_bitmap_rect = Rect{ 0, 0, 6, 24 };
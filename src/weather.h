@@ -33,6 +33,10 @@ public:
 	Weather();
 
 	void Draw(Bitmap& dst) override;
+
+	/** Only tracked without weather, the particles move every frame */
+	bool GetDamage(Rect& rect, DamageHash& hash) override;
+
 	void Update();
 
 	Tone GetTone() const;
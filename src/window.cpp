@@ -23,6 +23,7 @@
 #include "util_macro.h"
 #include "window.h"
 #include "bitmap.h"
+#include "damage_tracker.h"
 #include "drawable_mgr.h"
 
 constexpr int pause_animation_frames = 20;
@@ -167,6 +168,34 @@ void Window::Draw(Bitmap& dst) {
 	}
 }
 
+bool Window::GetDamage(Rect& rect, DamageHash& hash) {
+	if (width <= 0 || height <= 0) {
+		return true;
+	}
+
+	rect = Rect(x, y, width, height);
+
+	const bool draw_cursor = windowskin && width >= 16 && height > 16 && cursor_rect.width > 4 && cursor_rect.height > 4 && animation_frames == 0;
+	if (draw_cursor) {
+		// The cursor can leave the window by the border size
+		rect = DamageTracker::Bounds({ rect,
+			Rect(x + cursor_rect.x + border_x, y + cursor_rect.y + border_y, cursor_rect.width, cursor_rect.height) });
+	}
+
+	hash.Add(windowskin).Add(contents).Add(stretch)
+		.Add(x).Add(y).Add(width).Add(height).Add(ox).Add(oy).Add(border_x).Add(border_y)
+		.Add(opacity).Add(frame_opacity).Add(back_opacity).Add(contents_opacity)
+		.Add(up_arrow).Add(down_arrow).Add(left_arrow).Add(right_arrow)
+		.Add(pause && pause_frame < pause_animation_frames)
+		.Add(animation_frames > 0).Add(static_cast<int>(animation_count));
+
+	if (draw_cursor) {
+		hash.Add(cursor_rect).Add(cursor_frame <= 10);
+	}
+
+	return true;
+}
+
 void Window::RefreshBackground() {
 	background_needs_refresh = false;
 
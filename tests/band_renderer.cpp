@@ -0,0 +1,97 @@
+#include <cstring>
+#include "band_renderer.h"
+#include "drawable_list.h"
+#include "drawable_mgr.h"
+#include "bitmap.h"
+#include "doctest.h"
+
+TEST_SUITE_BEGIN("BandRenderer");
+
+namespace {
+
+class TestRect : public Drawable {
+	public:
+		TestRect(Drawable::Z_t z, Rect rect, Color color, bool band)
+			: Drawable(z, Drawable::Flags::Global), rect(rect), color(color), band(band) {}
+
+		void Draw(Bitmap& dst) override {
+			++draws;
+			dst.FillRect(rect, color);
+		}
+
+		bool PrepareBand() override {
+			return band;
+		}
+
+		void DrawBand(Bitmap& dst) const override {
+			dst.FillRect(rect, color);
+		}
+
+		Rect rect;
+		Color color;
+		bool band;
+		int draws = 0;
+};
+
+bool SamePixels(Bitmap& l, Bitmap& r) {
+	return std::memcmp(l.pixels(), r.pixels(), l.pitch() * l.height()) == 0;
+}
+
+}
+
+TEST_CASE("SameAsList") {
+	Bitmap::SetFormat(format_R8G8B8A8_a().format());
+	Bitmap expected(64, 100, false);
+	Bitmap result(64, 100, false);
+
+	DrawableList default_list;
+	DrawableMgr::SetLocalList(&default_list);
+
+	DrawableList list;
+	TestRect r1(1, Rect(0, 0, 64, 100), Color(10, 20, 30, 255), true);
+	TestRect r2(2, Rect(5, 10, 40, 70), Color(255, 0, 0, 128), true);
+	TestRect r3(3, Rect(20, 30, 30, 30), Color(0, 255, 0, 200), false);
+	TestRect r4(4, Rect(0, 50, 64, 3), Color(0, 0, 255, 255), true);
+	list.Append(&r1);
+	list.Append(&r2);
+	list.Append(&r3);
+	list.Append(&r4);
+
+	list.Draw(expected);
+
+	BandRenderer renderer(4);
+	REQUIRE_EQ(renderer.GetThreads(), 4);
+
+	SUBCASE("whole screen") {
+		renderer.Draw(list, result, 0, 10);
+		REQUIRE(SamePixels(expected, result));
+		// only the drawable without band support is drawn on the calling thread
+		REQUIRE_EQ(r3.draws, 2);
+		REQUIRE_EQ(r1.draws, 1);
+	}
+
+	SUBCASE("clipped") {
+		result.Fill(Color(1, 2, 3, 255));
+		result.SetClipRects({ Rect(0, 0, 64, 100) });
+		renderer.Draw(list, result, 0, 10);
+		result.ResetClip();
+		REQUIRE(SamePixels(expected, result));
+
+		// drawing outside of the clip rectangles changes nothing
+		Bitmap before(64, 100, false);
+		before.BlitFast(0, 0, result, result.GetRect(), Opacity::Opaque());
+		r4.color = Color(255, 255, 255, 255);
+		result.SetClipRects({ Rect(0, 0, 10, 10) });
+		renderer.Draw(list, result, 0, 10);
+		result.ResetClip();
+		REQUIRE(SamePixels(before, result));
+	}
+
+	SUBCASE("revision") {
+		auto revision = result.GetRevision();
+		renderer.Draw(list, result, 0, 10);
+		REQUIRE_NE(result.GetRevision(), revision);
+	}
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,110 @@
+#include "bitmap_effects.h"
+#include "doctest.h"
+#include <random>
+#include <vector>
+
+TEST_SUITE_BEGIN("BitmapEffects");
+
+using namespace BitmapEffects;
+
+namespace {
+constexpr Backend backends[] = { Backend::SSE2, Backend::AVX2, Backend::NEON };
+
+// 37 pixels to also cover the scalar tail of the vector kernels
+std::vector<uint32_t> MakePixels(const ToneParams& params) {
+	std::mt19937 rng(1);
+	std::vector<uint32_t> pixels(37);
+	for (size_t i = 0; i < pixels.size(); ++i) {
+		uint32_t alpha = i % 3 == 0 ? 0 : i % 3 == 1 ? 255 : rng() & 0xFF;
+		pixels[i] = (rng() & ~(0xFFu << params.as)) | (alpha << params.as);
+	}
+	return pixels;
+}
+
+void testTone(ToneParams params) {
+	auto pixels = MakePixels(params);
+	auto expected = pixels;
+	auto backend = GetBackend();
+
+	REQUIRE(SetBackend(Backend::Scalar));
+	ToneRow(expected.data(), expected.size(), params);
+
+	for (auto b: backends) {
+		if (!SetBackend(b)) {
+			continue;
+		}
+		CAPTURE(GetBackendName(b));
+		auto result = pixels;
+		ToneRow(result.data(), result.size(), params);
+		REQUIRE_EQ(result, expected);
+	}
+
+	SetBackend(backend);
+}
+
+void testAlphaModes(ToneParams params) {
+	for (auto alpha: { AlphaMode::Opaque, AlphaMode::Alpha_1Bit, AlphaMode::Alpha_8Bit }) {
+		params.alpha = alpha;
+		testTone(params);
+	}
+}
+}
+
+TEST_CASE("ScalarIsSupported") {
+	REQUIRE(IsSupported(Backend::Scalar));
+	REQUIRE(IsSupported(GetBackend()));
+}
+
+TEST_CASE("Saturation") {
+	ToneParams params;
+	params.rs = 24;
+	params.gs = 16;
+	params.bs = 8;
+	params.as = 0;
+	params.apply_sat = true;
+
+	SUBCASE("gray") {
+		params.sat = 0;
+		testAlphaModes(params);
+	}
+	SUBCASE("strong") {
+		params.sat = 1024 + 127 * 16;
+		testAlphaModes(params);
+	}
+}
+
+TEST_CASE("Tone") {
+	ToneParams params;
+	params.rs = 0;
+	params.gs = 8;
+	params.bs = 16;
+	params.as = 24;
+	params.apply_tone = true;
+	params.red = 0;
+	params.green = 129;
+	params.blue = 255;
+	testAlphaModes(params);
+
+	SUBCASE("saturation") {
+		params.apply_sat = true;
+		params.sat = 77 * 8;
+		testAlphaModes(params);
+	}
+}
+
+TEST_CASE("Hue") {
+	// transparent and gray pixels keep their color
+	std::vector<uint32_t> pixels = { 0xFF000000, 0x12345600, 0x808080FF, 0xFFFFFF80, 0xFF0000FF };
+	HueRow(pixels.data(), pixels.size(), 0x200);
+	REQUIRE_EQ(pixels[0], 0xFF000000);
+	REQUIRE_EQ(pixels[1], 0x12345600);
+	REQUIRE_EQ(pixels[2], 0x808080FF);
+	REQUIRE_EQ(pixels[3], 0xFFFFFF80);
+	// red rotated by 120 degrees, about green
+	REQUIRE_LT(pixels[4] >> 24, 0x08);
+	REQUIRE_GT((pixels[4] >> 16) & 0xFF, 0xF8);
+	REQUIRE_LT((pixels[4] >> 8) & 0xFF, 0x08);
+	REQUIRE_EQ(pixels[4] & 0xFF, 0xFF);
+}
+
+TEST_SUITE_END();
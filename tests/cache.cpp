@@ -0,0 +1,111 @@
+#include "cache.h"
+#include "bitmap.h"
+#include "game_clock.h"
+#include "doctest.h"
+
+using namespace std::chrono_literals;
+
+TEST_SUITE_BEGIN("Cache");
+
+namespace {
+
+BitmapRef FlipX(const BitmapRef& src) {
+	return Cache::SpriteEffect(src, src->GetRect(), true, false, Tone(), Color());
+}
+
+BitmapRef FlipY(const BitmapRef& src) {
+	return Cache::SpriteEffect(src, src->GetRect(), false, true, Tone(), Color());
+}
+
+}
+
+TEST_CASE("SpriteEffect") {
+	Bitmap::SetFormat(format_R8G8B8A8_a().format());
+	Cache::Clear();
+
+	auto src = Bitmap::Create(16, 16, true);
+	auto stats = Cache::GetStats();
+
+	auto flip_x = FlipX(src);
+	REQUIRE(flip_x);
+	REQUIRE_EQ(Cache::GetStats().misses, stats.misses + 1);
+
+	REQUIRE_EQ(FlipX(src), flip_x);
+	REQUIRE_EQ(Cache::GetStats().hits, stats.hits + 1);
+
+	REQUIRE_NE(FlipY(src), flip_x);
+	REQUIRE_EQ(Cache::GetStats().entries, 2);
+	REQUIRE_EQ(Cache::GetStats().bytes, 2 * flip_x->GetSize());
+
+	Cache::Clear();
+	REQUIRE_EQ(Cache::GetStats().entries, 0);
+	REQUIRE_EQ(Cache::GetStats().bytes, 0);
+}
+
+TEST_CASE("Eviction") {
+	Bitmap::SetFormat(format_R8G8B8A8_a().format());
+	Cache::Clear();
+
+	auto src = Bitmap::Create(16, 16, true);
+	auto start = Game_Clock::now();
+	Game_Clock::ResetFrame(start);
+
+	auto flip_x = FlipX(src);
+	Cache::SetLimit(flip_x->GetSize());
+	auto evictions = Cache::GetStats().evictions;
+
+	SUBCASE("unreferenced") {
+		flip_x.reset();
+		Game_Clock::ResetFrame(start + 1s);
+		FlipY(src);
+
+		REQUIRE_EQ(Cache::GetStats().evictions, evictions + 1);
+		REQUIRE_EQ(Cache::GetStats().entries, 1);
+
+		// evicted bitmaps are created again
+		auto misses = Cache::GetStats().misses;
+		FlipX(src);
+		REQUIRE_EQ(Cache::GetStats().misses, misses + 1);
+	}
+
+	SUBCASE("referenced") {
+		Game_Clock::ResetFrame(start + 1s);
+		FlipY(src);
+
+		REQUIRE_EQ(Cache::GetStats().evictions, evictions);
+		REQUIRE_EQ(Cache::GetStats().entries, 2);
+	}
+
+	SUBCASE("recently used") {
+		flip_x.reset();
+		FlipY(src);
+
+		REQUIRE_EQ(Cache::GetStats().evictions, evictions);
+		REQUIRE_EQ(Cache::GetStats().entries, 2);
+	}
+
+	SUBCASE("least recently used first") {
+		flip_x.reset();
+		Game_Clock::ResetFrame(start + 1s);
+		FlipY(src);
+
+		Cache::SetLimit(2 * src->GetSize());
+		Game_Clock::ResetFrame(start + 2s);
+		FlipX(src);
+		Game_Clock::ResetFrame(start + 3s);
+		// touches flip_y, flip_x becomes the least recently used
+		FlipY(src);
+		Cache::SetLimit(src->GetSize());
+
+		auto misses = Cache::GetStats().misses;
+		FlipY(src);
+		REQUIRE_EQ(Cache::GetStats().misses, misses);
+		FlipX(src);
+		REQUIRE_EQ(Cache::GetStats().misses, misses + 1);
+	}
+
+	Cache::SetLimit(Cache::default_limit);
+	Cache::Clear();
+}
+
+TEST_SUITE_END();
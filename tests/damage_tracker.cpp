@@ -0,0 +1,140 @@
+#include "damage_tracker.h"
+#include "drawable_list.h"
+#include "drawable_mgr.h"
+#include "bitmap.h"
+#include "doctest.h"
+
+TEST_SUITE_BEGIN("DamageTracker");
+
+namespace {
+
+class TestDrawable : public Drawable {
+	public:
+		TestDrawable(Drawable::Z_t z, Rect rect) : Drawable(z, Drawable::Flags::Global), rect(rect) {}
+		void Draw(Bitmap&) override {}
+		bool GetDamage(Rect& r, DamageHash& hash) override {
+			if (!tracked) {
+				return false;
+			}
+			r = rect;
+			hash.Add(state);
+			return true;
+		}
+
+		Rect rect;
+		int state = 0;
+		bool tracked = true;
+};
+
+}
+
+TEST_CASE("MergeOverlapping") {
+	std::vector<Rect> rects = { { 0, 0, 10, 10 }, { 5, 5, 10, 10 }, { 40, 40, 4, 4 }, {} };
+	DamageTracker::Merge(rects);
+
+	REQUIRE_EQ(rects.size(), 2);
+	REQUIRE_EQ(rects[0], Rect(0, 0, 15, 15));
+	REQUIRE_EQ(rects[1], Rect(40, 40, 4, 4));
+}
+
+TEST_CASE("MergeChained") {
+	// the first merge makes the result overlap the last rectangle
+	std::vector<Rect> rects = { { 0, 0, 4, 4 }, { 20, 0, 4, 4 }, { 2, 2, 4, 4 }, { 5, 0, 16, 1 } };
+	DamageTracker::Merge(rects);
+
+	REQUIRE_EQ(rects.size(), 1);
+	REQUIRE_EQ(rects[0], Rect(0, 0, 24, 6));
+}
+
+TEST_CASE("MergeTooMany") {
+	std::vector<Rect> rects;
+	for (int i = 0; i <= DamageTracker::max_rects; ++i) {
+		rects.push_back(Rect(i * 10, i, 2, 2));
+	}
+	DamageTracker::Merge(rects);
+
+	REQUIRE_EQ(rects.size(), 1);
+	REQUIRE_EQ(rects[0], Rect(0, 0, DamageTracker::max_rects * 10 + 2, DamageTracker::max_rects + 2));
+}
+
+TEST_CASE("Collect") {
+	Bitmap::SetFormat(format_R8G8B8A8_a().format());
+	Bitmap screen(64, 64, false);
+
+	DrawableList default_list;
+	DrawableMgr::SetLocalList(&default_list);
+
+	DrawableList list;
+	TestDrawable d1(1, Rect(0, 0, 8, 8));
+	TestDrawable d2(2, Rect(32, 32, 8, 8));
+	list.Append(&d1);
+	list.Append(&d2);
+
+	DamageTracker tracker;
+
+	SUBCASE("first frame") {
+		auto& damage = tracker.Collect(list, screen, 0);
+		REQUIRE_EQ(damage.size(), 1);
+		REQUIRE_EQ(damage[0], screen.GetRect());
+	}
+
+	tracker.Collect(list, screen, 0);
+	tracker.Drawn(screen);
+
+	SUBCASE("unchanged") {
+		REQUIRE(tracker.Collect(list, screen, 0).empty());
+	}
+
+	SUBCASE("state changed") {
+		d2.state = 1;
+		auto& damage = tracker.Collect(list, screen, 0);
+		REQUIRE_EQ(damage.size(), 1);
+		REQUIRE_EQ(damage[0], Rect(32, 32, 8, 8));
+	}
+
+	SUBCASE("moved") {
+		d1.rect = Rect(4, 4, 8, 8);
+		auto& damage = tracker.Collect(list, screen, 0);
+		REQUIRE_EQ(damage.size(), 1);
+		REQUIRE_EQ(damage[0], Rect(0, 0, 12, 12));
+	}
+
+	SUBCASE("hidden") {
+		d1.SetVisible(false);
+		auto& damage = tracker.Collect(list, screen, 0);
+		REQUIRE_EQ(damage.size(), 1);
+		REQUIRE_EQ(damage[0], Rect(0, 0, 8, 8));
+	}
+
+	SUBCASE("untracked") {
+		d1.tracked = false;
+		REQUIRE_EQ(tracker.Collect(list, screen, 0).front(), screen.GetRect());
+		tracker.Drawn(screen);
+
+		// the area of the untracked drawable is unknown
+		d1.tracked = true;
+		REQUIRE_EQ(tracker.Collect(list, screen, 0).front(), screen.GetRect());
+	}
+
+	SUBCASE("background changed") {
+		REQUIRE_EQ(tracker.Collect(list, screen, 1).front(), screen.GetRect());
+	}
+
+	SUBCASE("screen changed") {
+		screen.Fill(Color(255, 0, 0, 255));
+		REQUIRE_EQ(tracker.Collect(list, screen, 0).front(), screen.GetRect());
+	}
+
+	SUBCASE("reordered") {
+		d1.SetZ(3);
+		list.SetDirty();
+		REQUIRE_EQ(tracker.Collect(list, screen, 0).front(), screen.GetRect());
+	}
+
+	SUBCASE("reset") {
+		tracker.Reset();
+		REQUIRE_EQ(tracker.Collect(list, screen, 0).front(), screen.GetRect());
+	}
+}
+
+TEST_SUITE_END();
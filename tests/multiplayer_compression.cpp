@@ -0,0 +1,42 @@
+#include "multiplayer/compression.h"
+#include "doctest.h"
+
+TEST_SUITE_BEGIN("MultiplayerCompression");
+
+using namespace FrameCompression;
+
+TEST_CASE("RoundTrip") {
+	Deflater deflater;
+	Inflater inflater;
+	std::string compressed;
+	std::string out;
+
+	for (std::string data: { std::string("mv 12 3 mv 12 4"), std::string(),
+			std::string(MAX_OUTPUT_SIZE, 'a') }) {
+		REQUIRE(deflater.Compress(data, compressed));
+		REQUIRE(IsCompressed(compressed));
+		REQUIRE(inflater.Decompress(compressed, out));
+		REQUIRE_EQ(out, data);
+	}
+}
+
+TEST_CASE("Bomb") {
+	Deflater deflater;
+	Inflater inflater;
+	std::string compressed;
+	std::string out;
+
+	// a few KiB that inflate to 1 MiB
+	REQUIRE(deflater.Compress(std::string(1 << 20, '\0'), compressed));
+	REQUIRE_LT(compressed.size(), MAX_OUTPUT_SIZE);
+
+	REQUIRE_FALSE(inflater.Decompress(compressed, out));
+	REQUIRE(out.empty());
+	REQUIRE_EQ(out.capacity(), std::string().capacity());
+
+	// the connection is closed, the stream is not used anymore
+	REQUIRE(deflater.Compress("m", compressed));
+	REQUIRE_FALSE(inflater.Decompress(compressed, out));
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,102 @@
+#include "multiplayer/connection.h"
+#include "multiplayer/messages.h"
+#include "doctest.h"
+
+TEST_SUITE_BEGIN("MultiplayerPacket");
+
+using namespace Multiplayer;
+using namespace Messages;
+
+namespace {
+
+// sends the packets back to itself
+class LoopbackConnection : public Connection {
+public:
+	void Receive() {
+		Dispatch(sent);
+	}
+
+protected:
+	void Open() override {}
+	void Close() override {}
+	void Send(std::string_view data) override {
+		sent = std::string(data);
+	}
+
+private:
+	std::string sent;
+};
+
+Game_Pictures::ShowParams RoundTrip(const Game_Pictures::ShowParams& params, int protocol) {
+	LoopbackConnection connection;
+	connection.SetProtocol(protocol);
+
+	Game_Pictures::ShowParams result;
+	bool received = false;
+	connection.RegisterHandler<ShowPicturePacket>([&](ShowPicturePacket& p) {
+		result = p.params;
+		received = true;
+	});
+
+	connection.SendPacket(ShowPicturePacket(12, 3, params, 0, 0, 0, 0));
+	connection.Receive();
+	REQUIRE(received);
+	return result;
+}
+
+}
+
+TEST_CASE("ShowPictureBool") {
+	for (int protocol: { Packet::PROTOCOL_TEXT, Packet::PROTOCOL_BINARY }) {
+		CAPTURE(protocol);
+		for (int flags = 0; flags < 4; ++flags) {
+			Game_Pictures::ShowParams params;
+			params.name = "pic";
+			params.use_transparent_color = (flags & 1) != 0;
+			params.fixed_to_map = (flags & 2) != 0;
+
+			auto result = RoundTrip(params, protocol);
+			REQUIRE_EQ(result.name, params.name);
+			if (protocol == Packet::PROTOCOL_BINARY) {
+				REQUIRE_EQ(result.use_transparent_color, params.use_transparent_color);
+				REQUIRE_EQ(result.fixed_to_map, params.fixed_to_map);
+			} else {
+				// protocol 1 reads "0" as true, the text clients rely on it
+				REQUIRE(result.use_transparent_color);
+				REQUIRE(result.fixed_to_map);
+			}
+		}
+	}
+}
+
+TEST_CASE("GatewayPacketFromClient") {
+	for (int protocol: { Packet::PROTOCOL_TEXT, Packet::PROTOCOL_BINARY }) {
+		CAPTURE(protocol);
+		LoopbackConnection connection;
+		connection.SetProtocol(protocol);
+
+		std::vector<GatewayPacket> received;
+		connection.RegisterHandler<GatewayPacket>([&](GatewayPacket& p) {
+			received.push_back(p);
+		});
+
+		// the players do not know the secret of the cluster
+		connection.SendPacket(GatewayPacket(GatewayPacket::TYPE_RELAY, ""));
+		connection.Receive();
+		connection.SendPacket(GatewayPacket(GatewayPacket::TYPE_HANDOFF_IN, "guess"));
+		connection.Receive();
+		connection.SendPacket(GatewayPacket(GatewayPacket::TYPE_HANDOFF_OUT, "secret"));
+		connection.Receive();
+
+		REQUIRE_EQ(received.size(), 3);
+		REQUIRE_FALSE(received[0].IsAuthorized("secret"));
+		REQUIRE_FALSE(received[1].IsAuthorized("secret"));
+		REQUIRE(received[2].IsAuthorized("secret"));
+		REQUIRE_EQ(received[2].type, GatewayPacket::TYPE_HANDOFF_OUT);
+
+		// without a configured secret nobody is the gateway
+		REQUIRE_FALSE(received[0].IsAuthorized(""));
+	}
+}
+
+TEST_SUITE_END();